@@ -0,0 +1,273 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Image analysis (binarization, minutiae detection and rendering) runs on
+ * a worker thread so that it never stalls USB event handling or painting
+ * in the main loop. Results are posted back to the main loop. Thumbnails
+ * are made the same way, on a thread of their own. */
+
+#include <gtk/gtk.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <libfprint/fprint.h>
+
+#include "fprint_demo.h"
+
+/* The NBIS code behind libfprint's binarization and minutiae detection is
+ * not known to be reentrant. Analysis jobs are run one at a time, and each
+ * NBIS call is made under nbis_lock(), which other worker threads calling
+ * into NBIS take too. */
+#define ANALYSIS_THREADS 1
+
+struct img_analysis_job {
+	struct img_analysis *analysis;
+	img_analysis_cb callback;
+	void *user_data;
+	volatile gint cancelled;
+};
+
+static GThreadPool *analysis_pool = NULL;
+
+struct img_thumbnail_job {
+	struct fp_img *img;
+	int max_size;
+	GdkPixbuf *pixbuf;
+	img_thumbnail_cb callback;
+	void *user_data;
+	volatile gint cancelled;
+};
+
+static GThreadPool *thumbnail_pool = NULL;
+
+void img_analysis_free(struct img_analysis *analysis)
+{
+	int i, j;
+
+	if (!analysis)
+		return;
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < 2; j++)
+			if (analysis->pixbufs[i][j])
+				g_object_unref(analysis->pixbufs[i][j]);
+
+	/* minlist belongs to img */
+	fp_img_free(analysis->img_bin);
+	fp_img_free(analysis->img);
+	g_slice_free(struct img_analysis, analysis);
+}
+
+static GdkPixbuf *render_with_minutiae(struct img_analysis *analysis,
+	GdkPixbuf *base)
+{
+	int width = analysis->width;
+	int height = analysis->height;
+	unsigned char *rgbdata;
+
+	rgbdata = g_memdup(gdk_pixbuf_get_pixels(base), width * height * 3);
+	plot_minutiae(rgbdata, width, height, analysis->minlist,
+		analysis->nr_minutiae);
+	return gdk_pixbuf_new_from_data(rgbdata, GDK_COLORSPACE_RGB, FALSE, 8,
+		width, height, width * 3, pixbuf_destroy, NULL);
+}
+
+#define job_cancelled(job) g_atomic_int_get(&(job)->cancelled)
+
+/* runs in the main loop */
+static gboolean analysis_complete(gpointer data)
+{
+	struct img_analysis_job *job = data;
+
+	if (job_cancelled(job))
+		img_analysis_free(job->analysis);
+	else
+		job->callback(job->analysis, job->user_data);
+
+	g_slice_free(struct img_analysis_job, job);
+	return FALSE;
+}
+
+/* runs on the worker thread */
+static void analysis_run(gpointer data, gpointer user_data)
+{
+	struct img_analysis_job *job = data;
+	struct img_analysis *analysis = job->analysis;
+
+	if (job_cancelled(job))
+		goto out;
+	nbis_lock();
+	analysis->img_bin = fp_img_binarize(analysis->img);
+	nbis_unlock();
+
+	if (job_cancelled(job))
+		goto out;
+	nbis_lock();
+	analysis->minlist = fp_img_get_minutiae(analysis->img,
+		&analysis->nr_minutiae);
+	nbis_unlock();
+
+	if (job_cancelled(job))
+		goto out;
+	analysis->pixbufs[0][0] = img_to_pixbuf(analysis->img);
+	if (analysis->img_bin)
+		analysis->pixbufs[1][0] = img_to_pixbuf(analysis->img_bin);
+
+	if (job_cancelled(job))
+		goto out;
+	analysis->pixbufs[0][1] = render_with_minutiae(analysis,
+		analysis->pixbufs[0][0]);
+	if (analysis->img_bin)
+		analysis->pixbufs[1][1] = render_with_minutiae(analysis,
+			analysis->pixbufs[1][0]);
+
+out:
+	g_idle_add(analysis_complete, job);
+}
+
+/* Start analysing img in the background. Ownership of img passes to the
+ * analysis, which is handed to callback in the main loop. The returned
+ * job remains valid until the callback has run or the job is cancelled. */
+struct img_analysis_job *img_analysis_submit(struct fp_img *img,
+	img_analysis_cb callback, void *user_data)
+{
+	struct img_analysis_job *job = g_slice_new0(struct img_analysis_job);
+	struct img_analysis *analysis = g_slice_new0(struct img_analysis);
+
+	analysis->img = img;
+	analysis->width = fp_img_get_width(img);
+	analysis->height = fp_img_get_height(img);
+
+	job->analysis = analysis;
+	job->callback = callback;
+	job->user_data = user_data;
+
+	if (!analysis_pool)
+		analysis_pool = g_thread_pool_new(analysis_run, NULL,
+			ANALYSIS_THREADS, FALSE, NULL);
+	g_thread_pool_push(analysis_pool, job, NULL);
+	return job;
+}
+
+/* The callback will not be called and the analysis will be discarded.
+ * Must be called from the main loop. */
+void img_analysis_cancel(struct img_analysis_job *job)
+{
+	g_atomic_int_set(&job->cancelled, 1);
+}
+
+/* Scale img down to fit in max_size square, averaging each block of source
+ * pixels into one. Images already small enough are left at their size. */
+static GdkPixbuf *render_thumbnail(struct fp_img *img, int max_size)
+{
+	int width = fp_img_get_width(img);
+	int height = fp_img_get_height(img);
+	unsigned char *src = fp_img_get_data(img);
+	int longest = MAX(width, height);
+	int twidth = width;
+	int theight = height;
+	unsigned char *gray;
+	unsigned char *rgbdata;
+	int x, y;
+
+	if (longest > max_size) {
+		twidth = MAX(1, width * max_size / longest);
+		theight = MAX(1, height * max_size / longest);
+	}
+
+	gray = g_malloc(twidth * theight);
+	for (y = 0; y < theight; y++) {
+		int y0 = y * height / theight;
+		int y1 = MAX(y0 + 1, (y + 1) * height / theight);
+		for (x = 0; x < twidth; x++) {
+			int x0 = x * width / twidth;
+			int x1 = MAX(x0 + 1, (x + 1) * width / twidth);
+			unsigned int sum = 0;
+			int sx, sy;
+
+			for (sy = y0; sy < y1; sy++)
+				for (sx = x0; sx < x1; sx++)
+					sum += src[sy * width + sx];
+			gray[y * twidth + x] = sum / ((y1 - y0) * (x1 - x0));
+		}
+	}
+
+	rgbdata = g_malloc(twidth * theight * 3);
+	gray_to_rgb(rgbdata, gray, twidth * theight);
+	g_free(gray);
+	return gdk_pixbuf_new_from_data(rgbdata, GDK_COLORSPACE_RGB, FALSE, 8,
+		twidth, theight, twidth * 3, pixbuf_destroy, NULL);
+}
+
+/* runs in the main loop */
+static gboolean thumbnail_complete(gpointer data)
+{
+	struct img_thumbnail_job *job = data;
+
+	if (job_cancelled(job))
+		g_object_unref(job->pixbuf);
+	else
+		job->callback(job->pixbuf, job->user_data);
+
+	g_slice_free(struct img_thumbnail_job, job);
+	return FALSE;
+}
+
+/* runs on the worker thread */
+static void thumbnail_run(gpointer data, gpointer user_data)
+{
+	struct img_thumbnail_job *job = data;
+
+	if (!job_cancelled(job))
+		job->pixbuf = render_thumbnail(job->img, job->max_size);
+	fp_img_free(job->img);
+	job->img = NULL;
+
+	if (job->pixbuf)
+		g_idle_add(thumbnail_complete, job);
+	else
+		g_slice_free(struct img_thumbnail_job, job);
+}
+
+/* Make a thumbnail of img, no larger than max_size in either direction, in
+ * the background. Ownership of img passes to the job, which frees it once
+ * the thumbnail exists. The thumbnail is handed to callback, which takes
+ * over its reference, in the main loop. The returned job remains valid
+ * until the callback has run or the job is cancelled. */
+struct img_thumbnail_job *img_thumbnail_submit(struct fp_img *img,
+	int max_size, img_thumbnail_cb callback, void *user_data)
+{
+	struct img_thumbnail_job *job = g_slice_new0(struct img_thumbnail_job);
+
+	job->img = img;
+	job->max_size = max_size;
+	job->callback = callback;
+	job->user_data = user_data;
+
+	if (!thumbnail_pool)
+		thumbnail_pool = g_thread_pool_new(thumbnail_run, NULL, 1, FALSE,
+			NULL);
+	g_thread_pool_push(thumbnail_pool, job, NULL);
+	return job;
+}
+
+/* The callback will not be called and the thumbnail will be discarded.
+ * Must be called from the main loop. */
+void img_thumbnail_cancel(struct img_thumbnail_job *job)
+{
+	g_atomic_int_set(&job->cancelled, 1);
+}
@@ -0,0 +1,986 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* fprint_batch: headless driver which runs back-to-back verify or identify
+ * operations on one device and reports per-operation latency and aggregate
+ * throughput. Uses the same GSource integration as the GUI but no GTK+.
+ * Identification can also be run against a multi-user gallery, optionally
+ * at a series of gallery sizes to measure how latency scales, and on
+ * imaging devices the matching can be done in software while the next
+ * image is being captured.
+ * 
+ * The images delivered can be recorded, and a recording replayed through
+ * the image pipeline (binarization, minutiae detection and rendering)
+ * without a reader, either as fast as possible or with the timing it was
+ * captured with. Given a mode, the replayed images then stand in for
+ * captures and are matched in software like those of --software, which
+ * needs the reader to stamp the templates and pick the enrolled prints. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+enum batch_mode {
+	MODE_VERIFY,
+	MODE_IDENTIFY,
+};
+
+static enum batch_mode mode = MODE_VERIFY;
+static GMainLoop *loop;
+static struct fp_dev *dev = NULL;
+static int exit_status = 0;
+
+/* verify: the single enrolled print being verified against */
+static struct fp_print_data *enroll_data = NULL;
+static int enroll_finger = -1;
+
+/* identify: NULL-terminated gallery and the finger of each entry */
+static struct fp_print_data **gallery = NULL;
+static int *fingnum = NULL;
+
+/* identify: multi-user gallery, used instead of the above when given */
+static struct gallery *store = NULL;
+
+/* latency figures, per gallery size when sweeping */
+struct batch_stats {
+	unsigned int gallery_size;
+	int ops;
+	int matches;
+	double lat_min;
+	double lat_max;
+	double lat_total;
+};
+
+static struct batch_stats *sweep = NULL;
+static int nr_sweep = 0;
+static int cur_sweep = 0;
+
+/* identify --software: the image of one operation is matched while the
+ * next one is captured. A second captured image waits in held_op until
+ * the matcher is free, which keeps gallery_prints() changes safe. */
+struct sw_op {
+	int seq;
+	double start;
+	struct fp_img *img;
+};
+
+/* verify --replay: the enrolled print as a gallery of one */
+static struct fp_print_data *verify_gallery[2];
+
+static int captures_started = 0;
+static gboolean capture_running = FALSE;
+static gboolean match_busy = FALSE;
+static gboolean sw_failed = FALSE;
+static struct sw_op *held_op = NULL;
+
+static GTimer *op_timer;
+static GTimer *run_timer;
+static int ops_done = 0;
+static int nr_matches = 0;
+static double lat_min = 0.0;
+static double lat_max = 0.0;
+static double lat_total = 0.0;
+
+static gchar *opt_mode = NULL;
+static int opt_device = 0;
+static int opt_count = 10;
+static int opt_finger = 0;
+static gchar *opt_gallery = NULL;
+static gchar *opt_sizes = NULL;
+static gboolean opt_software = FALSE;
+static gchar *opt_write_pack = NULL;
+static gchar *opt_record = NULL;
+static gchar *opt_replay = NULL;
+static gboolean opt_realtime = FALSE;
+static int opt_start = 0;
+
+static struct frame_writer *recorder = NULL;
+
+static GOptionEntry entries[] = {
+	{ "mode", 'm', 0, G_OPTION_ARG_STRING, &opt_mode,
+		"Operation to run: verify (default) or identify", "MODE" },
+	{ "device", 'd', 0, G_OPTION_ARG_INT, &opt_device,
+		"Index of the discovered device to use (default 0)", "N" },
+	{ "count", 'n', 0, G_OPTION_ARG_INT, &opt_count,
+		"Number of operations to run (default 10)", "N" },
+	{ "finger", 'f', 0, G_OPTION_ARG_INT, &opt_finger,
+		"Finger to verify, 1-10 (default: first enrolled)", "N" },
+	{ "gallery", 'g', 0, G_OPTION_ARG_FILENAME, &opt_gallery,
+		"Identify against the multi-user gallery in DIR", "DIR" },
+	{ "sizes", 's', 0, G_OPTION_ARG_STRING, &opt_sizes,
+		"With --gallery, run COUNT identifications at each of these "
+		"gallery sizes", "N,N,..." },
+	{ "software", 'S', 0, G_OPTION_ARG_NONE, &opt_software,
+		"Identify by capturing images and matching them in software "
+		"(imaging devices only)", NULL },
+	{ "write-pack", 'w', 0, G_OPTION_ARG_FILENAME, &opt_write_pack,
+		"Pack the gallery directory given with --gallery into FILE and exit",
+		"FILE" },
+	{ "record", 'r', 0, G_OPTION_ARG_FILENAME, &opt_record,
+		"Record the images delivered by the device to FILE", "FILE" },
+	{ "replay", 'R', 0, G_OPTION_ARG_FILENAME, &opt_replay,
+		"Run the images recorded in FILE through the image pipeline, "
+		"and with --mode through the software matcher", "FILE" },
+	{ "realtime", 't', 0, G_OPTION_ARG_NONE, &opt_realtime,
+		"With --replay, keep the recorded timing between images", NULL },
+	{ "start", 'b', 0, G_OPTION_ARG_INT, &opt_start,
+		"With --replay, start at image N, counting from 0", "N" },
+	{ NULL }
+};
+
+static const char *result_str(int result)
+{
+	switch (result) {
+	case FP_VERIFY_NO_MATCH:
+		return "no-match";
+	case FP_VERIFY_MATCH:
+		return "match";
+	case FP_VERIFY_RETRY:
+		return "retry";
+	case FP_VERIFY_RETRY_TOO_SHORT:
+		return "retry-too-short";
+	case FP_VERIFY_RETRY_CENTER_FINGER:
+		return "retry-center-finger";
+	case FP_VERIFY_RETRY_REMOVE_FINGER:
+		return "retry-remove-finger";
+	default:
+		return "error";
+	}
+}
+
+static void batch_quit(int status)
+{
+	exit_status = status;
+	g_main_loop_quit(loop);
+}
+
+static void start_op(void);
+
+static int total_ops(void)
+{
+	return opt_count * MAX(nr_sweep, 1);
+}
+
+static void op_stopped_cb(struct fp_dev *_dev, void *user_data)
+{
+	if (++ops_done >= total_ops()) {
+		batch_quit(0);
+		return;
+	}
+
+	if (sweep && ops_done % opt_count == 0) {
+		cur_sweep++;
+		printf("Gallery size %u\n", sweep[cur_sweep].gallery_size);
+	}
+	start_op();
+}
+
+static void stats_add(struct batch_stats *stats, int result, double ms)
+{
+	if (stats->ops == 0 || ms < stats->lat_min)
+		stats->lat_min = ms;
+	if (ms > stats->lat_max)
+		stats->lat_max = ms;
+	stats->lat_total += ms;
+	stats->ops++;
+	if (result == FP_VERIFY_MATCH)
+		stats->matches++;
+}
+
+/* record the latency of the operation that just completed */
+static void op_done(int result, double ms, const char *user_id, int fnum)
+{
+	if (ops_done == 0 || ms < lat_min)
+		lat_min = ms;
+	if (ms > lat_max)
+		lat_max = ms;
+	lat_total += ms;
+	if (result == FP_VERIFY_MATCH)
+		nr_matches++;
+	if (sweep)
+		stats_add(&sweep[cur_sweep], result, ms);
+
+	if (result < 0)
+		printf("%5d  %-20s %10.2f ms  (error %d)\n", ops_done + 1,
+			result_str(result), ms, result);
+	else if (user_id)
+		printf("%5d  %-20s %10.2f ms  (user %s, finger %d)\n", ops_done + 1,
+			result_str(result), ms, user_id, fnum);
+	else if (fnum > 0)
+		printf("%5d  %-20s %10.2f ms  (finger %d)\n", ops_done + 1,
+			result_str(result), ms, fnum);
+	else
+		printf("%5d  %-20s %10.2f ms\n", ops_done + 1, result_str(result), ms);
+	fflush(stdout);
+}
+
+static void record_img(enum frame_source source, int finger, int result,
+	struct fp_img *img)
+{
+	if (!recorder || !img)
+		return;
+
+	if (frame_writer_add(recorder, dev, source, finger, result, img) < 0) {
+		g_printerr("Could not record image, recording stopped\n");
+		frame_writer_close(recorder);
+		recorder = NULL;
+	}
+}
+
+static void verify_cb(struct fp_dev *_dev, int result, struct fp_img *img,
+	void *user_data)
+{
+	int r;
+
+	op_done(result, g_timer_elapsed(op_timer, NULL) * 1000.0, NULL, -1);
+	record_img(FRAME_VERIFY, enroll_finger, result, img);
+	fp_img_free(img);
+
+	r = fp_async_verify_stop(_dev, op_stopped_cb, NULL);
+	if (r < 0)
+		op_stopped_cb(_dev, NULL);
+}
+
+static int matched_finger(int result, size_t match_offset)
+{
+	if (result != FP_VERIFY_MATCH)
+		return -1;
+	if (store)
+		return gallery_lookup(store, match_offset)->finger;
+	return fingnum[match_offset];
+}
+
+static void identify_done(int result, double ms, size_t match_offset)
+{
+	if (result != FP_VERIFY_MATCH || mode == MODE_VERIFY) {
+		op_done(result, ms, NULL, -1);
+	} else if (store) {
+		const struct gallery_entry *entry = gallery_lookup(store,
+			match_offset);
+		op_done(result, ms, entry->user_id, entry->finger);
+	} else {
+		op_done(result, ms, NULL, fingnum[match_offset]);
+	}
+}
+
+static void identify_cb(struct fp_dev *_dev, int result, size_t match_offset,
+	struct fp_img *img, void *user_data)
+{
+	int r;
+
+	identify_done(result, g_timer_elapsed(op_timer, NULL) * 1000.0,
+		match_offset);
+	record_img(FRAME_IDENTIFY, matched_finger(result, match_offset), result,
+		img);
+	fp_img_free(img);
+
+	r = fp_async_identify_stop(_dev, op_stopped_cb, NULL);
+	if (r < 0)
+		op_stopped_cb(_dev, NULL);
+}
+
+static void start_op(void)
+{
+	int r;
+
+	g_timer_start(op_timer);
+	if (mode == MODE_VERIFY)
+		r = fp_async_verify_start(dev, enroll_data, verify_cb, NULL);
+	else if (store)
+		r = fp_async_identify_start(dev, gallery_prints(store,
+			sweep ? sweep[cur_sweep].gallery_size : 0), identify_cb, NULL);
+	else
+		r = fp_async_identify_start(dev, gallery, identify_cb, NULL);
+
+	if (r < 0) {
+		g_printerr("Could not start operation %d, error %d\n", ops_done + 1, r);
+		batch_quit(1);
+	}
+}
+
+static void start_image(void);
+static void sw_submit(struct sw_op *op);
+
+static void match_done_cb(int result, size_t match_offset, void *user_data)
+{
+	struct sw_op *op = user_data;
+	double ms = (g_timer_elapsed(run_timer, NULL) - op->start) * 1000.0;
+
+	match_busy = FALSE;
+	identify_done(result, ms, match_offset);
+	g_slice_free(struct sw_op, op);
+
+	if (++ops_done >= total_ops()) {
+		batch_quit(0);
+		return;
+	}
+
+	if (held_op) {
+		op = held_op;
+		held_op = NULL;
+		sw_submit(op);
+	} else if (sw_failed) {
+		batch_quit(1);
+		return;
+	}
+
+	if (!capture_running && !sw_failed && captures_started < total_ops())
+		start_image();
+}
+
+static void sw_submit(struct sw_op *op)
+{
+	struct fp_print_data **prints = gallery;
+	int r;
+
+	if (mode == MODE_VERIFY) {
+		verify_gallery[0] = enroll_data;
+		prints = verify_gallery;
+	} else if (store) {
+		if (sweep) {
+			cur_sweep = op->seq / opt_count;
+			if (op->seq > 0 && op->seq % opt_count == 0)
+				printf("Gallery size %u\n", sweep[cur_sweep].gallery_size);
+		}
+		prints = gallery_prints(store,
+			sweep ? sweep[cur_sweep].gallery_size : 0);
+	}
+
+	match_busy = TRUE;
+	r = sw_match_submit(dev, op->img, prints, match_done_cb, op);
+	if (r < 0) {
+		g_printerr("Could not start matching, error %d\n", r);
+		batch_quit(1);
+	}
+}
+
+static void capture_stopped_cb(struct fp_dev *_dev, void *user_data)
+{
+	capture_running = FALSE;
+	if (!held_op && !sw_failed && captures_started < total_ops())
+		start_image();
+}
+
+static void capture_cb(struct fp_dev *_dev, int result, struct fp_img *img,
+	void *user_data)
+{
+	struct sw_op *op = user_data;
+	int r;
+
+	if (result < 0 || !img) {
+		g_printerr("Capture %d failed, error %d\n", op->seq + 1, result);
+		g_slice_free(struct sw_op, op);
+		fp_img_free(img);
+		sw_failed = TRUE;
+		if (!match_busy)
+			batch_quit(1);
+	} else {
+		record_img(FRAME_CAPTURE, -1, result, img);
+		op->img = img;
+		if (match_busy)
+			held_op = op;
+		else
+			sw_submit(op);
+	}
+
+	r = fp_async_capture_stop(_dev, capture_stopped_cb, NULL);
+	if (r < 0)
+		capture_stopped_cb(_dev, NULL);
+}
+
+static void start_capture(void)
+{
+	struct sw_op *op = g_slice_new0(struct sw_op);
+	int r;
+
+	op->seq = captures_started++;
+	op->start = g_timer_elapsed(run_timer, NULL);
+	capture_running = TRUE;
+	r = fp_async_capture_start(dev, 0, capture_cb, op);
+	if (r < 0) {
+		g_printerr("Could not start capture %d, error %d\n", op->seq + 1, r);
+		g_slice_free(struct sw_op, op);
+		capture_running = FALSE;
+		sw_failed = TRUE;
+		if (!match_busy)
+			batch_quit(1);
+	}
+}
+
+/* load the print(s) that the operations will be run against */
+static int load_prints(void)
+{
+	struct fp_dscv_print **dprints;
+	struct fp_dscv_print *dprint;
+	int nr_prints = 0;
+	int r = 0;
+	int i;
+
+	dprints = fp_discover_prints();
+	if (!dprints) {
+		g_printerr("Error loading enrolled prints\n");
+		return -1;
+	}
+
+	for (i = 0; (dprint = dprints[i]); i++)
+		if (fp_dev_supports_dscv_print(dev, dprint))
+			nr_prints++;
+
+	if (mode == MODE_IDENTIFY) {
+		gallery = g_malloc0(sizeof(*gallery) * (nr_prints + 1));
+		fingnum = g_malloc(sizeof(*fingnum) * (nr_prints + 1));
+	}
+
+	nr_prints = 0;
+	for (i = 0; (dprint = dprints[i]); i++) {
+		struct fp_print_data *data;
+		int fnum;
+
+		if (!fp_dev_supports_dscv_print(dev, dprint))
+			continue;
+
+		fnum = fp_dscv_print_get_finger(dprint);
+		if (mode == MODE_VERIFY && opt_finger && fnum != opt_finger)
+			continue;
+
+		r = fp_print_data_from_dscv_print(dprint, &data);
+		if (r < 0) {
+			g_printerr("Could not load print for finger %d, error %d\n",
+				fnum, r);
+			goto out;
+		}
+
+		if (mode == MODE_VERIFY) {
+			enroll_data = data;
+			enroll_finger = fnum;
+			printf("Verifying against finger %d\n", fnum);
+			break;
+		}
+
+		gallery[nr_prints] = data;
+		fingnum[nr_prints] = fnum;
+		nr_prints++;
+	}
+
+	if ((mode == MODE_VERIFY && !enroll_data)
+			|| (mode == MODE_IDENTIFY && nr_prints == 0)) {
+		g_printerr("No suitable enrolled prints for this device\n");
+		r = -1;
+	} else if (mode == MODE_IDENTIFY) {
+		printf("Identifying against %d enrolled print(s)\n", nr_prints);
+	}
+
+out:
+	fp_dscv_prints_free(dprints);
+	return r;
+}
+
+/* load the multi-user gallery and work out the sizes to run at */
+static int load_gallery(void)
+{
+	gchar **sizes;
+	int i;
+
+	store = gallery_load(opt_gallery, dev);
+	if (!store) {
+		g_printerr("Could not read gallery %s\n", opt_gallery);
+		return -1;
+	}
+	if (gallery_size(store) == 0) {
+		g_printerr("Gallery has no suitable prints for this device\n");
+		return -1;
+	}
+	printf("Identifying against %u print(s) from %u user(s)\n",
+		gallery_size(store), gallery_nr_users(store));
+
+	if (!opt_sizes)
+		return 0;
+
+	sizes = g_strsplit(opt_sizes, ",", 0);
+	sweep = g_new0(struct batch_stats, g_strv_length(sizes));
+	for (i = 0; sizes[i]; i++) {
+		int size = atoi(sizes[i]);
+		if (size <= 0)
+			continue;
+		sweep[nr_sweep++].gallery_size = MIN((unsigned int) size,
+			gallery_size(store));
+	}
+	g_strfreev(sizes);
+
+	if (nr_sweep == 0) {
+		g_printerr("No valid gallery sizes in '%s'\n", opt_sizes);
+		return -1;
+	}
+	printf("Gallery size %u\n", sweep[0].gallery_size);
+	return 0;
+}
+
+static void dev_open_cb(struct fp_dev *_dev, int status, void *user_data)
+{
+	if (status) {
+		g_printerr("Could not open device, error %d\n", status);
+		batch_quit(1);
+		return;
+	}
+
+	dev = _dev;
+	if (opt_software && !fp_dev_supports_imaging(dev)) {
+		g_printerr("Software matching needs an imaging device\n");
+		batch_quit(1);
+		return;
+	} else if (mode == MODE_IDENTIFY && !opt_software
+			&& !fp_dev_supports_identification(dev)) {
+		g_printerr("Device does not support identification\n");
+		batch_quit(1);
+		return;
+	}
+
+	if ((opt_gallery ? load_gallery() : load_prints()) < 0) {
+		batch_quit(1);
+		return;
+	}
+
+	if (opt_record) {
+		recorder = frame_writer_open(opt_record);
+		if (!recorder) {
+			g_printerr("Could not create %s\n", opt_record);
+			batch_quit(1);
+			return;
+		}
+	}
+
+	run_timer = g_timer_new();
+	if (opt_software)
+		start_image();
+	else
+		start_op();
+}
+
+static void print_summary(void)
+{
+	double secs;
+	int i;
+
+	if (!run_timer || ops_done == 0)
+		return;
+
+	secs = g_timer_elapsed(run_timer, NULL);
+	printf("\n%d operation(s) in %.3f s: %.2f ops/sec, %d match(es)\n",
+		ops_done, secs, ops_done / secs, nr_matches);
+	printf("latency min/avg/max: %.2f / %.2f / %.2f ms\n",
+		lat_min, lat_total / ops_done, lat_max);
+
+	if (!sweep)
+		return;
+
+	printf("\n%12s %6s %8s %10s %10s %10s\n", "gallery size", "ops",
+		"matches", "min ms", "avg ms", "max ms");
+	for (i = 0; i < nr_sweep; i++) {
+		struct batch_stats *stats = &sweep[i];
+		if (stats->ops == 0)
+			continue;
+		printf("%12u %6d %8d %10.2f %10.2f %10.2f\n", stats->gallery_size,
+			stats->ops, stats->matches, stats->lat_min,
+			stats->lat_total / stats->ops, stats->lat_max);
+	}
+}
+
+static void free_prints(void)
+{
+	int i;
+
+	fp_print_data_free(enroll_data);
+	if (gallery) {
+		for (i = 0; gallery[i]; i++)
+			fp_print_data_free(gallery[i]);
+		g_free(gallery);
+	}
+	g_free(fingnum);
+	gallery_free(store);
+	g_free(sweep);
+}
+
+/* replay: each recorded image is timed through the stages of the pipeline
+ * fprint_demo runs on a scan. With a device open, the image is then handed
+ * to the software matcher as if it had just been captured. */
+enum replay_stage {
+	STAGE_LOAD,
+	STAGE_BINARIZE,
+	STAGE_MINUTIAE,
+	STAGE_RENDER,
+	NR_STAGES,
+};
+
+static const char *stage_names[NR_STAGES] = {
+	"load", "binarize", "minutiae", "render",
+};
+
+struct replay_stats {
+	double min;
+	double max;
+	double total;
+};
+
+static struct frame_reader *replay_reader = NULL;
+static struct recorded_frame replay_frame;
+static gint64 replay_first = -1;
+/* run time in ms at which replay_first is due */
+static double replay_base = 0.0;
+static int frames_done = 0;
+static struct replay_stats stage_stats[NR_STAGES];
+static double late_max = 0.0;
+static double late_total = 0.0;
+
+static void replay_stats_add(struct replay_stats *stats, double ms)
+{
+	if (frames_done == 0 || ms < stats->min)
+		stats->min = ms;
+	if (ms > stats->max)
+		stats->max = ms;
+	stats->total += ms;
+}
+
+/* times one stage from *start, which is advanced to now */
+static double stage_time(enum replay_stage stage, GTimer *timer,
+	double *start)
+{
+	double now = g_timer_elapsed(timer, NULL) * 1000.0;
+	double ms = now - *start;
+
+	replay_stats_add(&stage_stats[stage], ms);
+	*start = now;
+	return ms;
+}
+
+static void replay_schedule(void);
+
+static gboolean replay_frame_cb(gpointer data)
+{
+	struct recorded_frame *frame = &replay_frame;
+	double ms[NR_STAGES];
+	double start = 0.0;
+	double late = 0.0;
+	struct fp_img *img;
+	struct fp_img *img_bin;
+	struct fp_minutia **minlist;
+	unsigned char *rgbdata;
+	size_t size;
+	int nr_minutiae = 0;
+	double frame_start = g_timer_elapsed(run_timer, NULL);
+	int i;
+
+	capture_running = FALSE;
+	if (dev && frame->driver_id
+			!= fp_driver_get_driver_id(fp_dev_get_driver(dev))) {
+		g_printerr("Image %d was recorded with a %s reader\n",
+			frames_done + 1, frame->driver_name);
+		sw_failed = TRUE;
+		if (!match_busy)
+			batch_quit(1);
+		return FALSE;
+	}
+
+	if (opt_realtime) {
+		late = frame_start * 1000.0 - replay_base
+			- (frame->offset_us - replay_first) / 1000.0;
+		if (late < 0.0)
+			late = 0.0;
+		if (late > late_max)
+			late_max = late;
+		late_total += late;
+	}
+
+	g_timer_start(op_timer);
+	img = frame_to_img(frame);
+	ms[STAGE_LOAD] = stage_time(STAGE_LOAD, op_timer, &start);
+	img_bin = fp_img_binarize(img);
+	ms[STAGE_BINARIZE] = stage_time(STAGE_BINARIZE, op_timer, &start);
+	minlist = fp_img_get_minutiae(img, &nr_minutiae);
+	ms[STAGE_MINUTIAE] = stage_time(STAGE_MINUTIAE, op_timer, &start);
+
+	size = frame->width * frame->height;
+	rgbdata = g_malloc(size * 3);
+	gray_to_rgb(rgbdata, fp_img_get_data(img), size);
+	if (minlist)
+		plot_minutiae(rgbdata, frame->width, frame->height, minlist,
+			nr_minutiae);
+	ms[STAGE_RENDER] = stage_time(STAGE_RENDER, op_timer, &start);
+
+	printf("frame %d: %s %dx%d, %d minutiae,", ++frames_done,
+		frame->driver_name, frame->width, frame->height, nr_minutiae);
+	for (i = 0; i < NR_STAGES; i++)
+		printf(" %s %.2f", stage_names[i], ms[i]);
+	if (opt_realtime)
+		printf(" late %.2f", late);
+	printf(" ms\n");
+
+	g_free(rgbdata);
+	if (img_bin)
+		fp_img_free(img_bin);
+
+	if (dev) {
+		struct sw_op *op = g_slice_new0(struct sw_op);
+
+		op->seq = captures_started++;
+		op->start = frame_start;
+		op->img = img;
+		if (match_busy)
+			held_op = op;
+		else
+			sw_submit(op);
+		if (!held_op && captures_started < total_ops())
+			replay_schedule();
+		return FALSE;
+	}
+
+	fp_img_free(img);
+	replay_schedule();
+	return FALSE;
+}
+
+/* read the next frame and queue it, at its recorded time in realtime mode */
+static void replay_schedule(void)
+{
+	double due_ms;
+	double now_ms;
+	int r;
+
+	r = frame_reader_next(replay_reader, &replay_frame);
+	if (r == 0 && dev) {
+		/* each gallery size is run over the whole recording */
+		frame_reader_seek(replay_reader, opt_start);
+		replay_first = -1;
+		replay_base = g_timer_elapsed(run_timer, NULL) * 1000.0;
+		r = frame_reader_next(replay_reader, &replay_frame);
+	}
+	if (r < 0) {
+		g_printerr("Could not read %s, error %d\n", opt_replay, r);
+		batch_quit(1);
+		return;
+	} else if (r == 0) {
+		batch_quit(0);
+		return;
+	}
+
+	if (replay_first < 0)
+		replay_first = replay_frame.offset_us;
+	capture_running = TRUE;
+	if (!opt_realtime) {
+		g_idle_add(replay_frame_cb, NULL);
+		return;
+	}
+
+	due_ms = replay_base + (replay_frame.offset_us - replay_first) / 1000.0;
+	now_ms = g_timer_elapsed(run_timer, NULL) * 1000.0;
+	if (due_ms > now_ms)
+		g_timeout_add((guint) (due_ms - now_ms), replay_frame_cb, NULL);
+	else
+		g_idle_add(replay_frame_cb, NULL);
+}
+
+static int replay_open(void)
+{
+	if (!frame_replay_available()) {
+		g_printerr("Replay is not supported by this libfprint\n");
+		return -1;
+	}
+
+	replay_reader = frame_reader_open(opt_replay);
+	if (!replay_reader) {
+		g_printerr("Could not open recording %s\n", opt_replay);
+		return -1;
+	}
+	if (opt_start < 0
+			|| frame_reader_seek(replay_reader, opt_start) < 0
+			|| frame_reader_count(replay_reader) == (unsigned int) opt_start) {
+		g_printerr("Recording has only %u image(s)\n",
+			frame_reader_count(replay_reader));
+		frame_reader_close(replay_reader);
+		replay_reader = NULL;
+		return -1;
+	}
+	printf("Replaying %u of %u image(s)\n",
+		frame_reader_count(replay_reader) - opt_start,
+		frame_reader_count(replay_reader));
+	return 0;
+}
+
+static void replay_summary(void)
+{
+	double secs;
+	int i;
+
+	if (frames_done == 0)
+		return;
+
+	secs = g_timer_elapsed(run_timer, NULL);
+	printf("\n%d frame(s) in %.3f s: %.2f frames/sec\n", frames_done, secs,
+		frames_done / secs);
+	printf("\n%10s %10s %10s %10s\n", "stage", "min ms", "avg ms", "max ms");
+	for (i = 0; i < NR_STAGES; i++) {
+		struct replay_stats *stats = &stage_stats[i];
+		printf("%10s %10.2f %10.2f %10.2f\n", stage_names[i], stats->min,
+			stats->total / frames_done, stats->max);
+	}
+	if (opt_realtime)
+		printf("\nlateness avg/max: %.2f / %.2f ms\n",
+			late_total / frames_done, late_max);
+}
+
+/* replay without a device: the image pipeline only */
+static int replay_run(void)
+{
+	if (replay_open() < 0)
+		return 1;
+
+	loop = g_main_loop_new(NULL, FALSE);
+	op_timer = g_timer_new();
+	run_timer = g_timer_new();
+	replay_schedule();
+	g_main_loop_run(loop);
+	replay_summary();
+	frame_reader_close(replay_reader);
+	return exit_status;
+}
+
+/* the next image for the software matcher, captured or replayed */
+static void start_image(void)
+{
+	if (replay_reader)
+		replay_schedule();
+	else
+		start_capture();
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	struct fp_dscv_dev **discovered_devs;
+	struct fp_dscv_dev *ddev = NULL;
+	int i;
+	int r;
+
+	context = g_option_context_new("- run fingerprint operations headlessly");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	/* matching and frame recording use worker threads */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	if (opt_write_pack) {
+		if (!opt_gallery) {
+			g_printerr("--write-pack requires --gallery\n");
+			return 1;
+		}
+		r = gallery_write_pack(opt_gallery, opt_write_pack);
+		if (r < 0) {
+			g_printerr("Could not write %s, error %d\n", opt_write_pack, r);
+			return 1;
+		}
+		printf("Packed %d print(s) into %s\n", r, opt_write_pack);
+		return 0;
+	}
+
+	if (opt_replay && !opt_mode)
+		return replay_run();
+
+	if (opt_mode && strcmp(opt_mode, "identify") == 0) {
+		mode = MODE_IDENTIFY;
+	} else if (opt_mode && strcmp(opt_mode, "verify") != 0) {
+		g_printerr("Unknown mode '%s'\n", opt_mode);
+		return 1;
+	}
+	if (opt_count < 1)
+		opt_count = 1;
+	if ((opt_gallery || (opt_software && !opt_replay))
+			&& mode != MODE_IDENTIFY) {
+		g_printerr("--gallery and --software require identify mode\n");
+		return 1;
+	}
+	if (opt_replay) {
+		/* replayed images are matched in software, the whole
+		 * recording once per gallery size */
+		if (replay_open() < 0)
+			return 1;
+		opt_software = TRUE;
+		opt_count = frame_reader_count(replay_reader) - opt_start;
+	}
+	if (opt_software && !sw_match_available()) {
+		g_printerr("Software matching is not supported by this libfprint\n");
+		return 1;
+	}
+
+	r = fp_init();
+	if (r < 0)
+		return r;
+
+	r = setup_pollfds();
+	if (r < 0)
+		return r;
+
+	discovered_devs = fp_discover_devs();
+	if (discovered_devs)
+		for (i = 0; discovered_devs[i]; i++)
+			if (i == opt_device)
+				ddev = discovered_devs[i];
+
+	if (!ddev) {
+		g_printerr("Device %d not found\n", opt_device);
+		fp_exit();
+		return 1;
+	}
+
+	printf("Using %s\n", fp_driver_get_full_name(fp_dscv_dev_get_driver(ddev)));
+
+	loop = g_main_loop_new(NULL, FALSE);
+	op_timer = g_timer_new();
+	r = fp_async_dev_open(ddev, dev_open_cb, NULL);
+	if (r) {
+		g_printerr("Could not open device, error %d\n", r);
+		exit_status = 1;
+	} else {
+		g_main_loop_run(loop);
+	}
+
+	print_summary();
+	if (replay_reader) {
+		replay_summary();
+		frame_reader_close(replay_reader);
+	}
+	free_prints();
+	frame_writer_close(recorder);
+
+	if (dev)
+		fp_dev_close(dev);
+	fp_dscv_devs_free(discovered_devs);
+	fp_exit();
+	return exit_status;
+}
@@ -0,0 +1,402 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* fprint_bench: micro-benchmarks of the image display and matching paths.
+ * Each benchmark runs on synthetic ridge images of several sizes, made
+ * from a fixed seed so that runs can be compared, and repeats until it has
+ * run for a minimum time. Results are given per pixel and per operation.
+ * The display path is timed on raw buffers, once per grayscale to RGB
+ * kernel the CPU supports; binarization and minutiae detection need an
+ * fp_img, which can only be built when libfprint exports fpi_img_new.
+ * Not built by default; "make bench" builds and runs it. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fprint_demo.h"
+
+#define BENCH_SEED 0x5eed
+/* ridge period in pixels, about right for a 500 dpi sensor */
+#define RIDGE_PERIOD 9.0
+/* pixels per plotted minutia, roughly what mindtct finds on real prints */
+#define PIXELS_PER_MINUTIA 1600
+
+struct img_size {
+	int width;
+	int height;
+};
+
+static const struct img_size default_sizes[] = {
+	{ 128, 128 },
+	{ 192, 192 },
+	{ 256, 360 },
+	{ 384, 289 },
+	{ 512, 512 },
+};
+
+struct bench_img {
+	struct recorded_frame frame;
+	unsigned char *data;
+	unsigned char *rgbdata;
+	int *points;
+	int nr_points;
+};
+
+struct kernel_bench {
+	struct bench_img *b;
+	gray_to_rgb_fn fn;
+};
+
+typedef void (*bench_fn)(void *data);
+
+static double opt_time = 0.5;
+static gchar *opt_sizes = NULL;
+
+static GOptionEntry entries[] = {
+	{ "time", 't', 0, G_OPTION_ARG_DOUBLE, &opt_time,
+		"Run each benchmark for at least SECS seconds (default 0.5)",
+		"SECS" },
+	{ "sizes", 's', 0, G_OPTION_ARG_STRING, &opt_sizes,
+		"Comma-separated image sizes to run at, e.g. 192x192,384x289",
+		"SIZES" },
+	{ NULL }
+};
+
+/* concentric ridges around an off-centre core, with noise to break them up
+ * into ridge endings and bifurcations */
+static void make_ridges(unsigned char *data, int width, int height)
+{
+	GRand *rng = g_rand_new_with_seed(BENCH_SEED);
+	double cx = width * 0.45;
+	double cy = height * 0.4;
+	int x, y;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++) {
+			double r = sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+			double v = 128.0 + 90.0 * sin(2.0 * G_PI * r / RIDGE_PERIOD)
+				+ g_rand_double_range(rng, -40.0, 40.0);
+			data[y * width + x] = CLAMP(v, 0.0, 255.0);
+		}
+	g_rand_free(rng);
+}
+
+static void bench_img_init(struct bench_img *b, int width, int height)
+{
+	GRand *rng = g_rand_new_with_seed(BENCH_SEED);
+	int i;
+
+	memset(b, 0, sizeof(*b));
+	b->data = g_malloc(width * height);
+	make_ridges(b->data, width, height);
+	b->rgbdata = g_malloc(width * height * 3);
+
+	b->frame.width = width;
+	b->frame.height = height;
+	b->frame.data = b->data;
+
+	/* crosses reach two pixels out from their centre */
+	b->nr_points = MAX(width * height / PIXELS_PER_MINUTIA, 1);
+	b->points = g_new(int, b->nr_points * 2);
+	for (i = 0; i < b->nr_points; i++) {
+		b->points[i * 2] = g_rand_int_range(rng, 2, width - 2);
+		b->points[i * 2 + 1] = g_rand_int_range(rng, 2, height - 2);
+	}
+	g_rand_free(rng);
+}
+
+static void bench_img_free(struct bench_img *b)
+{
+	g_free(b->points);
+	g_free(b->rgbdata);
+	g_free(b->data);
+}
+
+/* Runs fn in batches, doubling the batch until one takes opt_time, and
+ * returns the time of that batch. */
+static double bench_run(bench_fn fn, void *data, unsigned long *iterations)
+{
+	GTimer *timer = g_timer_new();
+	unsigned long batch = 1;
+	unsigned long i;
+	double secs;
+
+	/* warm up caches and any lazily initialised state */
+	fn(data);
+
+	for (;;) {
+		g_timer_start(timer);
+		for (i = 0; i < batch; i++)
+			fn(data);
+		secs = g_timer_elapsed(timer, NULL);
+		if (secs >= opt_time || batch >= G_MAXULONG / 2)
+			break;
+		batch *= 2;
+	}
+
+	g_timer_destroy(timer);
+	*iterations = batch;
+	return secs;
+}
+
+static void report(const char *name, const char *size, size_t pixels,
+	double secs, unsigned long iterations)
+{
+	if (pixels)
+		printf("%-18s %10s %12.3f %12.1f\n", name, size,
+			secs * 1e9 / ((double) iterations * pixels),
+			iterations / secs);
+	else
+		printf("%-18s %10s %12s %12.1f\n", name, size, "-",
+			iterations / secs);
+}
+
+static void bench_kernel(void *data)
+{
+	struct kernel_bench *k = data;
+	k->fn(k->b->rgbdata, k->b->data, k->b->frame.width * k->b->frame.height);
+}
+
+static void bench_rgbdata(void *data)
+{
+	struct bench_img *b = data;
+	g_free(gray_to_rgbdata(b->data, b->frame.width, b->frame.height));
+}
+
+static void bench_pixbuf(void *data)
+{
+	struct bench_img *b = data;
+	g_object_unref(gray_to_pixbuf(b->data, b->frame.width, b->frame.height));
+}
+
+static void bench_plot_minutiae(void *data)
+{
+	struct bench_img *b = data;
+	int i;
+
+	for (i = 0; i < b->nr_points; i++)
+		plot_cross(b->rgbdata, b->frame.width, b->points[i * 2],
+			b->points[i * 2 + 1]);
+}
+
+/* libfprint keeps the binarized image and minutiae on the fp_img once
+ * detected, so those two are timed on a fresh copy of the image each time.
+ * The copy on its own is timed as "img copy". */
+static void bench_img_copy(void *data)
+{
+	struct bench_img *b = data;
+	fp_img_free(frame_to_img(&b->frame));
+}
+
+static void bench_binarize(void *data)
+{
+	struct bench_img *b = data;
+	struct fp_img *img = frame_to_img(&b->frame);
+	struct fp_img *img_bin = fp_img_binarize(img);
+
+	if (img_bin)
+		fp_img_free(img_bin);
+	fp_img_free(img);
+}
+
+static void bench_minutiae(void *data)
+{
+	struct bench_img *b = data;
+	struct fp_img *img = frame_to_img(&b->frame);
+	int nr_minutiae;
+
+	fp_img_get_minutiae(img, &nr_minutiae);
+	fp_img_free(img);
+}
+
+struct bench {
+	const char *name;
+	bench_fn fn;
+};
+
+static const struct bench raw_benches[] = {
+	{ "gray_to_rgbdata", bench_rgbdata },
+	{ "gray_to_pixbuf", bench_pixbuf },
+	{ "plot_minutiae", bench_plot_minutiae },
+};
+
+/* need fpi_img_new */
+static const struct bench img_benches[] = {
+	{ "img copy", bench_img_copy },
+	{ "binarize", bench_binarize },
+	{ "minutiae", bench_minutiae },
+};
+
+static void run_benches(const struct bench *benches, int nr_benches,
+	void *data, const char *size, size_t pixels)
+{
+	int i;
+
+	for (i = 0; i < nr_benches; i++) {
+		unsigned long iterations;
+		double secs = bench_run(benches[i].fn, data, &iterations);
+		report(benches[i].name, size, pixels, secs, iterations);
+	}
+}
+
+static void run_img_benches(const struct img_size *sizes, int nr_sizes)
+{
+	struct gray_to_rgb_kernel kernels[GRAY_TO_RGB_MAX_KERNELS];
+	int nr_kernels = gray_to_rgb_kernels(kernels);
+	int i;
+	int j;
+
+	for (i = 0; i < nr_sizes; i++) {
+		struct bench_img b;
+		gchar *size = g_strdup_printf("%dx%d", sizes[i].width,
+			sizes[i].height);
+		size_t pixels = sizes[i].width * sizes[i].height;
+
+		bench_img_init(&b, sizes[i].width, sizes[i].height);
+		for (j = 0; j < nr_kernels; j++) {
+			struct kernel_bench k = { &b, kernels[j].fn };
+			gchar *name = g_strdup_printf("gray_to_rgb %s",
+				kernels[j].name);
+			unsigned long iterations;
+			double secs = bench_run(bench_kernel, &k, &iterations);
+
+			report(name, size, pixels, secs, iterations);
+			g_free(name);
+		}
+		run_benches(raw_benches, G_N_ELEMENTS(raw_benches), &b, size,
+			pixels);
+		if (frame_replay_available())
+			run_benches(img_benches, G_N_ELEMENTS(img_benches), &b, size,
+				pixels);
+		bench_img_free(&b);
+		g_free(size);
+	}
+}
+
+static void bench_template_load(void *data)
+{
+	struct fp_dscv_print **dprints = data;
+	int i;
+
+	for (i = 0; dprints[i]; i++) {
+		struct fp_print_data *print;
+		if (fp_print_data_from_dscv_print(dprints[i], &print) == 0)
+			fp_print_data_free(print);
+	}
+}
+
+/* loads every print enrolled under ~/.fprint, there being no way to make
+ * up templates without a device */
+static void run_template_bench(void)
+{
+	struct fp_dscv_print **dprints = fp_discover_prints();
+	unsigned long iterations;
+	gchar *count;
+	double secs;
+	int nr;
+
+	for (nr = 0; dprints && dprints[nr]; nr++)
+		;
+	if (nr == 0) {
+		printf("%-18s no enrolled prints found, skipped\n", "template load");
+		if (dprints)
+			fp_dscv_prints_free(dprints);
+		return;
+	}
+
+	secs = bench_run(bench_template_load, dprints, &iterations);
+	count = g_strdup_printf("%d prints", nr);
+	report("template load", count, 0, secs, iterations * nr);
+	g_free(count);
+	fp_dscv_prints_free(dprints);
+}
+
+static int parse_sizes(const char *str, struct img_size **sizes)
+{
+	gchar **tokens = g_strsplit(str, ",", 0);
+	int nr = g_strv_length(tokens);
+	int i;
+
+	*sizes = g_new0(struct img_size, nr);
+	for (i = 0; i < nr; i++) {
+		struct img_size *size = &(*sizes)[i];
+		if (sscanf(tokens[i], "%dx%d", &size->width, &size->height) != 2
+				|| size->width < 16 || size->height < 16) {
+			g_printerr("Bad image size '%s'\n", tokens[i]);
+			nr = -1;
+			break;
+		}
+	}
+	g_strfreev(tokens);
+	return nr;
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	struct img_size *sizes = NULL;
+	int nr_sizes;
+	int r;
+
+	context = g_option_context_new("- time the image and matching paths");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (opt_sizes) {
+		nr_sizes = parse_sizes(opt_sizes, &sizes);
+		if (nr_sizes < 0)
+			return 1;
+	} else {
+		nr_sizes = G_N_ELEMENTS(default_sizes);
+		sizes = g_memdup(default_sizes, sizeof(default_sizes));
+	}
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init();
+#endif
+
+	r = fp_init();
+	if (r < 0) {
+		g_printerr("Could not initialise libfprint, error %d\n", r);
+		return 1;
+	}
+
+	printf("%-18s %10s %12s %12s\n", "benchmark", "size", "ns/pixel",
+		"ops/sec");
+	run_img_benches(sizes, nr_sizes);
+	if (!frame_replay_available())
+		printf("Binarize and minutiae benchmarks need a libfprint which "
+			"exports fpi_img_new, skipped\n");
+	run_template_bench();
+
+	g_free(sizes);
+	fp_exit();
+	return 0;
+}
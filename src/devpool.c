@@ -0,0 +1,139 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Pool of open device handles. Opening a device can take seconds with
+ * some drivers, so a device whose window is closed is kept open for a
+ * while, together with the prints loaded for it, in case it is opened
+ * again. Up to a configurable number of unused devices are kept open, and
+ * the one least recently used is closed to make room for another.
+ * 
+ * Each row of the device list owns a handle for as long as the reader is
+ * plugged in, and a session holds another reference while it uses it. */
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+/* unused handles with an open device, most recently used first */
+static GQueue idle = G_QUEUE_INIT;
+static unsigned int idle_limit = DEV_POOL_DEFAULT_LIMIT;
+
+struct dev_handle *dev_handle_new(void)
+{
+	struct dev_handle *handle = g_slice_new0(struct dev_handle);
+	handle->refcnt = 1;
+	return handle;
+}
+
+struct dev_handle *dev_handle_ref(struct dev_handle *handle)
+{
+	handle->refcnt++;
+	return handle;
+}
+
+/* close the device and drop everything loaded for it */
+static void handle_close(struct dev_handle *handle)
+{
+	int i;
+
+	if (handle->idle_link) {
+		g_queue_delete_link(&idle, handle->idle_link);
+		handle->idle_link = NULL;
+	}
+
+	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
+		fp_print_data_free(handle->resident[i]);
+		handle->resident[i] = NULL;
+		handle->resident_serial[i] = 0;
+	}
+	gallery_free(handle->store);
+	handle->store = NULL;
+
+	if (handle->dev) {
+		io_dev_close(handle->dev);
+		handle->dev = NULL;
+	}
+}
+
+void dev_handle_unref(struct dev_handle *handle)
+{
+	if (--handle->refcnt > 0)
+		return;
+
+	handle_close(handle);
+	g_slice_free(struct dev_handle, handle);
+}
+
+/* close idle devices, least recently used first, until no more than limit
+ * are left open */
+static void pool_trim(unsigned int limit)
+{
+	while (g_queue_get_length(&idle) > limit)
+		handle_close(g_queue_peek_tail(&idle));
+}
+
+/* Take the handle for use by a session. Returns TRUE if its device is
+ * still open from earlier use, otherwise the caller opens it. */
+gboolean dev_handle_acquire(struct dev_handle *handle)
+{
+	g_assert(!handle->in_use);
+
+	if (handle->idle_link) {
+		g_queue_delete_link(&idle, handle->idle_link);
+		handle->idle_link = NULL;
+	}
+	handle->in_use = TRUE;
+	return handle->dev != NULL;
+}
+
+/* Hand back a handle which a session has finished with. Its device is
+ * kept open while the reader is still in the device list, unless that
+ * would take the pool over its limit. */
+void dev_handle_release(struct dev_handle *handle)
+{
+	g_assert(handle->in_use);
+	handle->in_use = FALSE;
+
+	if (!handle->dev)
+		return;
+
+	/* only the session referred to it, the reader has gone */
+	if (handle->refcnt == 1 || idle_limit == 0) {
+		handle_close(handle);
+		return;
+	}
+
+	g_queue_push_head(&idle, handle);
+	handle->idle_link = g_queue_peek_head_link(&idle);
+	pool_trim(idle_limit);
+}
+
+/* set how many unused devices are kept open */
+void dev_pool_set_limit(unsigned int limit)
+{
+	idle_limit = limit;
+	pool_trim(idle_limit);
+}
+
+/* close all unused devices */
+void dev_pool_exit(void)
+{
+	pool_trim(0);
+}
@@ -17,79 +17,155 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <libfprint/fprint.h>
 
 #include "fprint_demo.h"
 
-static GtkWidget *ewin_enroll_btn[RIGHT_LITTLE+1];
-static GtkWidget *ewin_delete_btn[RIGHT_LITTLE+1];
-static GtkWidget *ewin_status_lbl[RIGHT_LITTLE+1];
-
-static GtkWidget *edlg_dialog;
-static GtkWidget *edlg_please_wait;
-static GtkWidget *edlg_progress_lbl;
-static GtkWidget *edlg_instr_lbl;
-static GtkWidget *edlg_progress_bar;
-static GtkWidget *edlg_img_hbox;
-static GtkWidget *edlg_last_image = NULL;
+/* scans are shown as thumbnails no larger than this, and only the most
+ * recent few are kept so that retries do not grow the dialog */
+#define EDLG_THUMB_SIZE 96
+#define EDLG_MAX_THUMBS 6
 
-static struct fp_img *edlg_last_fp_img = NULL;
-static struct fp_print_data *edlg_enroll_data = NULL;
-
-static int nr_enroll_stages = 0;
-static int enroll_stage = 0;
-static gboolean enroll_complete = FALSE;
+/* a thumbnail in the enrollment dialog, which is filled in once made */
+struct edlg_thumb {
+	GtkWidget *image;
+	struct img_thumbnail_job *job;
+	struct scan_trace *trace;
+};
 
-/* the numeric index of the finger being enrolled */
-static int edlg_finger = 0;
+struct ewin {
+	struct fpd_session *session;
+
+	GtkWidget *enroll_btn[RIGHT_LITTLE+1];
+	GtkWidget *delete_btn[RIGHT_LITTLE+1];
+	GtkWidget *status_lbl[RIGHT_LITTLE+1];
+	GtkWidget *batch_chk[RIGHT_LITTLE+1];
+	GtkWidget *batch_btn;
+
+	/* enrollment dialog */
+	GtkWidget *edlg_dialog;
+	GtkWidget *edlg_please_wait;
+	GtkWidget *edlg_finger_lbl;
+	GtkWidget *edlg_progress_lbl;
+	GtkWidget *edlg_instr_lbl;
+	GtkWidget *edlg_progress_bar;
+	GtkWidget *edlg_img_hbox;
+
+	/* The fingers enrolled in this session, one after the other, and the
+	 * print of each completed so far. The prints are only saved, all
+	 * together, once the last finger has been enrolled. */
+	enum fp_finger batch_fingers[RIGHT_LITTLE];
+	struct fp_print_data *batch_prints[RIGHT_LITTLE];
+	int batch_len;
+	int batch_pos;
+
+	int nr_enroll_stages;
+	int enroll_stage;
+	gboolean enroll_complete;
+	/* TRUE from starting enrollment of a finger until it has stopped */
+	gboolean enroll_running;
+	/* result to report once enrollment has stopped */
+	int stop_result;
+
+	/* the numeric index of the finger being enrolled */
+	int edlg_finger;
+	/* set when a session has been asked to stop */
+	gboolean batch_cancelled;
+
+	/* trace of the running enrollment */
+	struct scan_trace *trace;
+};
 
-static GtkWidget *create_enroll_dialog(void)
+static GtkWidget *create_enroll_dialog(struct ewin *ew)
 {
-	const char *fstr = fingerstr(edlg_finger);
-	gchar *fstr_lower = g_ascii_strdown(fstr, -1);
-	nr_enroll_stages = fp_dev_get_nr_enroll_stages(fpdev);
+	struct fpd_session *session = ew->session;
+	const char *fstr = fingerstr(ew->batch_fingers[0]);
+	gchar *fstr_lower;
 	gchar *tmp;
 	GtkWidget *label, *vbox;
 
+	ew->nr_enroll_stages = fp_dev_get_nr_enroll_stages(session->dev);
+
+	if (ew->batch_len > 1)
+		fstr_lower = g_strdup_printf("%d fingers", ew->batch_len);
+	else
+		fstr_lower = g_ascii_strdown(fstr, -1);
+
 	tmp = g_strdup_printf("Enroll %s", fstr_lower);
-	edlg_dialog = gtk_dialog_new_with_buttons(tmp, GTK_WINDOW(mwin_window),
-		GTK_DIALOG_MODAL | GTK_DIALOG_NO_SEPARATOR,
+	ew->edlg_dialog = gtk_dialog_new_with_buttons(tmp,
+		GTK_WINDOW(session->window),
+		GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT
+		| GTK_DIALOG_NO_SEPARATOR,
 		GTK_STOCK_OK, GTK_RESPONSE_OK,
 		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, NULL);
 	g_free(tmp);
 
-	vbox = GTK_DIALOG(edlg_dialog)->vbox;
+	vbox = GTK_DIALOG(ew->edlg_dialog)->vbox;
 
 	tmp = g_strdup_printf("In order to enroll your %s you will have to "
-		"successfully scan your finger %d time%s.",
-		fstr_lower, nr_enroll_stages,
-		(nr_enroll_stages == 1) ? "" : "s");
+		"successfully scan %s %d time%s.",
+		fstr_lower, (ew->batch_len > 1) ? "each finger" : "your finger",
+		ew->nr_enroll_stages, (ew->nr_enroll_stages == 1) ? "" : "s");
 	label = gtk_label_new(tmp);
 	gtk_box_pack_start_defaults(GTK_BOX(vbox), label);
 	g_free(fstr_lower);
 	g_free(tmp);
 
-	edlg_progress_lbl = gtk_label_new(NULL);
-	gtk_box_pack_start_defaults(GTK_BOX(vbox), edlg_progress_lbl);
-	tmp = g_strdup_printf("<b>Step 1 of %d</b>", nr_enroll_stages);
-	gtk_label_set_markup(GTK_LABEL(edlg_progress_lbl), tmp);
-	g_free(tmp);
+	ew->edlg_finger_lbl = gtk_label_new(NULL);
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), ew->edlg_finger_lbl);
 
-	edlg_img_hbox = gtk_hbox_new(FALSE, 2);
-	gtk_box_pack_start_defaults(GTK_BOX(vbox), edlg_img_hbox);
+	ew->edlg_progress_lbl = gtk_label_new(NULL);
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), ew->edlg_progress_lbl);
 
-	edlg_progress_bar = gtk_progress_bar_new();
-	gtk_box_pack_start_defaults(GTK_BOX(vbox), edlg_progress_bar);
-	g_object_set_data(G_OBJECT(edlg_dialog), "progressbar", edlg_progress_bar);
+	ew->edlg_img_hbox = gtk_hbox_new(FALSE, 2);
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), ew->edlg_img_hbox);
 
-	edlg_instr_lbl = gtk_label_new(NULL);
-	gtk_box_pack_start_defaults(GTK_BOX(vbox), edlg_instr_lbl);
-	gtk_label_set_text(GTK_LABEL(edlg_instr_lbl), "Scan your finger now");
+	ew->edlg_progress_bar = gtk_progress_bar_new();
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), ew->edlg_progress_bar);
+	g_object_set_data(G_OBJECT(ew->edlg_dialog), "progressbar",
+		ew->edlg_progress_bar);
 
-	gtk_dialog_set_response_sensitive(GTK_DIALOG(edlg_dialog),
+	ew->edlg_instr_lbl = gtk_label_new(NULL);
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), ew->edlg_instr_lbl);
+
+	gtk_dialog_set_response_sensitive(GTK_DIALOG(ew->edlg_dialog),
 		GTK_RESPONSE_OK, FALSE);
-	return edlg_dialog;
+	return ew->edlg_dialog;
+}
+
+/* show which finger of the session is being enrolled, dropping the
+ * thumbnails of the one before */
+static void edlg_show_finger(struct ewin *ew)
+{
+	gchar *tmp;
+
+	gtk_container_foreach(GTK_CONTAINER(ew->edlg_img_hbox),
+		(GtkCallback) gtk_widget_destroy, NULL);
+
+	if (ew->batch_len > 1) {
+		tmp = g_strdup_printf("<big><b>%s</b></big> (finger %d of %d)",
+			fingerstr(ew->edlg_finger), ew->batch_pos + 1, ew->batch_len);
+		gtk_label_set_markup(GTK_LABEL(ew->edlg_finger_lbl), tmp);
+		g_free(tmp);
+	}
+
+	tmp = g_strdup_printf("<b>Step 1 of %d</b>", ew->nr_enroll_stages);
+	gtk_label_set_markup(GTK_LABEL(ew->edlg_progress_lbl), tmp);
+	g_free(tmp);
+	gtk_label_set_text(GTK_LABEL(ew->edlg_instr_lbl), "Scan your finger now");
+}
+
+static void batch_free_prints(struct ewin *ew)
+{
+	int i;
+
+	for (i = 0; i < ew->batch_len; i++) {
+		fp_print_data_free(ew->batch_prints[i]);
+		ew->batch_prints[i] = NULL;
+	}
 }
 
 /* timeout-invoked function which pulses the progress bar */
@@ -126,99 +202,188 @@ static void destroy_enroll_dialog(GtkWidget *dialog)
 	gtk_widget_destroy(dialog);
 }
 
-static void __enroll_stopped(int result)
+static int enroll_start_finger(struct ewin *ew);
+
+static void edlg_show_error(struct ewin *ew, const char *fmt, int error)
+{
+	GtkWidget *dialog = gtk_message_dialog_new_with_markup(
+			GTK_WINDOW(ew->session->window),
+			GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+			GTK_MESSAGE_ERROR, GTK_BUTTONS_OK, fmt, error, NULL);
+	gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+}
+
+static void __enroll_stopped(struct ewin *ew, int result)
 {
-	if (edlg_please_wait) {
-		gtk_widget_destroy(edlg_please_wait);
-		edlg_please_wait = NULL;
+	int r;
+
+	scan_trace_mark(ew->trace, SCAN_STOPPED);
+	scan_trace_release(ew->trace);
+	ew->trace = NULL;
+	ew->enroll_running = FALSE;
+
+	if (ew->edlg_please_wait) {
+		gtk_widget_destroy(ew->edlg_please_wait);
+		ew->edlg_please_wait = NULL;
 	}
 
-	if (!enroll_complete)
-		return;
+	/* the dialog has been closed, or is about to be with its device */
+	if (ew->batch_cancelled || ew->session->closing) {
+		batch_free_prints(ew);
+		goto out;
+	}
 
-	stop_edlg_progress_pulse(edlg_dialog);
+	/* Go straight on to the next finger of a session, or give the finger
+	 * another go if its enrollment failed, keeping the dialog up. */
+	if ((result == FP_ENROLL_COMPLETE && ew->batch_pos + 1 < ew->batch_len)
+			|| (result == FP_ENROLL_FAIL && ew->batch_len > 1)) {
+		if (result == FP_ENROLL_COMPLETE)
+			ew->batch_pos++;
+		r = enroll_start_finger(ew);
+		if (r == 0) {
+			if (result == FP_ENROLL_FAIL)
+				gtk_label_set_text(GTK_LABEL(ew->edlg_instr_lbl),
+					"Bad scan data, please enroll this finger again.");
+			return;
+		}
+		result = r;
+	}
+
+	stop_edlg_progress_pulse(ew->edlg_dialog);
 
 	if (result < 0) {
-		GtkWidget *dialog =
-			gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
+		GtkWidget *dialog = gtk_message_dialog_new_with_markup(
+				GTK_WINDOW(ew->session->window),
 				GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
 				GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
 				"Enroll failed with error %d", result, NULL);
 		gtk_dialog_run(GTK_DIALOG(dialog));
 		gtk_widget_destroy(dialog);
-		destroy_enroll_dialog(edlg_dialog);
+		destroy_enroll_dialog(ew->edlg_dialog);
+		batch_free_prints(ew);
 	} else if (result == FP_ENROLL_FAIL) {
-		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(edlg_progress_bar),
+		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(ew->edlg_progress_bar),
 			"Enrollment failed due to bad scan data.");
-		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(edlg_progress_bar),
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ew->edlg_progress_bar),
 			0.0);
-		gtk_label_set_text(GTK_LABEL(edlg_instr_lbl), "Click Cancel to "
+		gtk_label_set_text(GTK_LABEL(ew->edlg_instr_lbl), "Click Cancel to "
 			"continue.");
 	} else if (result == FP_ENROLL_COMPLETE) {
-		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(edlg_progress_bar),
-			"Enrollment complete!");
-		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(edlg_progress_bar),
+		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(ew->edlg_progress_bar),
+			(ew->batch_len > 1) ? "All fingers enrolled!"
+			: "Enrollment complete!");
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ew->edlg_progress_bar),
 			1.0);
-		gtk_label_set_text(GTK_LABEL(edlg_instr_lbl), "Click OK to save "
+		gtk_label_set_text(GTK_LABEL(ew->edlg_instr_lbl), "Click OK to save "
 			"and continue.");
-		gtk_dialog_set_response_sensitive(GTK_DIALOG(edlg_dialog),
+		gtk_dialog_set_response_sensitive(GTK_DIALOG(ew->edlg_dialog),
 			GTK_RESPONSE_OK, TRUE);
 		/* FIXME: grab focus on OK button? */
 	} else {
 		g_error("unknown enroll result %d", result);
 	}
+
+out:
+	session_op_end(ew->session);
 }
 
 static void enroll_stopped(struct fp_dev *dev, void *user_data)
 {
-	__enroll_stopped(GPOINTER_TO_INT(user_data));
+	struct ewin *ew = user_data;
+	__enroll_stopped(ew, ew->stop_result);
 }
 
-static void edlg_cancel_enroll(int result)
+static void edlg_cancel_enroll(struct ewin *ew, int result)
 {
 	int r;
-	void *data = GINT_TO_POINTER(result);
 
-	enroll_stage = -1;
-	r = fp_async_enroll_stop(fpdev, enroll_stopped, data);
+	ew->enroll_stage = -1;
+	ew->stop_result = result;
+	r = io_enroll_stop(ew->session->dev, enroll_stopped, ew);
 	if (r < 0)
-		__enroll_stopped(result);
+		__enroll_stopped(ew, result);
+}
+
+static void edlg_thumb_done(GdkPixbuf *pixbuf, void *user_data)
+{
+	struct edlg_thumb *thumb = user_data;
+
+	thumb->job = NULL;
+	gtk_image_set_from_pixbuf(GTK_IMAGE(thumb->image), pixbuf);
+	g_object_unref(pixbuf);
+	scan_trace_mark(thumb->trace, SCAN_DRAWN);
+	scan_trace_release(thumb->trace);
+	thumb->trace = NULL;
+}
+
+/* the thumbnail was dropped from the dialog, or the dialog closed */
+static void edlg_thumb_destroyed(GtkWidget *widget, gpointer user_data)
+{
+	struct edlg_thumb *thumb = user_data;
+
+	if (thumb->job)
+		img_thumbnail_cancel(thumb->job);
+	scan_trace_release(thumb->trace);
+	g_slice_free(struct edlg_thumb, thumb);
+}
+
+/* add a thumbnail of img, which is taken over, dropping the oldest if the
+ * dialog is full */
+static void edlg_add_thumb(struct ewin *ew, struct fp_img *img)
+{
+	GList *children = gtk_container_get_children(
+		GTK_CONTAINER(ew->edlg_img_hbox));
+	struct edlg_thumb *thumb;
+
+	if (g_list_length(children) >= EDLG_MAX_THUMBS)
+		gtk_widget_destroy(children->data);
+	g_list_free(children);
+
+	thumb = g_slice_new0(struct edlg_thumb);
+	thumb->image = gtk_image_new();
+	gtk_widget_set_size_request(thumb->image, EDLG_THUMB_SIZE,
+		EDLG_THUMB_SIZE);
+	g_signal_connect(G_OBJECT(thumb->image), "destroy",
+		G_CALLBACK(edlg_thumb_destroyed), thumb);
+	gtk_box_pack_start(GTK_BOX(ew->edlg_img_hbox), thumb->image, FALSE,
+		FALSE, 0);
+	gtk_widget_show(thumb->image);
+
+	thumb->trace = ew->trace;
+	scan_trace_hold(thumb->trace);
+	thumb->job = img_thumbnail_submit(img, EDLG_THUMB_SIZE, edlg_thumb_done,
+		thumb);
 }
 
 static void enroll_stage_cb(struct fp_dev *dev, int result,
 	struct fp_print_data *print, struct fp_img *img, void *user_data)
 {
+	struct ewin *ew = user_data;
 	gboolean free_tmp = FALSE;
 	gchar *tmp;
 
+	scan_trace_callback(ew->trace, io_event_time(), result, img != NULL);
+	frame_record(dev, FRAME_ENROLL, ew->edlg_finger, result, img);
 	if (result < 0) {
-		edlg_cancel_enroll(result);
+		fp_img_free(img);
+		edlg_cancel_enroll(ew, result);
 		return;
 	}
 
-	if (img) {
-		GdkPixbuf *pixbuf = img_to_pixbuf(img);
-		GtkWidget *image = gtk_image_new_from_pixbuf(pixbuf);
-		gtk_box_pack_start_defaults(GTK_BOX(edlg_img_hbox), image);
-		gtk_widget_show(image);
-		edlg_last_fp_img = img;
-		edlg_last_image = image;
-		g_object_unref(G_OBJECT(pixbuf));
-	} else {
-		edlg_last_fp_img = NULL;
-		edlg_last_image = NULL;
-	}
+	if (img)
+		edlg_add_thumb(ew, img);
 
 	if (print)
-		edlg_enroll_data = print;
+		ew->batch_prints[ew->batch_pos] = print;
 
 	switch (result) {
 	case FP_ENROLL_COMPLETE:
 		tmp = "<b>Enrollment completed!</b>";
 		break;
 	case FP_ENROLL_PASS:
-		tmp = g_strdup_printf("<b>Step %d of %d</b>", ++enroll_stage,
-			nr_enroll_stages);
+		tmp = g_strdup_printf("<b>Step %d of %d</b>", ++ew->enroll_stage,
+			ew->nr_enroll_stages);
 		free_tmp = TRUE;
 		break;
 	case FP_ENROLL_FAIL:
@@ -241,154 +406,233 @@ static void enroll_stage_cb(struct fp_dev *dev, int result,
 		tmp = "Unknown state!";
 	}
 
-	gtk_label_set_markup(GTK_LABEL(edlg_progress_lbl), tmp);
+	gtk_label_set_markup(GTK_LABEL(ew->edlg_progress_lbl), tmp);
 	if (free_tmp)
 		g_free(tmp);
+	scan_trace_mark(ew->trace, SCAN_RESULT);
 
 	if (result == FP_ENROLL_COMPLETE || result == FP_ENROLL_FAIL) {
-		enroll_complete = TRUE;
-		edlg_cancel_enroll(result);
+		ew->enroll_complete = TRUE;
+		edlg_cancel_enroll(ew, result);
 	}
 
 	/* FIXME show binarized images? */
 }
 
+/* start enrolling the finger at batch_pos, in the open dialog */
+static int enroll_start_finger(struct ewin *ew)
+{
+	int r;
+
+	ew->edlg_finger = ew->batch_fingers[ew->batch_pos];
+	ew->enroll_stage = 1;
+	ew->enroll_complete = FALSE;
+	edlg_show_finger(ew);
+
+	ew->trace = scan_trace_begin("enroll", ew->session->dev);
+	r = io_enroll_start(ew->session->dev, enroll_stage_cb, ew);
+	scan_trace_mark(ew->trace, SCAN_STARTED);
+	if (r < 0) {
+		scan_trace_release(ew->trace);
+		ew->trace = NULL;
+		return r;
+	}
+
+	ew->enroll_running = TRUE;
+	return 0;
+}
+
 /* called when enrollment dialog is closed. determine if it was cancelled
- * or if there is a print to be saved. */
+ * or if there are prints to be saved. */
 static void enroll_response(GtkWidget *widget, gint arg, gpointer data)
 {
+	struct ewin *ew = data;
+	struct fp_dev *dev = ew->session->dev;
+	enum fp_finger fingers[RIGHT_LITTLE];
+	struct fp_print_data *saved[RIGHT_LITTLE];
+	int nr_saved = 0;
+	int error = 0;
+	int i;
 	int r;
-	destroy_enroll_dialog(edlg_dialog);
+
+	destroy_enroll_dialog(ew->edlg_dialog);
 
 	if (arg == GTK_RESPONSE_CANCEL) {
-		if (!enroll_complete)
-			edlg_cancel_enroll(0);
+		/* the prints are freed once enrollment has stopped */
+		ew->batch_cancelled = TRUE;
+		if (!ew->enroll_running)
+			batch_free_prints(ew);
+		else if (!ew->enroll_complete)
+			edlg_cancel_enroll(ew, 0);
 		return;
 	}
 
-	g_assert(edlg_enroll_data);
-	r = fp_print_data_save(edlg_enroll_data, edlg_finger);
-	fp_print_data_free(edlg_enroll_data);
-	if (r < 0) {
-		GtkWidget *dialog =
-			gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
-				GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
-				GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
-				"Could not save enroll data, error %d", r, NULL);
-		gtk_dialog_run(GTK_DIALOG(dialog));
-		gtk_widget_destroy(dialog);
+	for (i = 0; i < ew->batch_len; i++) {
+		g_assert(ew->batch_prints[i]);
+		r = fp_print_data_save(ew->batch_prints[i], ew->batch_fingers[i]);
+		if (r < 0) {
+			error = r;
+			continue;
+		}
+		fingers[nr_saved] = ew->batch_fingers[i];
+		saved[nr_saved++] = ew->batch_prints[i];
 	}
+	print_cache_add_many(dev, fingers, saved, nr_saved);
+	batch_free_prints(ew);
 
-	mwin_refresh_prints();
+	if (error < 0)
+		edlg_show_error(ew, "Could not save enroll data, error %d", error);
+
+	session_refresh_prints(dev);
 	return;
 }
 
-/* open enrollment dialog and start enrollment */
-static void ewin_cb_enroll_clicked(GtkWidget *widget, gpointer data)
+/* open enrollment dialog and enroll the given fingers one after another */
+static void ewin_enroll(struct ewin *ew, const enum fp_finger *fingers,
+	int nr_fingers)
 {
-	int r;
 	GtkWidget *dialog;
+	int r;
 
-	edlg_finger = GPOINTER_TO_INT(data);
-	edlg_enroll_data = NULL;
-	enroll_stage = 1;
-	enroll_complete = FALSE;
+	memcpy(ew->batch_fingers, fingers, nr_fingers * sizeof(*fingers));
+	memset(ew->batch_prints, 0, sizeof(ew->batch_prints));
+	ew->batch_len = nr_fingers;
+	ew->batch_pos = 0;
+	ew->batch_cancelled = FALSE;
 
-	dialog = create_enroll_dialog();
-	r = fp_async_enroll_start(fpdev, enroll_stage_cb, dialog);
+	dialog = create_enroll_dialog(ew);
+	r = enroll_start_finger(ew);
 	if (r < 0) {
 		destroy_enroll_dialog(dialog);
-		dialog = gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
-			GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
-			GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
-			"Failed to start enrollment, error %d", r, NULL);
-		gtk_dialog_run(GTK_DIALOG(dialog));
-		gtk_widget_destroy(dialog);
+		edlg_show_error(ew, "Failed to start enrollment, error %d", r);
+		return;
 	}
-	g_signal_connect(dialog, "response", G_CALLBACK(enroll_response), NULL);
+	session_op_begin(ew->session);
+	g_signal_connect(dialog, "response", G_CALLBACK(enroll_response), ew);
 	run_enroll_dialog(dialog);
 }
 
+static void ewin_cb_enroll_clicked(GtkWidget *widget, gpointer data)
+{
+	enum fp_finger finger = GPOINTER_TO_INT(g_object_get_data(
+		G_OBJECT(widget), "finger"));
+	ewin_enroll(data, &finger, 1);
+}
+
+/* enroll every finger ticked for the batch, in one session */
+static void ewin_cb_batch_clicked(GtkWidget *widget, gpointer data)
+{
+	struct ewin *ew = data;
+	enum fp_finger fingers[RIGHT_LITTLE];
+	int nr_fingers = 0;
+	int i;
+
+	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++)
+		if (gtk_toggle_button_get_active(
+				GTK_TOGGLE_BUTTON(ew->batch_chk[i])))
+			fingers[nr_fingers++] = i;
+
+	if (nr_fingers)
+		ewin_enroll(ew, fingers, nr_fingers);
+}
+
+static void ewin_update_batch_btn(struct ewin *ew)
+{
+	gboolean any = FALSE;
+	int i;
+
+	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++)
+		if (gtk_toggle_button_get_active(
+				GTK_TOGGLE_BUTTON(ew->batch_chk[i])))
+			any = TRUE;
+	gtk_widget_set_sensitive(ew->batch_btn,
+		any && GTK_WIDGET_IS_SENSITIVE(ew->batch_chk[LEFT_THUMB]));
+}
+
+static void ewin_cb_batch_toggled(GtkWidget *widget, gpointer data)
+{
+	ewin_update_batch_btn(data);
+}
+
 static void ewin_cb_delete_clicked(GtkWidget *widget, gpointer data)
 {
-	int finger = GPOINTER_TO_INT(data);
+	struct ewin *ew = data;
+	struct fp_dev *dev = ew->session->dev;
+	int finger = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget),
+		"finger"));
 	int r;
 
-	r = fp_print_data_delete(fpdev, finger);
+	r = fp_print_data_delete(dev, finger);
 	if (r < 0) {
-		GtkWidget *dialog =
-			gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
+		GtkWidget *dialog = gtk_message_dialog_new_with_markup(
+				GTK_WINDOW(ew->session->window),
 				GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
 				GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
 				"Could not delete enroll data, error %d", r, NULL);
 		gtk_dialog_run(GTK_DIALOG(dialog));
 		gtk_widget_destroy(dialog);
+	} else {
+		print_cache_remove(dev, finger);
 	}
-	mwin_refresh_prints();
+	session_refresh_prints(dev);
 }
 
-static void ewin_clear(void)
+static void ewin_clear(struct fpd_session *session)
 {
+	struct ewin *ew = session->ewin;
 	int i;
+
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
-		gtk_widget_set_sensitive(ewin_enroll_btn[i], FALSE);
-		gtk_widget_set_sensitive(ewin_delete_btn[i], FALSE);
-		gtk_label_set_text(GTK_LABEL(ewin_status_lbl[i]), "Not enrolled");
+		gtk_widget_set_sensitive(ew->enroll_btn[i], FALSE);
+		gtk_widget_set_sensitive(ew->delete_btn[i], FALSE);
+		gtk_widget_set_sensitive(ew->batch_chk[i], FALSE);
+		gtk_label_set_text(GTK_LABEL(ew->status_lbl[i]), "Not enrolled");
 	}
+	ewin_update_batch_btn(ew);
 }
 
-static void ewin_refresh(void)
+static void ewin_refresh(struct fpd_session *session)
 {
-	struct fp_dscv_print *print;
+	struct ewin *ew = session->ewin;
 	int i;
 
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
-		gtk_label_set_text(GTK_LABEL(ewin_status_lbl[i]), "Not enrolled");
-		gtk_widget_set_sensitive(ewin_delete_btn[i], FALSE);
-	}
-
-	i = 0;
-	while ((print = fp_dscv_prints[i++])) {
-		int fnum;
-		if (!fp_dev_supports_dscv_print(fpdev, print))
-			continue;
-
-		fnum = fp_dscv_print_get_finger(print);
-		gtk_label_set_text(GTK_LABEL(ewin_status_lbl[fnum]), "Enrolled");
-		gtk_widget_set_sensitive(ewin_delete_btn[fnum], TRUE);
+		gboolean enrolled = print_cache_lookup(session->dev, i) != NULL;
+		gtk_label_set_text(GTK_LABEL(ew->status_lbl[i]),
+			enrolled ? "Enrolled" : "Not enrolled");
+		gtk_widget_set_sensitive(ew->delete_btn[i], enrolled);
 	}
 }
 
-static void ewin_activate_dev(void)
+static void ewin_activate_dev(struct fpd_session *session)
 {
-	struct fp_dscv_print *print;
-	int i = 0;
-
-	g_assert(fpdev);
-	g_assert(fp_dscv_prints);
+	struct ewin *ew = session->ewin;
+	int i;
 
-	while ((print = fp_dscv_prints[i++])) {
-		int fnum;
-		if (!fp_dev_supports_dscv_print(fpdev, print))
-			continue;
+	g_assert(session->dev);
 
-		fnum = fp_dscv_print_get_finger(print);
-		gtk_label_set_text(GTK_LABEL(ewin_status_lbl[fnum]), "Enrolled");
-		gtk_widget_set_sensitive(ewin_delete_btn[fnum], TRUE);
+	ewin_refresh(session);
+	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
+		gtk_widget_set_sensitive(ew->enroll_btn[i], TRUE);
+		gtk_widget_set_sensitive(ew->batch_chk[i], TRUE);
 	}
-
-	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++)
-		gtk_widget_set_sensitive(ewin_enroll_btn[i], TRUE);
+	ewin_update_batch_btn(ew);
 }
 
-static GtkWidget *ewin_create(void)
+static GtkWidget *ewin_create(struct fpd_session *session)
 {
+	struct ewin *ew;
 	GtkWidget *vbox;
 	GtkWidget *table;
+	GtkWidget *hbox;
 	int i;
 
+	ew = g_slice_new0(struct ewin);
+	ew->session = session;
+	session->ewin = ew;
+
 	vbox = gtk_vbox_new(FALSE, 0);
-	table = gtk_table_new(10, 4, FALSE);
+	table = gtk_table_new(10, 5, FALSE);
 	gtk_table_set_row_spacings(GTK_TABLE(table), 5);
 
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
@@ -401,32 +645,54 @@ static GtkWidget *ewin_create(void)
 		g_free(tmp);
 		gtk_table_attach_defaults(GTK_TABLE(table), label, 0, 1, i - 1, i);
 
-		ewin_status_lbl[i] = gtk_label_new(NULL);
-		gtk_table_attach_defaults(GTK_TABLE(table), ewin_status_lbl[i],
+		ew->status_lbl[i] = gtk_label_new(NULL);
+		gtk_table_attach_defaults(GTK_TABLE(table), ew->status_lbl[i],
 			1, 2, i - 1, i);
 
 		button = gtk_button_new_with_label("Enroll");
 		gtk_table_attach_defaults(GTK_TABLE(table), button, 2, 3, i - 1, i);
+		g_object_set_data(G_OBJECT(button), "finger", GINT_TO_POINTER(i));
 		g_signal_connect(G_OBJECT(button), "clicked",
-			G_CALLBACK(ewin_cb_enroll_clicked), GINT_TO_POINTER(i));
-		ewin_enroll_btn[i] = button;
+			G_CALLBACK(ewin_cb_enroll_clicked), ew);
+		ew->enroll_btn[i] = button;
 
 		button = gtk_button_new_from_stock(GTK_STOCK_DELETE);
+		g_object_set_data(G_OBJECT(button), "finger", GINT_TO_POINTER(i));
 		g_signal_connect(G_OBJECT(button), "clicked",
-			G_CALLBACK(ewin_cb_delete_clicked), GINT_TO_POINTER(i));
+			G_CALLBACK(ewin_cb_delete_clicked), ew);
 		gtk_table_attach_defaults(GTK_TABLE(table), button, 3, 4, i - 1, i);
-		ewin_delete_btn[i] = button;
+		ew->delete_btn[i] = button;
+
+		button = gtk_check_button_new_with_label("Include in batch");
+		g_signal_connect(G_OBJECT(button), "toggled",
+			G_CALLBACK(ewin_cb_batch_toggled), ew);
+		gtk_table_attach_defaults(GTK_TABLE(table), button, 4, 5, i - 1, i);
+		ew->batch_chk[i] = button;
 	}
 
 	gtk_box_pack_start(GTK_BOX(vbox), table, FALSE, FALSE, 0);
+
+	/* Batch enrollment */
+	hbox = gtk_hbox_new(FALSE, 0);
+	ew->batch_btn = gtk_button_new_with_label("Enroll batch");
+	g_signal_connect(G_OBJECT(ew->batch_btn), "clicked",
+		G_CALLBACK(ewin_cb_batch_clicked), ew);
+	gtk_box_pack_end(GTK_BOX(hbox), ew->batch_btn, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 5);
 	return vbox;
 }
 
+static void ewin_destroy(struct fpd_session *session)
+{
+	g_slice_free(struct ewin, session->ewin);
+	session->ewin = NULL;
+}
+
 struct fpd_tab enroll_tab = {
 	.name = "Enroll",
 	.create = ewin_create,
 	.clear = ewin_clear,
 	.activate_dev = ewin_activate_dev,
 	.refresh = ewin_refresh,
+	.destroy = ewin_destroy,
 };
-
@@ -0,0 +1,547 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* GSource which integrates libfprint's file descriptors and timeouts into
+ * a GLib main loop. Shared between the GUI and the headless batch driver,
+ * so nothing in here may depend on GTK+. The application's own file
+ * descriptors can be polled by the same source through watches.
+ * 
+ * Where timerfd is available, libfprint's next timeout is tracked by a
+ * timerfd polled alongside its other fds, and the timer is only re-armed
+ * when the deadline moves. Otherwise the deadline is passed to GLib as the
+ * poll timeout. Either way libfprint is only asked to handle events when
+ * one of its fds or its timeout has actually fired.
+ * 
+ * The source can be attached to a main context run by a thread of its own,
+ * so that USB events are handled however busy the GUI is. libfprint is not
+ * thread safe, so the source then holds a lock whenever it calls into
+ * libfprint and other threads must take the same lock, with
+ * fdsource_lock(), around their own libfprint calls. */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+/* libfprint's pollfds are kept in a dense array, so that they can be
+ * scanned without chasing list links, plus a table indexed by fd giving
+ * each one's position in the array. Removal moves the last pollfd into the
+ * hole, so adding and removing are both constant time. The GPollFDs
+ * themselves are registered with GLib by address and never move. */
+struct fdsource {
+	GSource source;
+	GPtrArray *pollfds;
+	/* index into pollfds by fd, -1 for fds which are not monitored */
+	int *fd_slots;
+	unsigned int nr_fd_slots;
+	/* timerfd for libfprint's timeouts, fd is -1 when there is none */
+	GPollFD timer;
+	gboolean timer_armed;
+	struct timespec deadline;
+	/* libfprint has fds or timeouts to handle this iteration, and when
+	 * that was noticed (with loop stats enabled) */
+	gboolean fp_ready;
+	gint64 ready_at;
+	GSList *watches;
+};
+
+struct fd_watch {
+	GPollFD pollfd;
+	fdsource_watch_cb callback;
+	void *user_data;
+};
+
+/* Serialises libfprint calls and protects the source's bookkeeping. It is
+ * recursive as libfprint calls back into the pollfd notifiers, and watch
+ * callbacks may remove their own watch, with the lock already held. */
+static GStaticRecMutex source_lock = G_STATIC_REC_MUTEX_INIT;
+
+/* serialises image processing calls made from worker threads */
+static GStaticMutex nbis_mutex = G_STATIC_MUTEX_INIT;
+
+/* context the source runs in, when that is not the default one */
+static GMainContext *source_context = NULL;
+
+#ifdef HAVE_SYS_TIMERFD_H
+
+/* deadlines closer than this are treated as unchanged, as libfprint
+ * reports them relative to a slightly earlier time on each call */
+#define TIMER_SLACK_NS 1000000
+
+static void timer_setup(struct fdsource *_fdsource)
+{
+	_fdsource->timer.fd = timerfd_create(CLOCK_MONOTONIC,
+		TFD_NONBLOCK | TFD_CLOEXEC);
+	_fdsource->timer.events = G_IO_IN;
+	_fdsource->timer.revents = 0;
+	_fdsource->timer_armed = FALSE;
+	if (_fdsource->timer.fd < 0)
+		g_warning("timerfd unavailable, using poll timeouts");
+	else
+		g_source_add_poll((GSource *) _fdsource, &_fdsource->timer);
+}
+
+/* arm the timer to fire after tv, or disarm it when tv is NULL */
+static void timer_arm(struct fdsource *_fdsource, struct timeval *tv)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	struct timespec now;
+	struct timespec *deadline = &its.it_value;
+	gint64 delta;
+
+	if (!tv) {
+		if (_fdsource->timer_armed) {
+			timerfd_settime(_fdsource->timer.fd, 0, &its, NULL);
+			_fdsource->timer_armed = FALSE;
+		}
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline->tv_sec = now.tv_sec + tv->tv_sec;
+	deadline->tv_nsec = now.tv_nsec + tv->tv_usec * 1000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+
+	if (_fdsource->timer_armed) {
+		delta = (gint64) (deadline->tv_sec - _fdsource->deadline.tv_sec)
+			* 1000000000 + (deadline->tv_nsec - _fdsource->deadline.tv_nsec);
+		if (delta > -TIMER_SLACK_NS && delta < TIMER_SLACK_NS)
+			return;
+	}
+
+	if (timerfd_settime(_fdsource->timer.fd, TFD_TIMER_ABSTIME, &its,
+			NULL) < 0) {
+		g_warning("couldn't arm timerfd: %s", g_strerror(errno));
+		return;
+	}
+	_fdsource->deadline = *deadline;
+	_fdsource->timer_armed = TRUE;
+}
+
+/* acknowledge an expiry of the timer */
+static void timer_clear(struct fdsource *_fdsource)
+{
+	guint64 expirations;
+
+	if (read(_fdsource->timer.fd, &expirations, sizeof(expirations)) > 0)
+		_fdsource->timer_armed = FALSE;
+	_fdsource->timer.revents = 0;
+}
+
+#else
+
+static void timer_setup(struct fdsource *_fdsource)
+{
+	_fdsource->timer.fd = -1;
+	_fdsource->timer.revents = 0;
+	_fdsource->timer_armed = FALSE;
+}
+
+static void timer_arm(struct fdsource *_fdsource, struct timeval *tv)
+{
+}
+
+static void timer_clear(struct fdsource *_fdsource)
+{
+}
+
+#endif
+
+static gboolean source_prepare(GSource *source, gint *timeout)
+{
+	struct fdsource *_fdsource = (struct fdsource *) source;
+	gint64 start = 0;
+	gboolean fp_ready;
+	int r;
+	struct timeval tv;
+
+	if (loop_stats_enabled) {
+		loop_stats_poll();
+		start = loop_stats_now();
+	}
+
+	g_static_rec_mutex_lock(&source_lock);
+	_fdsource->fp_ready = FALSE;
+	r = fp_get_next_timeout(&tv);
+	if (r == 0) {
+		timer_arm(_fdsource, NULL);
+		*timeout = -1;
+	} else if (!timerisset(&tv)) {
+		_fdsource->fp_ready = TRUE;
+		_fdsource->ready_at = start;
+	} else if (_fdsource->timer.fd >= 0) {
+		timer_arm(_fdsource, &tv);
+		*timeout = -1;
+	} else {
+		*timeout = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	}
+	fp_ready = _fdsource->fp_ready;
+	g_static_rec_mutex_unlock(&source_lock);
+
+	if (loop_stats_enabled)
+		loop_stats_record(LOOP_PREPARE, loop_stats_now() - start);
+	return fp_ready;
+}
+
+static gboolean source_check(GSource *source)
+{
+	struct fdsource *_fdsource = (struct fdsource *) source;
+	GPtrArray *pollfds = _fdsource->pollfds;
+	gboolean watch_ready = FALSE;
+	gboolean fp_ready;
+	gint64 start = 0;
+	GSList *elem;
+	unsigned int i;
+
+	/* the poll has just returned, so this is when fds were found ready */
+	if (loop_stats_enabled)
+		start = loop_stats_now();
+
+	g_static_rec_mutex_lock(&source_lock);
+	for (elem = _fdsource->watches; elem; elem = g_slist_next(elem)) {
+		struct fd_watch *watch = elem->data;
+		if (watch->pollfd.revents) {
+			watch_ready = TRUE;
+			break;
+		}
+	}
+
+	if (_fdsource->timer.revents)
+		_fdsource->fp_ready = TRUE;
+
+	for (i = 0; !_fdsource->fp_ready && i < pollfds->len; i++) {
+		GPollFD *pollfd = g_ptr_array_index(pollfds, i);
+		if (pollfd->revents)
+			_fdsource->fp_ready = TRUE;
+	}
+
+	/* without a timerfd, the poll timeout may have run out */
+	if (!_fdsource->fp_ready && _fdsource->timer.fd < 0) {
+		struct timeval tv;
+		int r = fp_get_next_timeout(&tv);
+		if (r == 1 && !timerisset(&tv))
+			_fdsource->fp_ready = TRUE;
+	}
+	fp_ready = _fdsource->fp_ready;
+	_fdsource->ready_at = start;
+	g_static_rec_mutex_unlock(&source_lock);
+
+	if (loop_stats_enabled)
+		loop_stats_record(LOOP_CHECK, loop_stats_now() - start);
+	return watch_ready || fp_ready;
+}
+
+static gboolean source_dispatch(GSource *source, GSourceFunc callback,
+	gpointer data)
+{
+	struct fdsource *_fdsource = (struct fdsource *) source;
+	struct timeval zerotimeout = {
+		.tv_sec = 0,
+		.tv_usec = 0,
+	};
+	gboolean empty = TRUE;
+	gint64 start = 0;
+	GSList *elem;
+
+	if (loop_stats_enabled)
+		start = loop_stats_now();
+
+	g_static_rec_mutex_lock(&source_lock);
+
+	/* callbacks may remove their own watch */
+	elem = _fdsource->watches;
+	while (elem) {
+		struct fd_watch *watch = elem->data;
+		gushort revents = watch->pollfd.revents;
+
+		elem = g_slist_next(elem);
+		if (revents) {
+			empty = FALSE;
+			watch->pollfd.revents = 0;
+			watch->callback(watch->pollfd.fd, revents, watch->user_data);
+		}
+	}
+
+	if (_fdsource->fp_ready) {
+		empty = FALSE;
+		_fdsource->fp_ready = FALSE;
+		if (loop_stats_enabled) {
+			gint64 now = loop_stats_now();
+
+			loop_stats_record(LOOP_READY, now - _fdsource->ready_at);
+			if (_fdsource->timer.revents)
+				loop_stats_record(LOOP_TIMER_LATE, now
+					- ((gint64) _fdsource->deadline.tv_sec * 1000000000
+					+ _fdsource->deadline.tv_nsec));
+		}
+		if (_fdsource->timer.revents)
+			timer_clear(_fdsource);
+
+		/* FIXME error handling */
+		fp_handle_events_timeout(&zerotimeout);
+	}
+
+	g_static_rec_mutex_unlock(&source_lock);
+
+	if (loop_stats_enabled) {
+		loop_stats_record(LOOP_DISPATCH, loop_stats_now() - start);
+		loop_stats_dispatch(empty);
+	}
+
+	/* FIXME whats the return value used for? */
+	return TRUE;
+}
+
+static void source_finalize(GSource *source)
+{
+	struct fdsource *_fdsource = (struct fdsource *) source;
+	GPtrArray *pollfds = _fdsource->pollfds;
+	GSList *elem;
+	unsigned int i;
+
+	for (i = 0; i < pollfds->len; i++) {
+		GPollFD *pollfd = g_ptr_array_index(pollfds, i);
+		g_source_remove_poll((GSource *) _fdsource, pollfd);
+		g_slice_free(GPollFD, pollfd);
+	}
+	g_ptr_array_free(pollfds, TRUE);
+	g_free(_fdsource->fd_slots);
+
+	if (_fdsource->timer.fd >= 0) {
+		g_source_remove_poll((GSource *) _fdsource, &_fdsource->timer);
+		close(_fdsource->timer.fd);
+	}
+
+	for (elem = _fdsource->watches; elem; elem = g_slist_next(elem))
+		g_slice_free(struct fd_watch, elem->data);
+	g_slist_free(_fdsource->watches);
+}
+
+static GSourceFuncs sourcefuncs = {
+	.prepare = source_prepare,
+	.check = source_check,
+	.dispatch = source_dispatch,
+	.finalize = source_finalize,
+};
+
+static struct fdsource *fdsource = NULL;
+
+void fdsource_lock(void)
+{
+	g_static_rec_mutex_lock(&source_lock);
+}
+
+/* Release the lock, waking the source's thread so that it picks up any new
+ * fds or timeouts resulting from the libfprint calls just made. */
+void fdsource_unlock(void)
+{
+	g_static_rec_mutex_unlock(&source_lock);
+	if (source_context)
+		g_main_context_wakeup(source_context);
+}
+
+/* The NBIS code behind libfprint's binarization, minutiae detection and
+ * bozorth3 matching is not reentrant. Worker threads calling into it take
+ * this lock rather than the source's, so that USB events keep being
+ * handled for however long the processing takes. */
+void nbis_lock(void)
+{
+	g_static_mutex_lock(&nbis_mutex);
+}
+
+void nbis_unlock(void)
+{
+	g_static_mutex_unlock(&nbis_mutex);
+}
+
+static void pollfd_add(int fd, short events)
+{
+	GPollFD *pollfd;
+
+	if (fd < 0) {
+		g_warning("ignoring invalid fd %d", fd);
+		return;
+	}
+
+	if ((unsigned int) fd >= fdsource->nr_fd_slots) {
+		unsigned int nr_slots = MAX(fdsource->nr_fd_slots * 2, 64);
+		unsigned int i;
+
+		while (nr_slots <= (unsigned int) fd)
+			nr_slots *= 2;
+		fdsource->fd_slots = g_renew(int, fdsource->fd_slots, nr_slots);
+		for (i = fdsource->nr_fd_slots; i < nr_slots; i++)
+			fdsource->fd_slots[i] = -1;
+		fdsource->nr_fd_slots = nr_slots;
+	}
+
+	if (fdsource->fd_slots[fd] >= 0) {
+		g_warning("fd %d is already monitored", fd);
+		return;
+	}
+
+	pollfd = g_slice_new(GPollFD);
+	pollfd->fd = fd;
+	pollfd->events = 0;
+	pollfd->revents = 0;
+	if (events & POLLIN)
+		pollfd->events |= G_IO_IN;
+	if (events & POLLOUT)
+		pollfd->events |= G_IO_OUT;
+
+	fdsource->fd_slots[fd] = fdsource->pollfds->len;
+	g_ptr_array_add(fdsource->pollfds, pollfd);
+	g_source_add_poll((GSource *) fdsource, pollfd);
+}
+
+static void pollfd_added_cb(int fd, short events)
+{
+	g_message("now monitoring fd %d", fd);
+	pollfd_add(fd, events);
+}
+
+static void pollfd_removed_cb(int fd)
+{
+	GPollFD *pollfd;
+	GPollFD *last;
+	int slot;
+
+	g_message("no longer monitoring fd %d", fd);
+
+	if (fd < 0 || (unsigned int) fd >= fdsource->nr_fd_slots
+			|| fdsource->fd_slots[fd] < 0) {
+		g_error("couldn't find fd %d in table", fd);
+		return;
+	}
+
+	slot = fdsource->fd_slots[fd];
+	pollfd = g_ptr_array_index(fdsource->pollfds, slot);
+	g_source_remove_poll((GSource *) fdsource, pollfd);
+
+	/* fill the hole with the last pollfd */
+	last = g_ptr_array_index(fdsource->pollfds, fdsource->pollfds->len - 1);
+	g_ptr_array_remove_index_fast(fdsource->pollfds, slot);
+	if (last != pollfd)
+		fdsource->fd_slots[last->fd] = slot;
+	fdsource->fd_slots[fd] = -1;
+
+	g_slice_free(GPollFD, pollfd);
+}
+
+/* Create the source and attach it to context, NULL for the default one.
+ * A context other than the default must be run by a thread of its own. */
+int setup_pollfds_context(GMainContext *context)
+{
+	size_t numfds;
+	size_t i;
+	struct fp_pollfd *fpfds;
+	GSource *gsource = g_source_new(&sourcefuncs, sizeof(struct fdsource));
+
+	fdsource = (struct fdsource *) gsource;
+	fdsource->pollfds = g_ptr_array_new();
+	fdsource->fd_slots = NULL;
+	fdsource->nr_fd_slots = 0;
+	fdsource->fp_ready = FALSE;
+	fdsource->ready_at = 0;
+	fdsource->watches = NULL;
+	timer_setup(fdsource);
+	loop_stats_init();
+
+	numfds = fp_get_pollfds(&fpfds);
+	if (numfds < 0) {
+		if (fpfds)
+			free(fpfds);
+		return (int) numfds;
+	} else if (numfds > 0) {
+		for (i = 0; i < numfds; i++) {
+			struct fp_pollfd *fpfd = &fpfds[i];
+			pollfd_add(fpfd->fd, fpfd->events);
+		}
+	}
+
+	free(fpfds);
+	fp_set_pollfd_notifiers(pollfd_added_cb, pollfd_removed_cb);
+	source_context = context;
+	g_source_attach(gsource, context);
+	return 0;
+}
+
+int setup_pollfds(void)
+{
+	return setup_pollfds_context(NULL);
+}
+
+/* Poll an application file descriptor from the libfprint source. The
+ * callback runs in the source's main loop whenever one of the requested
+ * conditions is raised on fd. That may be another thread, and the source
+ * is locked while the callback runs. */
+int fdsource_add_watch(int fd, GIOCondition events, fdsource_watch_cb callback,
+	void *user_data)
+{
+	struct fd_watch *watch;
+
+	if (!fdsource)
+		return -EINVAL;
+
+	watch = g_slice_new0(struct fd_watch);
+	watch->pollfd.fd = fd;
+	watch->pollfd.events = events;
+	watch->callback = callback;
+	watch->user_data = user_data;
+
+	fdsource_lock();
+	fdsource->watches = g_slist_prepend(fdsource->watches, watch);
+	g_source_add_poll((GSource *) fdsource, &watch->pollfd);
+	fdsource_unlock();
+	return 0;
+}
+
+void fdsource_remove_watch(int fd)
+{
+	GSList *elem;
+
+	if (!fdsource)
+		return;
+
+	fdsource_lock();
+	for (elem = fdsource->watches; elem; elem = g_slist_next(elem)) {
+		struct fd_watch *watch = elem->data;
+		if (watch->pollfd.fd != fd)
+			continue;
+
+		g_source_remove_poll((GSource *) fdsource, &watch->pollfd);
+		fdsource->watches = g_slist_delete_link(fdsource->watches, elem);
+		g_slice_free(struct fd_watch, watch);
+		break;
+	}
+	fdsource_unlock();
+}
@@ -0,0 +1,266 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* fdsource_stress: churns the libfprint pollfd bookkeeping in fdsource.c.
+ * libfprint itself is replaced by the stand-ins below, which hand the
+ * source a set of pipes and then add and remove them at random through the
+ * pollfd notifiers, thousands of times over. Every so often a byte is
+ * written to a pipe and the main loop is run, to check that exactly the
+ * monitored pipes are being polled. Built and run by "make check". */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+/* how many churn operations between main loop iterations */
+#define CHECK_INTERVAL 1024
+
+static int nr_pipes = 256;
+static int nr_ops = 1000000;
+static int seed = 0;
+
+static int *read_fds;
+static int *write_fds;
+static gboolean *monitored;
+static gboolean *pending;
+
+static fp_pollfd_added_cb added_cb = NULL;
+static fp_pollfd_removed_cb removed_cb = NULL;
+static int nr_dispatches = 0;
+
+/* stand-ins for the parts of libfprint used by fdsource.c */
+
+ssize_t fp_get_pollfds(struct fp_pollfd **pollfds)
+{
+	/* start out with every other pipe monitored */
+	struct fp_pollfd *fpfds = calloc(nr_pipes, sizeof(*fpfds));
+	ssize_t numfds = 0;
+	int i;
+
+	for (i = 0; i < nr_pipes; i += 2) {
+		fpfds[numfds].fd = read_fds[i];
+		fpfds[numfds].events = POLLIN;
+		monitored[i] = TRUE;
+		numfds++;
+	}
+
+	*pollfds = fpfds;
+	return numfds;
+}
+
+void fp_set_pollfd_notifiers(fp_pollfd_added_cb _added_cb,
+	fp_pollfd_removed_cb _removed_cb)
+{
+	added_cb = _added_cb;
+	removed_cb = _removed_cb;
+}
+
+int fp_get_next_timeout(struct timeval *tv)
+{
+	return 0;
+}
+
+int fp_handle_events_timeout(struct timeval *timeout)
+{
+	char buf[64];
+	int i;
+
+	nr_dispatches++;
+	for (i = 0; i < nr_pipes; i++) {
+		if (!pending[i])
+			continue;
+		while (read(read_fds[i], buf, sizeof(buf)) > 0)
+			;
+		pending[i] = FALSE;
+	}
+	return 0;
+}
+
+static void discard_log(const gchar *log_domain, GLogLevelFlags log_level,
+	const gchar *message, gpointer user_data)
+{
+}
+
+static int open_pipes(void)
+{
+	int i;
+
+	read_fds = g_new(int, nr_pipes);
+	write_fds = g_new(int, nr_pipes);
+	monitored = g_new0(gboolean, nr_pipes);
+	pending = g_new0(gboolean, nr_pipes);
+
+	for (i = 0; i < nr_pipes; i++) {
+		int fds[2];
+
+		if (pipe(fds) < 0) {
+			fprintf(stderr, "pipe %d failed: %s\n", i, strerror(errno));
+			return -errno;
+		}
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		read_fds[i] = fds[0];
+		write_fds[i] = fds[1];
+	}
+
+	return 0;
+}
+
+/* poke pipe i and check that the source wakes up only when a pipe with
+ * data waiting is monitored */
+static int check_poll(int i)
+{
+	gboolean expected = FALSE;
+	int before = nr_dispatches;
+	int j;
+
+	if (write(write_fds[i], "x", 1) != 1) {
+		fprintf(stderr, "write to pipe %d failed\n", i);
+		return -EIO;
+	}
+	pending[i] = TRUE;
+
+	for (j = 0; j < nr_pipes; j++)
+		if (pending[j] && monitored[j]) {
+			expected = TRUE;
+			break;
+		}
+
+	g_main_context_iteration(NULL, FALSE);
+	if ((nr_dispatches != before) != expected) {
+		fprintf(stderr, "pipe %d: expected %s dispatch\n", i,
+			expected ? "a" : "no");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static GOptionEntry entries[] = {
+	{ "pipes", 'n', 0, G_OPTION_ARG_INT, &nr_pipes,
+		"Number of pipes to churn (default 256)", "N" },
+	{ "ops", 'o', 0, G_OPTION_ARG_INT, &nr_ops,
+		"Number of add/remove notifications (default 1000000)", "N" },
+	{ "seed", 's', 0, G_OPTION_ARG_INT, &seed,
+		"Random seed (default 0: pick one)", "SEED" },
+	{ NULL }
+};
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	GTimer *timer;
+	GRand *rng;
+	double churn_time = 0;
+	int nr_checks = 0;
+	int nr_added = 0;
+	int nr_removed = 0;
+	int op;
+	int i;
+	int r;
+
+	context = g_option_context_new("- stress the pollfd bookkeeping");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (nr_pipes < 1 || nr_ops < 0) {
+		fprintf(stderr, "invalid pipe or op count\n");
+		return 1;
+	}
+	if (!seed)
+		seed = (int) time(NULL);
+	rng = g_rand_new_with_seed(seed);
+	printf("seed %d, %d pipes, %d ops\n", seed, nr_pipes, nr_ops);
+
+	/* every add and remove is logged, which would swamp the timing */
+	g_log_set_handler(NULL, G_LOG_LEVEL_MESSAGE, discard_log, NULL);
+
+	r = open_pipes();
+	if (r < 0)
+		return 1;
+
+	r = setup_pollfds();
+	if (r < 0 || !added_cb || !removed_cb) {
+		fprintf(stderr, "pollfd setup failed\n");
+		return 1;
+	}
+
+	timer = g_timer_new();
+	for (op = 0; op < nr_ops; op += CHECK_INTERVAL) {
+		int end = MIN(op + CHECK_INTERVAL, nr_ops);
+		int j;
+
+		g_timer_start(timer);
+		for (j = op; j < end; j++) {
+			i = g_rand_int_range(rng, 0, nr_pipes);
+			if (monitored[i]) {
+				removed_cb(read_fds[i]);
+				nr_removed++;
+			} else {
+				added_cb(read_fds[i], POLLIN);
+				nr_added++;
+			}
+			monitored[i] = !monitored[i];
+		}
+		g_timer_stop(timer);
+		churn_time += g_timer_elapsed(timer, NULL);
+
+		if (check_poll(g_rand_int_range(rng, 0, nr_pipes)) < 0)
+			return 1;
+		nr_checks++;
+	}
+
+	/* drain the table completely, then make sure nothing is polled */
+	for (i = 0; i < nr_pipes; i++)
+		if (monitored[i]) {
+			removed_cb(read_fds[i]);
+			monitored[i] = FALSE;
+		}
+	if (check_poll(0) < 0)
+		return 1;
+
+	printf("%d added, %d removed, %d poll checks\n", nr_added, nr_removed,
+		nr_checks);
+	if (nr_ops > 0)
+		printf("%.1f ns per notification\n", churn_time * 1e9 / nr_ops);
+
+	for (i = 0; i < nr_pipes; i++) {
+		close(read_fds[i]);
+		close(write_fds[i]);
+	}
+	g_timer_destroy(timer);
+	g_rand_free(rng);
+	return 0;
+}
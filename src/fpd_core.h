@@ -0,0 +1,305 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Declarations shared by the GUI and the headless tools. Only GLib and
+ * libfprint may be pulled in from here. */
+
+#ifndef __FPD_CORE_H__
+#define __FPD_CORE_H__
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+/* fdsource.c */
+typedef void (*fdsource_watch_cb)(int fd, GIOCondition revents,
+	void *user_data);
+
+int setup_pollfds(void);
+int setup_pollfds_context(GMainContext *context);
+void fdsource_lock(void);
+void fdsource_unlock(void);
+void nbis_lock(void);
+void nbis_unlock(void);
+int fdsource_add_watch(int fd, GIOCondition events, fdsource_watch_cb callback,
+	void *user_data);
+void fdsource_remove_watch(int fd);
+
+/* hotplug.c */
+typedef void (*hotplug_cb)(void *user_data);
+
+int hotplug_monitor_start(hotplug_cb callback, void *user_data);
+void hotplug_monitor_stop(void);
+
+/* iothread.c */
+int io_thread_start(void);
+void io_thread_stop(void);
+int io_dev_open(struct fp_dscv_dev *ddev, fp_dev_open_cb callback,
+	void *user_data);
+void io_dev_close(struct fp_dev *dev);
+int io_enroll_start(struct fp_dev *dev, fp_enroll_stage_cb callback,
+	void *user_data);
+int io_enroll_stop(struct fp_dev *dev, fp_enroll_stop_cb callback,
+	void *user_data);
+int io_verify_start(struct fp_dev *dev, struct fp_print_data *data,
+	fp_verify_cb callback, void *user_data);
+int io_verify_stop(struct fp_dev *dev, fp_verify_stop_cb callback,
+	void *user_data);
+int io_identify_start(struct fp_dev *dev, struct fp_print_data **gallery,
+	fp_identify_cb callback, void *user_data);
+int io_identify_stop(struct fp_dev *dev, fp_identify_stop_cb callback,
+	void *user_data);
+int io_capture_start(struct fp_dev *dev, int unconditional,
+	fp_capture_cb callback, void *user_data);
+int io_capture_stop(struct fp_dev *dev, fp_capture_stop_cb callback,
+	void *user_data);
+gint64 io_event_time(void);
+
+/* loopstats.c */
+enum loop_phase {
+	LOOP_PREPARE,
+	LOOP_CHECK,
+	LOOP_DISPATCH,
+	/* libfprint's fds or timeout found ready -> libfprint called */
+	LOOP_READY,
+	/* timer expiry -> libfprint called */
+	LOOP_TIMER_LATE,
+	NR_LOOP_PHASES,
+};
+
+extern gboolean loop_stats_enabled;
+
+void loop_stats_init(void);
+gint64 loop_stats_now(void);
+void loop_stats_record(enum loop_phase phase, gint64 ns);
+void loop_stats_dispatch(gboolean empty);
+void loop_stats_poll(void);
+void loop_stats_dump(void);
+
+/* scantrace.c */
+enum scan_stage {
+	SCAN_STARTED,
+	SCAN_CALLBACK,
+	SCAN_DELIVERED,
+	SCAN_IMAGE,
+	SCAN_RESULT,
+	SCAN_DRAWN,
+	SCAN_STOPPED,
+	NR_SCAN_STAGES,
+};
+
+struct scan_trace;
+
+struct scan_trace *scan_trace_begin(const char *op, struct fp_dev *dev);
+void scan_trace_mark(struct scan_trace *trace, enum scan_stage stage);
+void scan_trace_callback(struct scan_trace *trace, gint64 raised_at,
+	int result, gboolean have_img);
+void scan_trace_hold(struct scan_trace *trace);
+void scan_trace_release(struct scan_trace *trace);
+
+/* printcache.c */
+struct fpd_print {
+	uint16_t driver_id;
+	uint32_t devtype;
+	enum fp_finger finger;
+	/* index in the print pack, or -1 */
+	int pack_index;
+	/* without a pack, NULL for prints enrolled since startup */
+	struct fp_dscv_print *dscv;
+	/* unique to each entry, changes when a finger is re-enrolled */
+	unsigned int serial;
+};
+
+int print_cache_init(void);
+void print_cache_exit(void);
+struct fpd_print *print_cache_lookup(struct fp_dev *dev, enum fp_finger finger);
+void print_cache_add(struct fp_dev *dev, enum fp_finger finger,
+	struct fp_print_data *data);
+void print_cache_add_many(struct fp_dev *dev, const enum fp_finger *fingers,
+	struct fp_print_data **data, unsigned int nr_prints);
+void print_cache_remove(struct fp_dev *dev, enum fp_finger finger);
+int print_cache_load(struct fp_dev *dev, struct fpd_print *print,
+	struct fp_print_data **data);
+
+/* printpack.c */
+#define PRINT_PACK_USER_ID_MAX 43
+
+struct print_pack;
+struct print_pack_info {
+	uint16_t driver_id;
+	uint32_t devtype;
+	enum fp_finger finger;
+	const char *user_id;
+};
+
+struct print_pack *print_pack_open(const char *path, gboolean create);
+void print_pack_close(struct print_pack *pack);
+unsigned int print_pack_size(struct print_pack *pack);
+int print_pack_get(struct print_pack *pack, unsigned int i,
+	struct print_pack_info *info);
+int print_pack_load(struct print_pack *pack, unsigned int i,
+	struct fp_print_data **data);
+int print_pack_append_raw(struct print_pack *pack, const char *user_id,
+	uint16_t driver_id, uint32_t devtype, enum fp_finger finger,
+	const unsigned char *buf, size_t length);
+int print_pack_append(struct print_pack *pack, const char *user_id,
+	enum fp_finger finger, struct fp_print_data *data);
+int print_pack_append_many(struct print_pack *pack, const char *user_id,
+	const enum fp_finger *fingers, struct fp_print_data **data,
+	unsigned int nr_prints);
+int print_pack_remove(struct print_pack *pack, unsigned int i);
+int print_pack_import_dir(struct print_pack *pack, const char *path,
+	const char *user_id);
+
+/* gallery.c */
+struct gallery;
+struct gallery_entry {
+	const char *user_id;
+	enum fp_finger finger;
+};
+
+struct gallery *gallery_load(const char *path, struct fp_dev *dev);
+int gallery_write_pack(const char *path, const char *pack_path);
+void gallery_free(struct gallery *gallery);
+unsigned int gallery_size(struct gallery *gallery);
+unsigned int gallery_nr_users(struct gallery *gallery);
+struct fp_print_data **gallery_prints(struct gallery *gallery,
+	unsigned int limit);
+const struct gallery_entry *gallery_lookup(struct gallery *gallery,
+	size_t match_offset);
+
+/* devpool.c */
+#define DEV_POOL_DEFAULT_LIMIT 2
+
+/* an opened device, with the prints loaded for it */
+struct dev_handle {
+	struct fp_dev *dev;
+	/* templates for the enrolled fingers and the multi-user gallery,
+	 * loaded for identification and dropped when dev is closed */
+	struct fp_print_data *resident[RIGHT_LITTLE + 1];
+	unsigned int resident_serial[RIGHT_LITTLE + 1];
+	struct gallery *store;
+
+	int refcnt;
+	gboolean in_use;
+	/* position in the pool while open but unused */
+	GList *idle_link;
+};
+
+struct dev_handle *dev_handle_new(void);
+struct dev_handle *dev_handle_ref(struct dev_handle *handle);
+void dev_handle_unref(struct dev_handle *handle);
+gboolean dev_handle_acquire(struct dev_handle *handle);
+void dev_handle_release(struct dev_handle *handle);
+void dev_pool_set_limit(unsigned int limit);
+void dev_pool_exit(void);
+
+/* matcher.c */
+typedef void (*sw_match_cb)(int result, size_t match_offset, void *user_data);
+gboolean sw_match_available(void);
+int sw_match_submit(struct fp_dev *dev, struct fp_img *img,
+	struct fp_print_data **gallery, sw_match_cb callback, void *user_data);
+
+/* rgbconv.c */
+#define GRAY_TO_RGB_MAX_KERNELS 3
+
+typedef void (*gray_to_rgb_fn)(unsigned char *dst, const unsigned char *src,
+	size_t n);
+
+struct gray_to_rgb_kernel {
+	const char *name;
+	gray_to_rgb_fn fn;
+};
+
+void gray_to_rgb(unsigned char *dst, const unsigned char *src, size_t n);
+int gray_to_rgb_kernels(struct gray_to_rgb_kernel *kernels);
+void plot_cross(unsigned char *rgbdata, int width, int x, int y);
+void plot_minutiae(unsigned char *rgbdata, int width, int height,
+	struct fp_minutia **minlist, int nr_minutiae);
+
+/* framefile.c */
+enum frame_source {
+	FRAME_VERIFY,
+	FRAME_IDENTIFY,
+	FRAME_ENROLL,
+	FRAME_CAPTURE,
+};
+
+struct recorded_frame {
+	/* wall clock time, microseconds since the epoch */
+	gint64 timestamp_us;
+	/* microseconds since the recording was started */
+	gint64 offset_us;
+	enum frame_source source;
+	/* the finger scanned for, or matched, -1 if not known */
+	int finger;
+	int result;
+	uint16_t driver_id;
+	uint32_t devtype;
+	const char *driver_name;
+	int width;
+	int height;
+	const unsigned char *data;
+};
+
+struct frame_writer;
+struct frame_reader;
+
+struct frame_writer *frame_writer_open(const char *path);
+int frame_writer_add(struct frame_writer *writer, struct fp_dev *dev,
+	enum frame_source source, int finger, int result, struct fp_img *img);
+void frame_writer_close(struct frame_writer *writer);
+void frame_record(struct fp_dev *dev, enum frame_source source, int finger,
+	int result, struct fp_img *img);
+void frame_record_exit(void);
+struct frame_reader *frame_reader_open(const char *path);
+unsigned int frame_reader_count(struct frame_reader *reader);
+int frame_reader_seek(struct frame_reader *reader, unsigned int n);
+int frame_reader_next(struct frame_reader *reader,
+	struct recorded_frame *frame);
+void frame_reader_close(struct frame_reader *reader);
+gboolean frame_replay_available(void);
+struct fp_img *frame_to_img(const struct recorded_frame *frame);
+
+/* imgring.c */
+struct img_ring;
+struct img_ring *img_ring_new(unsigned int size);
+void img_ring_free(struct img_ring *ring);
+void img_ring_flush(struct img_ring *ring);
+void img_ring_push(struct img_ring *ring, struct fp_img *img);
+struct fp_img *img_ring_pop(struct img_ring *ring);
+unsigned int img_ring_count(struct img_ring *ring);
+unsigned int img_ring_dropped(struct img_ring *ring);
+void img_ring_reset_stats(struct img_ring *ring);
+
+/* imgsave.c */
+enum img_save_format {
+	IMG_SAVE_PNG,
+	IMG_SAVE_PGM,
+};
+
+struct img_save_job;
+typedef void (*img_save_cb)(const char *path, int result, void *user_data);
+enum img_save_format img_save_format_for(const char *path);
+struct img_save_job *img_save_submit(const char *path,
+	enum img_save_format format, const unsigned char *data, int width,
+	int height, img_save_cb callback, void *user_data);
+void img_save_cancel(struct img_save_job *job);
+void img_save_flush(void);
+
+#endif
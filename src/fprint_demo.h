@@ -24,23 +24,109 @@
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <libfprint/fprint.h>
 
+#include "fpd_core.h"
+
 /* main.c */
-extern struct fp_dev *fpdev;
-extern struct fp_dscv_print **fp_dscv_prints;
-extern GtkWidget *mwin_window;
+extern char *gallery_path;
 const char *fingerstr(enum fp_finger finger);
+
+/* pixbuf.c */
 void pixbuf_destroy(guchar *pixels, gpointer data);
+unsigned char *gray_to_rgbdata(const unsigned char *data, int width,
+	int height);
+GdkPixbuf *gray_to_pixbuf(const unsigned char *data, int width, int height);
 unsigned char *img_to_rgbdata(struct fp_img *img);
 GdkPixbuf *img_to_pixbuf(struct fp_img *img);
-void mwin_refresh_prints(void);
+
+/* session.c */
+#define NR_TABS 4
+
+struct ewin;
+struct vwin;
+struct iwin;
+struct cwin;
+
+/* one open device, with its own window and tabs */
+struct fpd_session {
+	struct fp_dev *dev;
+	/* the device's entry in the pool of open devices */
+	struct dev_handle *handle;
+	GtkWidget *window;
+	GtkWindowGroup *group;
+	GtkWidget *notebook;
+	GtkWidget *please_wait;
+	GtkWidget *status_label;
+	GtkWidget *drvname_label;
+	GtkWidget *imgcapa_label;
+
+	/* Tabs are only built when first shown. Until then the notebook holds
+	 * an empty page for them and they are skipped by tab operations. */
+	GtkWidget *tab_pages[NR_TABS];
+	gboolean tab_built[NR_TABS];
+
+	/* per-tab state, set up by the tab's create operation */
+	struct ewin *ewin;
+	struct vwin *vwin;
+	struct iwin *iwin;
+	struct cwin *cwin;
+
+	/* TRUE once dev is open and the built tabs have been activated */
+	gboolean active;
+	/* device operations in progress, see session_op_begin */
+	int busy;
+	/* the prints changed during an operation, refresh once it ends */
+	gboolean refresh_pending;
+	gboolean closing;
+};
+
+struct fpd_session *session_open(struct dev_handle *handle,
+	struct fp_dscv_dev *ddev, const char *name);
+void session_present(struct fpd_session *session);
+void session_close(struct fpd_session *session);
+void session_op_begin(struct fpd_session *session);
+void session_op_end(struct fpd_session *session);
+void session_refresh_prints(struct fp_dev *dev);
+void sessions_exit(void);
+
+/* analysis.c */
+struct img_analysis {
+	struct fp_img *img;
+	struct fp_img *img_bin;
+	struct fp_minutia **minlist;
+	int nr_minutiae;
+	int width;
+	int height;
+	/* indexed by [binarized][minutiae plotted] */
+	GdkPixbuf *pixbufs[2][2];
+};
+
+struct img_analysis_job;
+typedef void (*img_analysis_cb)(struct img_analysis *analysis,
+	void *user_data);
+
+struct img_analysis_job *img_analysis_submit(struct fp_img *img,
+	img_analysis_cb callback, void *user_data);
+void img_analysis_cancel(struct img_analysis_job *job);
+void img_analysis_free(struct img_analysis *analysis);
+
+struct img_thumbnail_job;
+typedef void (*img_thumbnail_cb)(GdkPixbuf *pixbuf, void *user_data);
+
+struct img_thumbnail_job *img_thumbnail_submit(struct fp_img *img,
+	int max_size, img_thumbnail_cb callback, void *user_data);
+void img_thumbnail_cancel(struct img_thumbnail_job *job);
 
 /* tabs */
 struct fpd_tab {
 	const char *name;
-	GtkWidget *(*create)(void);
-	void (*activate_dev)(void);
-	void (*clear)(void);
-	void (*refresh)(void);
+	GtkWidget *(*create)(struct fpd_session *session);
+	void (*activate_dev)(struct fpd_session *session);
+	void (*clear)(struct fpd_session *session);
+	void (*refresh)(struct fpd_session *session);
+	/* end any operation which would otherwise run until the user stops it */
+	void (*stop)(struct fpd_session *session);
+	/* free the tab's state, its widgets are destroyed with the window */
+	void (*destroy)(struct fpd_session *session);
 };
 
 extern struct fpd_tab enroll_tab;
@@ -49,8 +135,8 @@ extern struct fpd_tab identify_tab;
 extern struct fpd_tab img_tab;
 
 /* helper dialogs */
-GtkWidget *run_please_wait_dialog(char *msg);
-GtkWidget *create_scan_finger_dialog(void);
+GtkWidget *run_please_wait_dialog(GtkWidget *parent, char *msg);
+GtkWidget *create_scan_finger_dialog(GtkWidget *parent);
 void run_scan_finger_dialog(GtkWidget *dialog);
 void destroy_scan_finger_dialog(GtkWidget *dialog);
 
@@ -0,0 +1,525 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Frame archives: the images delivered by a reader, with the time each
+ * arrived and what it was scanned for, so that the image pipeline can be
+ * run again later without the reader (see fprint_batch --replay) and so
+ * that large numbers of frames can be collected for tuning.
+ * 
+ * The file is a header followed by chunks, each a tag, a payload length
+ * and the payload. Every frame is a FRME chunk: a fixed size header, the
+ * driver name and the 8-bit image data. Frames are only ever appended, and
+ * are written by a thread of their own so that recording never holds up
+ * the caller. Closing the archive appends a FIDX chunk holding the file
+ * offset of every FRME chunk, which ends in a trailer pointing back at
+ * it, so that readers can find any frame without reading the ones before
+ * it. An archive cut short by a crash has no index and is still readable
+ * up to its last whole frame; the index is then rebuilt by walking the
+ * chunk headers. All fields are little endian. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+#define FRAME_MAGIC "FPDFRAM"
+#define FRAME_VERSION 2
+#define INDEX_MAGIC "FPDINDEX"
+
+#define TAG_FRAME "FRME"
+#define TAG_INDEX "FIDX"
+
+/* sanity limit on image dimensions when reading */
+#define FRAME_MAX_DIM 4096
+
+/* frames waiting to be written beyond this many bytes are dropped, rather
+ * than letting a slow disk hold up the caller or eat all memory */
+#define FRAME_QUEUE_MAX (64 * 1024 * 1024)
+
+struct frame_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved[3];
+};
+
+struct chunk_header {
+	char tag[4];
+	uint32_t length;
+};
+
+struct frame_header {
+	/* wall clock time the frame arrived, microseconds since the epoch */
+	int64_t timestamp_us;
+	/* microseconds since the archive was started */
+	int64_t offset_us;
+	uint32_t width;
+	uint32_t height;
+	int32_t result;
+	uint32_t devtype;
+	uint16_t driver_id;
+	uint8_t source;
+	int8_t finger;
+	uint8_t name_len;
+	uint8_t reserved[3];
+};
+
+/* the last bytes of a FIDX chunk, and of the file */
+struct index_trailer {
+	uint64_t index_offset;
+	uint32_t nr_frames;
+	uint32_t reserved;
+	char magic[8];
+};
+
+struct frame_writer {
+	FILE *file;
+	GTimer *timer;
+	GThreadPool *pool;
+	/* bytes queued but not yet written */
+	volatile gint pending;
+	volatile gint failed;
+	unsigned int dropped;
+
+	/* only touched by the writing thread until it has been stopped */
+	uint64_t pos;
+	GArray *index;
+};
+
+struct frame_reader {
+	FILE *file;
+	/* file offset of each frame */
+	GArray *index;
+	unsigned int next;
+	unsigned char *data;
+	size_t data_size;
+	char driver_name[256];
+};
+
+/* a FRME chunk ready to be written */
+struct frame_chunk {
+	size_t size;
+	unsigned char buf[];
+};
+
+/* runs on the writing thread */
+static void writer_run(gpointer data, gpointer user_data)
+{
+	struct frame_chunk *chunk = data;
+	struct frame_writer *writer = user_data;
+
+	if (!g_atomic_int_get(&writer->failed)) {
+		if (fwrite(chunk->buf, chunk->size, 1, writer->file) != 1
+				|| fflush(writer->file) != 0) {
+			g_atomic_int_set(&writer->failed, 1);
+		} else {
+			g_array_append_val(writer->index, writer->pos);
+			writer->pos += chunk->size;
+		}
+	}
+
+	g_atomic_int_add(&writer->pending, -(gint) chunk->size);
+	g_free(chunk);
+}
+
+struct frame_writer *frame_writer_open(const char *path)
+{
+	struct frame_file_header hdr;
+	struct frame_writer *writer;
+	FILE *file;
+
+	file = fopen(path, "wb");
+	if (!file)
+		return NULL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+	hdr.version = GUINT32_TO_LE(FRAME_VERSION);
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+		fclose(file);
+		return NULL;
+	}
+
+	writer = g_slice_new0(struct frame_writer);
+	writer->file = file;
+	writer->timer = g_timer_new();
+	writer->pos = sizeof(hdr);
+	writer->index = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+	writer->pool = g_thread_pool_new(writer_run, writer, 1, FALSE, NULL);
+	return writer;
+}
+
+/* Queue img, as delivered to an operation on dev for the given finger (-1
+ * if not known) with the given result, to be appended. The image stays
+ * owned by the caller. Returns -EIO once writing has failed; frames which
+ * arrive while too many are waiting to be written are dropped. */
+int frame_writer_add(struct frame_writer *writer, struct fp_dev *dev,
+	enum frame_source source, int finger, int result, struct fp_img *img)
+{
+	struct fp_driver *drv = fp_dev_get_driver(dev);
+	const char *name = fp_driver_get_name(drv);
+	size_t name_len = MIN(strlen(name), 255);
+	int width = fp_img_get_width(img);
+	int height = fp_img_get_height(img);
+	size_t payload = sizeof(struct frame_header) + name_len + width * height;
+	struct frame_chunk *chunk;
+	struct chunk_header *chdr;
+	struct frame_header *hdr;
+	GTimeVal now;
+
+	if (g_atomic_int_get(&writer->failed))
+		return -EIO;
+	if (g_atomic_int_get(&writer->pending) + payload > FRAME_QUEUE_MAX) {
+		writer->dropped++;
+		return 0;
+	}
+
+	chunk = g_malloc0(sizeof(*chunk) + sizeof(*chdr) + payload);
+	chunk->size = sizeof(*chdr) + payload;
+	chdr = (struct chunk_header *) chunk->buf;
+	hdr = (struct frame_header *) (chunk->buf + sizeof(*chdr));
+
+	memcpy(chdr->tag, TAG_FRAME, 4);
+	chdr->length = GUINT32_TO_LE(payload);
+
+	g_get_current_time(&now);
+	hdr->timestamp_us = GINT64_TO_LE((gint64) now.tv_sec * 1000000
+		+ now.tv_usec);
+	hdr->offset_us = GINT64_TO_LE((gint64)
+		(g_timer_elapsed(writer->timer, NULL) * 1000000));
+	hdr->width = GUINT32_TO_LE(width);
+	hdr->height = GUINT32_TO_LE(height);
+	hdr->result = GINT32_TO_LE(result);
+	hdr->devtype = GUINT32_TO_LE(fp_dev_get_devtype(dev));
+	hdr->driver_id = GUINT16_TO_LE(fp_driver_get_driver_id(drv));
+	hdr->source = source;
+	hdr->finger = finger;
+	hdr->name_len = name_len;
+	memcpy(hdr + 1, name, name_len);
+	memcpy((unsigned char *) (hdr + 1) + name_len, fp_img_get_data(img),
+		width * height);
+
+	g_atomic_int_add(&writer->pending, chunk->size);
+	g_thread_pool_push(writer->pool, chunk, NULL);
+	return 0;
+}
+
+static int write_index(struct frame_writer *writer)
+{
+	struct chunk_header chdr;
+	struct index_trailer trailer;
+	unsigned int i;
+
+	memcpy(chdr.tag, TAG_INDEX, 4);
+	chdr.length = GUINT32_TO_LE(writer->index->len * sizeof(uint64_t)
+		+ sizeof(trailer));
+	if (fwrite(&chdr, sizeof(chdr), 1, writer->file) != 1)
+		return -EIO;
+
+	for (i = 0; i < writer->index->len; i++) {
+		uint64_t offset = GUINT64_TO_LE(
+			g_array_index(writer->index, uint64_t, i));
+		if (fwrite(&offset, sizeof(offset), 1, writer->file) != 1)
+			return -EIO;
+	}
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.index_offset = GUINT64_TO_LE(writer->pos);
+	trailer.nr_frames = GUINT32_TO_LE(writer->index->len);
+	memcpy(trailer.magic, INDEX_MAGIC, sizeof(trailer.magic));
+	if (fwrite(&trailer, sizeof(trailer), 1, writer->file) != 1)
+		return -EIO;
+	return 0;
+}
+
+/* Waits for all queued frames to be written, then adds the index. */
+void frame_writer_close(struct frame_writer *writer)
+{
+	if (!writer)
+		return;
+
+	g_thread_pool_free(writer->pool, FALSE, TRUE);
+	if (writer->failed || write_index(writer) < 0)
+		g_warning("frame archive incomplete, it will be read without "
+			"an index");
+	if (writer->dropped)
+		g_warning("%u frame(s) dropped while the archive was falling "
+			"behind", writer->dropped);
+
+	fclose(writer->file);
+	g_timer_destroy(writer->timer);
+	g_array_free(writer->index, TRUE);
+	g_slice_free(struct frame_writer, writer);
+}
+
+static struct frame_writer *recorder = NULL;
+static gboolean recorder_checked = FALSE;
+
+/* Record img to the archive named by FPD_RECORD_FRAMES, if it is set. */
+void frame_record(struct fp_dev *dev, enum frame_source source, int finger,
+	int result, struct fp_img *img)
+{
+	const char *path;
+
+	if (!img)
+		return;
+
+	if (!recorder_checked) {
+		recorder_checked = TRUE;
+		path = g_getenv("FPD_RECORD_FRAMES");
+		if (path && *path) {
+			recorder = frame_writer_open(path);
+			if (!recorder)
+				g_warning("couldn't record frames to %s", path);
+		}
+	}
+
+	if (recorder && frame_writer_add(recorder, dev, source, finger, result,
+			img) < 0) {
+		g_warning("frame recording failed, stopping");
+		frame_writer_close(recorder);
+		recorder = NULL;
+	}
+}
+
+/* Finish the archive started by frame_record(). */
+void frame_record_exit(void)
+{
+	frame_writer_close(recorder);
+	recorder = NULL;
+}
+
+/* load the index through the trailer at the end of the file */
+static gboolean read_index(struct frame_reader *reader)
+{
+	struct index_trailer trailer;
+	struct chunk_header chdr;
+	off_t index_offset;
+	uint32_t nr_frames;
+	uint32_t i;
+
+	if (fseeko(reader->file, -(off_t) sizeof(trailer), SEEK_END) != 0
+			|| fread(&trailer, sizeof(trailer), 1, reader->file) != 1
+			|| memcmp(trailer.magic, INDEX_MAGIC, sizeof(trailer.magic)))
+		return FALSE;
+
+	index_offset = GUINT64_FROM_LE(trailer.index_offset);
+	nr_frames = GUINT32_FROM_LE(trailer.nr_frames);
+	if (fseeko(reader->file, index_offset, SEEK_SET) != 0
+			|| fread(&chdr, sizeof(chdr), 1, reader->file) != 1
+			|| memcmp(chdr.tag, TAG_INDEX, 4) != 0
+			|| GUINT32_FROM_LE(chdr.length) != nr_frames
+				* sizeof(uint64_t) + sizeof(trailer))
+		return FALSE;
+
+	g_array_set_size(reader->index, nr_frames);
+	for (i = 0; i < nr_frames; i++) {
+		uint64_t offset;
+		if (fread(&offset, sizeof(offset), 1, reader->file) != 1) {
+			g_array_set_size(reader->index, 0);
+			return FALSE;
+		}
+		g_array_index(reader->index, uint64_t, i) = GUINT64_FROM_LE(offset);
+	}
+	return TRUE;
+}
+
+/* build the index by walking the chunks, for archives which were not
+ * closed; a frame cut short ends the walk */
+static void scan_index(struct frame_reader *reader)
+{
+	struct chunk_header chdr;
+	struct frame_header hdr;
+	off_t end;
+	off_t pos = sizeof(struct frame_file_header);
+
+	g_array_set_size(reader->index, 0);
+	if (fseeko(reader->file, 0, SEEK_END) != 0)
+		return;
+	end = ftello(reader->file);
+
+	while (fseeko(reader->file, pos, SEEK_SET) == 0
+			&& fread(&chdr, sizeof(chdr), 1, reader->file) == 1) {
+		off_t next = pos + sizeof(chdr) + GUINT32_FROM_LE(chdr.length);
+		if (next > end)
+			break;
+		if (memcmp(chdr.tag, TAG_FRAME, 4) == 0) {
+			uint64_t offset = pos;
+			if (fread(&hdr, sizeof(hdr), 1, reader->file) != 1)
+				break;
+			g_array_append_val(reader->index, offset);
+		}
+		pos = next;
+	}
+}
+
+struct frame_reader *frame_reader_open(const char *path)
+{
+	struct frame_file_header hdr;
+	struct frame_reader *reader;
+	FILE *file;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1
+			|| memcmp(hdr.magic, FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0
+			|| GUINT32_FROM_LE(hdr.version) != FRAME_VERSION) {
+		fclose(file);
+		return NULL;
+	}
+
+	reader = g_slice_new0(struct frame_reader);
+	reader->file = file;
+	reader->index = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+	if (!read_index(reader))
+		scan_index(reader);
+	return reader;
+}
+
+unsigned int frame_reader_count(struct frame_reader *reader)
+{
+	return reader->index->len;
+}
+
+/* Make frame number n, counting from 0, the next one to be read. */
+int frame_reader_seek(struct frame_reader *reader, unsigned int n)
+{
+	if (n > reader->index->len)
+		return -EINVAL;
+	reader->next = n;
+	return 0;
+}
+
+/* Read the next frame. Its data belongs to the reader and is only valid
+ * until the next call. Returns 1 for a frame, 0 at the end of the
+ * archive. */
+int frame_reader_next(struct frame_reader *reader,
+	struct recorded_frame *frame)
+{
+	struct chunk_header chdr;
+	struct frame_header hdr;
+	off_t offset;
+	size_t size;
+
+	if (reader->next >= reader->index->len)
+		return 0;
+	offset = g_array_index(reader->index, uint64_t, reader->next);
+	if (fseeko(reader->file, offset, SEEK_SET) != 0
+			|| fread(&chdr, sizeof(chdr), 1, reader->file) != 1
+			|| fread(&hdr, sizeof(hdr), 1, reader->file) != 1)
+		return -EIO;
+	if (memcmp(chdr.tag, TAG_FRAME, 4) != 0)
+		return -EINVAL;
+
+	frame->timestamp_us = GINT64_FROM_LE(hdr.timestamp_us);
+	frame->offset_us = GINT64_FROM_LE(hdr.offset_us);
+	frame->width = GUINT32_FROM_LE(hdr.width);
+	frame->height = GUINT32_FROM_LE(hdr.height);
+	frame->result = GINT32_FROM_LE(hdr.result);
+	frame->devtype = GUINT32_FROM_LE(hdr.devtype);
+	frame->driver_id = GUINT16_FROM_LE(hdr.driver_id);
+	frame->source = hdr.source;
+	frame->finger = hdr.finger;
+	if (frame->width <= 0 || frame->width > FRAME_MAX_DIM
+			|| frame->height <= 0 || frame->height > FRAME_MAX_DIM
+			|| GUINT32_FROM_LE(chdr.length) != sizeof(hdr) + hdr.name_len
+				+ frame->width * frame->height)
+		return -EINVAL;
+
+	if (fread(reader->driver_name, hdr.name_len, 1, reader->file) != 1
+			&& hdr.name_len)
+		return -EIO;
+	reader->driver_name[hdr.name_len] = '\0';
+	frame->driver_name = reader->driver_name;
+
+	size = frame->width * frame->height;
+	if (size > reader->data_size) {
+		reader->data = g_realloc(reader->data, size);
+		reader->data_size = size;
+	}
+	if (fread(reader->data, size, 1, reader->file) != 1)
+		return -EIO;
+
+	frame->data = reader->data;
+	reader->next++;
+	return 1;
+}
+
+void frame_reader_close(struct frame_reader *reader)
+{
+	if (!reader)
+		return;
+
+	fclose(reader->file);
+	g_array_free(reader->index, TRUE);
+	g_free(reader->data);
+	g_slice_free(struct frame_reader, reader);
+}
+
+#ifdef HAVE_FPI_IMG_NEW
+
+/* libfprint has no public constructor for images, so configure only
+ * enables this when the installed library exports its internal one.
+ * Images are only ever created for a device, so the dimensions are then
+ * filled in through the head of the private struct fp_img, which has been
+ * the same in every libfprint release. */
+struct fp_img *fpi_img_new(size_t length);
+
+struct img_shim {
+	int width;
+	int height;
+};
+
+gboolean frame_replay_available(void)
+{
+	return TRUE;
+}
+
+/* a new image holding a copy of frame's data */
+struct fp_img *frame_to_img(const struct recorded_frame *frame)
+{
+	size_t size = frame->width * frame->height;
+	struct fp_img *img = fpi_img_new(size);
+	struct img_shim *shim = (struct img_shim *) img;
+
+	shim->width = frame->width;
+	shim->height = frame->height;
+	memcpy(fp_img_get_data(img), frame->data, size);
+	return img;
+}
+
+#else
+
+gboolean frame_replay_available(void)
+{
+	return FALSE;
+}
+
+struct fp_img *frame_to_img(const struct recorded_frame *frame)
+{
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Multi-user gallery for large scale identification. The store is a
+ * directory with one subdirectory per user, named after the user ID, each
+ * laid out like libfprint's own print store:
+ * 
+ *   <store>/<user id>/<driver id>/<devtype>/<finger>
+ * 
+ * so a user's prints can be added by copying their ~/.fprint/prints
+ * directory. For a large population the store can be converted into a
+ * print pack (see printpack.c) with gallery_write_pack(), which is then
+ * loaded without opening a file per print. Either way only the prints
+ * matching the device are read, and the whole gallery is kept loaded as
+ * one NULL-terminated array which is handed to fp_async_identify_start()
+ * as-is. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+struct gallery {
+	/* NULL-terminated, possibly early (see gallery_prints) */
+	struct fp_print_data **prints;
+	/* entries[i] describes prints[i] */
+	struct gallery_entry *entries;
+	unsigned int size;
+	unsigned int nr_users;
+	/* number of prints currently exposed, and the print displaced by the
+	 * early terminator */
+	unsigned int active;
+	struct fp_print_data *displaced;
+	GStringChunk *user_ids;
+};
+
+static gint compare_names(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* load the prints of one user which are compatible with dev */
+static int load_user(struct gallery *gallery, GPtrArray *prints,
+	GArray *entries, const char *userpath, const char *user_id,
+	struct fp_dev *dev)
+{
+	struct gallery_entry entry;
+	const char *name;
+	gchar driver[8];
+	gchar devtype[16];
+	gchar *devpath;
+	GDir *dir;
+	int nr_prints = 0;
+
+	g_snprintf(driver, sizeof(driver), "%04x",
+		fp_driver_get_driver_id(fp_dev_get_driver(dev)));
+	g_snprintf(devtype, sizeof(devtype), "%08x", fp_dev_get_devtype(dev));
+	devpath = g_build_filename(userpath, driver, devtype, NULL);
+
+	dir = g_dir_open(devpath, 0, NULL);
+	if (!dir) {
+		g_free(devpath);
+		return 0;
+	}
+
+	entry.user_id = g_string_chunk_insert_const(gallery->user_ids, user_id);
+	while ((name = g_dir_read_name(dir))) {
+		struct fp_print_data *data;
+		gchar *path;
+		gchar *contents;
+		gsize length;
+		char *end;
+		long finger = strtol(name, &end, 16);
+
+		if (*end || finger < LEFT_THUMB || finger > RIGHT_LITTLE)
+			continue;
+
+		path = g_build_filename(devpath, name, NULL);
+		if (!g_file_get_contents(path, &contents, &length, NULL)) {
+			g_free(path);
+			continue;
+		}
+
+		data = fp_print_data_from_data((unsigned char *) contents, length);
+		g_free(contents);
+		if (!data || !fp_dev_supports_print_data(dev, data)) {
+			g_message("ignoring unusable print %s", path);
+			fp_print_data_free(data);
+			g_free(path);
+			continue;
+		}
+		g_free(path);
+
+		entry.finger = finger;
+		g_ptr_array_add(prints, data);
+		g_array_append_val(entries, entry);
+		nr_prints++;
+	}
+
+	g_dir_close(dir);
+	g_free(devpath);
+	return nr_prints;
+}
+
+/* sorted list of the user directories in a store, NULL on error */
+static GPtrArray *list_users(const char *path)
+{
+	GPtrArray *user_ids;
+	const char *name;
+	GDir *dir;
+
+	dir = g_dir_open(path, 0, NULL);
+	if (!dir)
+		return NULL;
+
+	user_ids = g_ptr_array_new();
+	while ((name = g_dir_read_name(dir)))
+		g_ptr_array_add(user_ids, g_strdup(name));
+	g_dir_close(dir);
+	g_ptr_array_sort(user_ids, compare_names);
+	return user_ids;
+}
+
+static void free_users(GPtrArray *user_ids)
+{
+	unsigned int i;
+
+	for (i = 0; i < user_ids->len; i++)
+		g_free(g_ptr_array_index(user_ids, i));
+	g_ptr_array_free(user_ids, TRUE);
+}
+
+/* load the prints in a pack which are compatible with dev */
+static void load_pack(struct gallery *gallery, GPtrArray *prints,
+	GArray *entries, struct print_pack *pack, struct fp_dev *dev)
+{
+	uint16_t driver_id = fp_driver_get_driver_id(fp_dev_get_driver(dev));
+	uint32_t devtype = fp_dev_get_devtype(dev);
+	unsigned int nr_entries = print_pack_size(pack);
+	GHashTable *users = g_hash_table_new(NULL, NULL);
+	unsigned int i;
+
+	for (i = 0; i < nr_entries; i++) {
+		struct print_pack_info info;
+		struct gallery_entry entry;
+		struct fp_print_data *data;
+
+		/* only the index is looked at until a print matches */
+		if (print_pack_get(pack, i, &info) < 0
+				|| info.driver_id != driver_id || info.devtype != devtype)
+			continue;
+
+		if (print_pack_load(pack, i, &data) < 0
+				|| !fp_dev_supports_print_data(dev, data)) {
+			g_message("ignoring unusable print %u in pack", i);
+			fp_print_data_free(data);
+			continue;
+		}
+
+		entry.user_id = g_string_chunk_insert_const(gallery->user_ids,
+			info.user_id);
+		entry.finger = info.finger;
+		/* user IDs are interned, so count them by address */
+		g_hash_table_insert(users, (gpointer) entry.user_id, NULL);
+		g_ptr_array_add(prints, data);
+		g_array_append_val(entries, entry);
+	}
+
+	gallery->nr_users = g_hash_table_size(users);
+	g_hash_table_destroy(users);
+}
+
+/* Load every print in the store or print pack at path which can be used
+ * with dev. Store users are loaded in name order and pack entries in the
+ * order they were added, so that gallery_prints() limits are repeatable.
+ * Returns NULL if the store cannot be read. */
+struct gallery *gallery_load(const char *path, struct fp_dev *dev)
+{
+	struct gallery *gallery;
+	struct print_pack *pack = NULL;
+	GPtrArray *user_ids = NULL;
+	GPtrArray *prints;
+	GArray *entries;
+	unsigned int i;
+
+	if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+		pack = print_pack_open(path, FALSE);
+	else
+		user_ids = list_users(path);
+	if (!pack && !user_ids)
+		return NULL;
+
+	gallery = g_slice_new0(struct gallery);
+	gallery->user_ids = g_string_chunk_new(4096);
+	prints = g_ptr_array_new();
+	entries = g_array_new(FALSE, FALSE, sizeof(struct gallery_entry));
+
+	if (pack) {
+		load_pack(gallery, prints, entries, pack, dev);
+		print_pack_close(pack);
+	} else {
+		for (i = 0; i < user_ids->len; i++) {
+			const char *user_id = g_ptr_array_index(user_ids, i);
+			gchar *userpath = g_build_filename(path, user_id, NULL);
+
+			if (load_user(gallery, prints, entries, userpath, user_id,
+					dev) > 0)
+				gallery->nr_users++;
+			g_free(userpath);
+		}
+		free_users(user_ids);
+	}
+
+	gallery->size = prints->len;
+	gallery->active = prints->len;
+	g_ptr_array_add(prints, NULL);
+	gallery->prints = (struct fp_print_data **) g_ptr_array_free(prints,
+		FALSE);
+	gallery->entries = (struct gallery_entry *) g_array_free(entries, FALSE);
+	return gallery;
+}
+
+/* Pack all prints in the store at path into a new print pack at
+ * pack_path. Returns the number of prints packed. */
+int gallery_write_pack(const char *path, const char *pack_path)
+{
+	struct print_pack *pack;
+	GPtrArray *user_ids;
+	unsigned int i;
+	int nr_prints = 0;
+
+	user_ids = list_users(path);
+	if (!user_ids)
+		return -ENOENT;
+
+	pack = print_pack_open(pack_path, TRUE);
+	if (!pack) {
+		free_users(user_ids);
+		return -EIO;
+	}
+
+	for (i = 0; i < user_ids->len; i++) {
+		const char *user_id = g_ptr_array_index(user_ids, i);
+		gchar *userpath = g_build_filename(path, user_id, NULL);
+
+		nr_prints += print_pack_import_dir(pack, userpath, user_id);
+		g_free(userpath);
+	}
+
+	free_users(user_ids);
+	print_pack_close(pack);
+	return nr_prints;
+}
+
+void gallery_free(struct gallery *gallery)
+{
+	unsigned int i;
+
+	if (!gallery)
+		return;
+
+	gallery->prints[gallery->active] = gallery->displaced;
+	for (i = 0; i < gallery->size; i++)
+		fp_print_data_free(gallery->prints[i]);
+	g_free(gallery->prints);
+	g_free(gallery->entries);
+	g_string_chunk_free(gallery->user_ids);
+	g_slice_free(struct gallery, gallery);
+}
+
+unsigned int gallery_size(struct gallery *gallery)
+{
+	return gallery->size;
+}
+
+unsigned int gallery_nr_users(struct gallery *gallery)
+{
+	return gallery->nr_users;
+}
+
+/* Return the gallery for identification, terminated after the first limit
+ * prints (0 for all of them). The array stays owned by the gallery and is
+ * only valid until the next call. */
+struct fp_print_data **gallery_prints(struct gallery *gallery,
+	unsigned int limit)
+{
+	if (limit == 0 || limit > gallery->size)
+		limit = gallery->size;
+
+	if (limit != gallery->active) {
+		gallery->prints[gallery->active] = gallery->displaced;
+		gallery->displaced = gallery->prints[limit];
+		gallery->prints[limit] = NULL;
+		gallery->active = limit;
+	}
+
+	return gallery->prints;
+}
+
+/* map an identification match_offset back to the user and finger */
+const struct gallery_entry *gallery_lookup(struct gallery *gallery,
+	size_t match_offset)
+{
+	g_assert(match_offset < gallery->active);
+	return &gallery->entries[match_offset];
+}
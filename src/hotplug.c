@@ -0,0 +1,189 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* USB hotplug monitor. Listens to the kernel's uevent netlink socket, on
+ * the libfprint source so that no extra main loop source is needed, and
+ * tells the application when USB devices come or go. Events come in bursts
+ * (one per interface, plus the device itself), and udev has to set up the
+ * device node before it can be opened, so the notification is only sent
+ * once the bus has been quiet for a moment. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_NETLINK_H
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif
+
+#include <glib.h>
+
+#include "fpd_core.h"
+
+#ifdef HAVE_LINUX_NETLINK_H
+
+/* time for a burst of uevents to end and udev to catch up */
+#define HOTPLUG_SETTLE_MS 500
+
+static int uevent_fd = -1;
+static guint settle_id = 0;
+static hotplug_cb notify_cb;
+static void *notify_data;
+
+static gboolean hotplug_settled(gpointer data)
+{
+	settle_id = 0;
+	notify_cb(notify_data);
+	return FALSE;
+}
+
+/* (re)start the settle timer, in the default main context */
+static gboolean hotplug_changed(gpointer data)
+{
+	if (uevent_fd < 0)
+		return FALSE;
+
+	if (settle_id)
+		g_source_remove(settle_id);
+	settle_id = g_timeout_add(HOTPLUG_SETTLE_MS, hotplug_settled, NULL);
+	return FALSE;
+}
+
+/* Only whole USB devices being added or removed matter. The message is
+ * "action@devpath" followed by KEY=value pairs, all NUL-terminated. */
+static gboolean uevent_is_usb_device(const char *buf, size_t len)
+{
+	const char *end = buf + len;
+	gboolean usb = FALSE;
+	gboolean device = FALSE;
+	gboolean action = FALSE;
+
+	for (; buf < end; buf += strlen(buf) + 1) {
+		if (strcmp(buf, "SUBSYSTEM=usb") == 0)
+			usb = TRUE;
+		else if (strcmp(buf, "DEVTYPE=usb_device") == 0)
+			device = TRUE;
+		else if (strcmp(buf, "ACTION=add") == 0
+				|| strcmp(buf, "ACTION=remove") == 0)
+			action = TRUE;
+	}
+
+	return usb && device && action;
+}
+
+static void uevent_readable(int fd, GIOCondition revents, void *user_data)
+{
+	char buf[4096];
+	gboolean changed = FALSE;
+
+	while (1) {
+		struct sockaddr_nl addr;
+		struct iovec iov = { buf, sizeof(buf) - 1 };
+		struct msghdr msg = {
+			.msg_name = &addr,
+			.msg_namelen = sizeof(addr),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+		ssize_t len = recvmsg(fd, &msg, 0);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* ENOBUFS means events were dropped, assume we missed one */
+			if (errno == ENOBUFS)
+				changed = TRUE;
+			break;
+		}
+
+		/* anybody may send to the group, only trust the kernel */
+		if (addr.nl_pid != 0 || (msg.msg_flags & MSG_TRUNC))
+			continue;
+
+		buf[len] = '\0';
+		if (uevent_is_usb_device(buf, len))
+			changed = TRUE;
+	}
+
+	/* the watch may be running in the device I/O thread */
+	if (changed)
+		g_idle_add(hotplug_changed, NULL);
+}
+
+/* Start calling callback from the main loop whenever USB devices have been
+ * plugged or unplugged. setup_pollfds() must have been called first. */
+int hotplug_monitor_start(hotplug_cb callback, void *user_data)
+{
+	struct sockaddr_nl addr;
+	int r;
+
+	if (uevent_fd >= 0)
+		return -EBUSY;
+
+	uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT);
+	if (uevent_fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(uevent_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		r = -errno;
+		close(uevent_fd);
+		uevent_fd = -1;
+		return r;
+	}
+
+	notify_cb = callback;
+	notify_data = user_data;
+	r = fdsource_add_watch(uevent_fd, G_IO_IN, uevent_readable, NULL);
+	if (r < 0) {
+		close(uevent_fd);
+		uevent_fd = -1;
+	}
+	return r;
+}
+
+void hotplug_monitor_stop(void)
+{
+	if (uevent_fd < 0)
+		return;
+
+	if (settle_id)
+		g_source_remove(settle_id);
+	settle_id = 0;
+	fdsource_remove_watch(uevent_fd);
+	close(uevent_fd);
+	uevent_fd = -1;
+}
+
+#else
+
+int hotplug_monitor_start(hotplug_cb callback, void *user_data)
+{
+	return -ENOSYS;
+}
+
+void hotplug_monitor_stop(void)
+{
+}
+
+#endif /* HAVE_LINUX_NETLINK_H */
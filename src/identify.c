@@ -23,112 +23,190 @@
 
 #include "fprint_demo.h"
 
-static GtkWidget *iwin_verify_img;
-static GtkWidget *iwin_ify_status;
-static GtkWidget *iwin_ify_button;
-static GtkWidget *iwin_non_img_label;
+struct iwin {
+	struct fpd_session *session;
 
-static GtkWidget *iwin_fing_checkbox[RIGHT_LITTLE + 1];
+	GtkWidget *verify_img;
+	GtkWidget *ify_status;
+	GtkWidget *ify_button;
+	GtkWidget *non_img_label;
 
-static struct fp_img *img_normal = NULL;
+	GtkWidget *fing_checkbox[RIGHT_LITTLE + 1];
+	GtkWidget *gallery_checkbox;
 
-static struct fp_print_data **gallery = NULL;
-static int *fingnum = NULL;
+	GtkWidget *scan_dialog;
+	GtkWidget *please_wait;
 
-static void iwin_ify_status_not_capable(void)
+	struct fp_img *img_normal;
+
+	/* NULL-terminated gallery of the fingers selected for identification */
+	struct fp_print_data *gallery[RIGHT_LITTLE + 2];
+	int fingnum[RIGHT_LITTLE + 1];
+
+	/* identifying against the multi-user gallery of the device handle */
+	gboolean identifying_store;
+
+	/* TRUE while an identification borrows the resident templates, which
+	 * are then left alone and brought up to date once it has ended */
+	gboolean identifying;
+	gboolean resync_pending;
+
+	/* trace of the running identification */
+	struct scan_trace *trace;
+};
+
+static void iwin_ify_status_not_capable(struct iwin *iw)
 {
-	gtk_label_set_markup(GTK_LABEL(iwin_ify_status),
+	gtk_label_set_markup(GTK_LABEL(iw->ify_status),
 		"<b>Status:</b> Device does not support identification.");
-	gtk_widget_set_sensitive(iwin_ify_button, FALSE);
+	gtk_widget_set_sensitive(iw->ify_button, FALSE);
 }
 
-static void iwin_clear(void)
+/* The templates for the enrolled fingers of the open device are kept with
+ * its handle. They are loaded when the device is activated and kept in
+ * step with the print cache on refresh, so identification does not go
+ * back to the print store, and are still there when a device kept open by
+ * the pool is used again. */
+
+static void resident_drop(struct dev_handle *handle, int fnum)
 {
+	fp_print_data_free(handle->resident[fnum]);
+	handle->resident[fnum] = NULL;
+	handle->resident_serial[fnum] = 0;
+}
+
+/* bring the resident template for a finger in line with the print cache */
+static int resident_sync(struct iwin *iw, int fnum)
+{
+	struct dev_handle *handle = iw->session->handle;
+	struct fp_dev *dev = iw->session->dev;
+	struct fpd_print *cprint = print_cache_lookup(dev, fnum);
+	int r;
+
+	if (!cprint) {
+		resident_drop(handle, fnum);
+		return 0;
+	}
+
+	if (handle->resident[fnum]
+			&& handle->resident_serial[fnum] == cprint->serial)
+		return 0;
+
+	resident_drop(handle, fnum);
+	r = print_cache_load(dev, cprint, &handle->resident[fnum]);
+	if (r < 0) {
+		handle->resident[fnum] = NULL;
+		return r;
+	}
+
+	handle->resident_serial[fnum] = cprint->serial;
+	return 0;
+}
+
+static void iwin_clear(struct fpd_session *session)
+{
+	struct iwin *iw = session->iwin;
 	int i;
 
-	fp_img_free(img_normal);
-	img_normal = NULL;
+	fp_img_free(iw->img_normal);
+	iw->img_normal = NULL;
 
-	gtk_image_clear(GTK_IMAGE(iwin_verify_img));
+	gtk_image_clear(GTK_IMAGE(iw->verify_img));
 
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
-		gtk_widget_set_sensitive(iwin_fing_checkbox[i], FALSE);
-		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(iwin_fing_checkbox[i]),
+		gtk_widget_set_sensitive(iw->fing_checkbox[i], FALSE);
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(iw->fing_checkbox[i]),
 			FALSE);
 	}
 
-	gtk_label_set_text(GTK_LABEL(iwin_ify_status), NULL);
-	gtk_widget_set_sensitive(iwin_ify_button, FALSE);
+	gtk_widget_set_sensitive(iw->gallery_checkbox, FALSE);
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(iw->gallery_checkbox),
+		FALSE);
+	gtk_button_set_label(GTK_BUTTON(iw->gallery_checkbox),
+		"All users in gallery");
+
+	gtk_label_set_text(GTK_LABEL(iw->ify_status), NULL);
+	gtk_widget_set_sensitive(iw->ify_button, FALSE);
 }
 
-static void iwin_refresh(void)
+static void iwin_refresh(struct fpd_session *session)
 {
-	struct fp_dscv_print *print;
+	struct iwin *iw = session->iwin;
 	int i;
 
 	/* mark all fingers insensitive */
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++)
-		gtk_widget_set_sensitive(iwin_fing_checkbox[i], FALSE);
-
-	/* resensitize detected fingers */
-	i = 0;
-	while ((print = fp_dscv_prints[i++])) {
-		int fnum;
-
-		if (!fp_dev_supports_dscv_print(fpdev, print))
-			continue;
+		gtk_widget_set_sensitive(iw->fing_checkbox[i], FALSE);
 
-		fnum = fp_dscv_print_get_finger(print);
-		gtk_widget_set_sensitive(iwin_fing_checkbox[fnum], TRUE);
+	/* resensitize detected fingers, reloading only those which changed.
+	 * a template which fails to load is retried when identifying. */
+	iw->resync_pending = iw->identifying;
+	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
+		if (!iw->identifying)
+			resident_sync(iw, i);
+		if (print_cache_lookup(session->dev, i))
+			gtk_widget_set_sensitive(iw->fing_checkbox[i], TRUE);
 	}
 
 	/* untick any fingers that are not sensitive */
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
-		if (!GTK_WIDGET_SENSITIVE(iwin_fing_checkbox[i]))
+		if (!GTK_WIDGET_SENSITIVE(iw->fing_checkbox[i]))
 			gtk_toggle_button_set_active(
-				GTK_TOGGLE_BUTTON(iwin_fing_checkbox[i]), FALSE);
+				GTK_TOGGLE_BUTTON(iw->fing_checkbox[i]), FALSE);
 	}
 }
 
-static void iwin_activate_dev(void)
+static void iwin_activate_dev(struct fpd_session *session)
 {
-	struct fp_dscv_print *print;
-	int i = 0;
-	g_assert(fpdev);
-	g_assert(fp_dscv_prints);
+	struct iwin *iw = session->iwin;
+	struct fp_dev *dev = session->dev;
+	struct dev_handle *handle = session->handle;
+	int i;
+	g_assert(dev);
 
-	if (!fp_dev_supports_identification(fpdev)) {
-		iwin_ify_status_not_capable();
+	if (!fp_dev_supports_identification(dev)) {
+		iwin_ify_status_not_capable(iw);
 		return;
 	}
 
-	while ((print = fp_dscv_prints[i++])) {
-		int fnum;
-
-		if (!fp_dev_supports_dscv_print(fpdev, print))
+	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
+		if (!print_cache_lookup(dev, i))
 			continue;
 
-		fnum = fp_dscv_print_get_finger(print);
-		gtk_widget_set_sensitive(iwin_fing_checkbox[fnum], TRUE);
+		resident_sync(iw, i);
+		gtk_widget_set_sensitive(iw->fing_checkbox[i], TRUE);
 		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(
-			iwin_fing_checkbox[fnum]), TRUE);
+			iw->fing_checkbox[i]), TRUE);
 	}
 
-	if (fp_dev_supports_imaging(fpdev)) {
-		int width = fp_dev_get_img_width(fpdev);
-		int height = fp_dev_get_img_height(fpdev);
-		gtk_widget_set_size_request(iwin_verify_img,
+	/* the gallery is loaded once and kept for as long as the device is
+	 * open, as it may hold many thousands of prints */
+	if (gallery_path && !handle->store)
+		handle->store = gallery_load(gallery_path, dev);
+	if (handle->store && gallery_size(handle->store) > 0) {
+		gchar *label = g_strdup_printf("All users in gallery "
+			"(%u prints, %u users)", gallery_size(handle->store),
+			gallery_nr_users(handle->store));
+		gtk_button_set_label(GTK_BUTTON(iw->gallery_checkbox), label);
+		g_free(label);
+		gtk_widget_set_sensitive(iw->gallery_checkbox, TRUE);
+	}
+
+	if (fp_dev_supports_imaging(dev)) {
+		int width = fp_dev_get_img_width(dev);
+		int height = fp_dev_get_img_height(dev);
+		gtk_widget_set_size_request(iw->verify_img,
 			(width == 0) ? 192 : width,
 			(height == 0) ? 192 : height);
-		gtk_widget_hide(iwin_non_img_label);
-		gtk_widget_show(iwin_verify_img);
+		gtk_widget_hide(iw->non_img_label);
+		gtk_widget_show(iw->verify_img);
 	} else {
-		gtk_widget_show(iwin_non_img_label);
-		gtk_widget_hide(iwin_verify_img);
+		gtk_widget_show(iw->non_img_label);
+		gtk_widget_hide(iw->verify_img);
 	}
 }
 
-static void iwin_ify_result_other(int code)
+static void iwin_ify_result_other(struct iwin *iw, int code)
 {
 	const char *msgs[] = {
 		[FP_VERIFY_NO_MATCH] = "Could not identify finger.",
@@ -145,185 +223,210 @@ static void iwin_ify_result_other(int code)
 	else
 		msg = g_strdup_printf("<b>Status:</b> %s", msgs[code]);
 
-	gtk_label_set_markup(GTK_LABEL(iwin_ify_status), msg);
+	gtk_label_set_markup(GTK_LABEL(iw->ify_status), msg);
 	g_free(msg);
 }
 
-static void iwin_ify_result_match(int fnum)
+static void iwin_ify_result_match(struct iwin *iw, int fnum)
 {
 	gchar *tmp = g_ascii_strdown(fingerstr(fnum), -1);
 	gchar *msg = g_strdup_printf("<b>Status:</b> Matched %s", tmp);
 	g_free(tmp);
-	gtk_label_set_markup(GTK_LABEL(iwin_ify_status), msg);
+	gtk_label_set_markup(GTK_LABEL(iw->ify_status), msg);
+	g_free(msg);
+}
+
+static void iwin_ify_result_store_match(struct iwin *iw,
+	size_t match_offset)
+{
+	const struct gallery_entry *entry =
+		gallery_lookup(iw->session->handle->store, match_offset);
+	gchar *tmp = g_ascii_strdown(fingerstr(entry->finger), -1);
+	gchar *msg = g_markup_printf_escaped(
+		"<b>Status:</b> Matched user %s, %s", entry->user_id, tmp);
+	g_free(tmp);
+	gtk_label_set_markup(GTK_LABEL(iw->ify_status), msg);
 	g_free(msg);
 }
 
-static void iwin_img_draw(void)
+static void iwin_img_draw(struct iwin *iw)
 {
 	unsigned char *rgbdata;
 	GdkPixbuf *pixbuf;
 	int width;
 	int height;
 
-	if (!img_normal)
+	if (!iw->img_normal)
 		return;
 
-	rgbdata = img_to_rgbdata(img_normal);
+	rgbdata = img_to_rgbdata(iw->img_normal);
 
-	width = fp_img_get_width(img_normal);
-	height = fp_img_get_height(img_normal);
-	gtk_widget_set_size_request(iwin_verify_img, width, height);
+	width = fp_img_get_width(iw->img_normal);
+	height = fp_img_get_height(iw->img_normal);
+	gtk_widget_set_size_request(iw->verify_img, width, height);
 
 	pixbuf = gdk_pixbuf_new_from_data(rgbdata, GDK_COLORSPACE_RGB,
 			FALSE, 8, width, height, width * 3, pixbuf_destroy, NULL);
-	gtk_image_set_from_pixbuf(GTK_IMAGE(iwin_verify_img), pixbuf);
+	gtk_image_set_from_pixbuf(GTK_IMAGE(iw->verify_img), pixbuf);
 	g_object_unref(pixbuf);
 }
 
 static void iwin_cb_fing_checkbox_toggled(GtkToggleButton *button,
 	gpointer data)
 {
+	struct iwin *iw = data;
 	int i;
-	if (gtk_toggle_button_get_active(button)) {
-		gtk_widget_set_sensitive(iwin_ify_button, TRUE);
+	if (gtk_toggle_button_get_active(button)
+			|| gtk_toggle_button_get_active(
+				GTK_TOGGLE_BUTTON(iw->gallery_checkbox))) {
+		gtk_widget_set_sensitive(iw->ify_button, TRUE);
 		return;
 	}
 
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
 		if (gtk_toggle_button_get_active(
-				GTK_TOGGLE_BUTTON(iwin_fing_checkbox[i]))) {
-			gtk_widget_set_sensitive(iwin_ify_button, TRUE);
+				GTK_TOGGLE_BUTTON(iw->fing_checkbox[i]))) {
+			gtk_widget_set_sensitive(iw->ify_button, TRUE);
 			return;
 		}
 	}
 
-	gtk_widget_set_sensitive(iwin_ify_button, FALSE);
+	gtk_widget_set_sensitive(iw->ify_button, FALSE);
 }
 
-static struct fp_dscv_print *dscv_print_for_finger(int fnum)
+static void __identify_cleanup(struct iwin *iw)
 {
-	int i = 0;
-	struct fp_dscv_print *dprint;
-
-	while ((dprint = fp_dscv_prints[i++])) {
-		if (!fp_dev_supports_dscv_print(fpdev, dprint))
-			continue;
-		if (fp_dscv_print_get_finger(dprint) == fnum)
-			return dprint;
-	}
-	return NULL;
+	/* the gallery only borrows the resident templates */
+	gtk_widget_destroy(iw->please_wait);
+	iw->please_wait = NULL;
+	scan_trace_mark(iw->trace, SCAN_STOPPED);
+	scan_trace_release(iw->trace);
+	iw->trace = NULL;
+
+	/* catch up with prints enrolled or deleted meanwhile */
+	iw->identifying = FALSE;
+	if (iw->resync_pending && !iw->session->closing)
+		iwin_refresh(iw->session);
+	iw->resync_pending = FALSE;
+	session_op_end(iw->session);
 }
 
-static void __identify_cleanup(GtkWidget *dialog)
+static void identify_stopped_cb(struct fp_dev *dev, void *user_data)
 {
-	struct fp_print_data *print;
-	int i = 0;
-
-	gtk_widget_destroy(dialog);
+	__identify_cleanup(user_data);
+}
 
-	while ((print = gallery[i++]))
-		fp_print_data_free(print);
-	g_free(gallery);
-	g_free(fingnum);
+static void iwin_identify_stop(struct iwin *iw)
+{
+	int r;
 
-	fingnum = NULL;
-	gallery = NULL;
+	iw->please_wait = run_please_wait_dialog(iw->session->window,
+		"Ending identification...");
+	r = io_identify_stop(iw->session->dev, identify_stopped_cb, iw);
+	if (r < 0)
+		__identify_cleanup(iw);
 }
 
-static void identify_stopped_cb(struct fp_dev *dev, void *user_data)
+static int iwin_matched_finger(struct iwin *iw, int result,
+	size_t match_offset)
 {
-	__identify_cleanup(GTK_WIDGET(user_data));
+	if (result != FP_VERIFY_MATCH)
+		return -1;
+	if (iw->identifying_store)
+		return gallery_lookup(iw->session->handle->store,
+			match_offset)->finger;
+	return iw->fingnum[match_offset];
 }
 
 static void identify_cb(struct fp_dev *dev, int result, size_t match_offset,
 	struct fp_img *img, void *user_data)
 {
-	GtkWidget *dialog;
-	int r;
-
-	destroy_scan_finger_dialog(GTK_WIDGET(user_data));
-
-	if (result == FP_VERIFY_MATCH)
-		iwin_ify_result_match(fingnum[match_offset]);
+	struct iwin *iw = user_data;
+
+	scan_trace_callback(iw->trace, io_event_time(), result, img != NULL);
+	frame_record(dev, FRAME_IDENTIFY, iwin_matched_finger(iw, result,
+		match_offset), result, img);
+	destroy_scan_finger_dialog(iw->scan_dialog);
+	iw->scan_dialog = NULL;
+
+	if (result == FP_VERIFY_MATCH && iw->identifying_store)
+		iwin_ify_result_store_match(iw, match_offset);
+	else if (result == FP_VERIFY_MATCH)
+		iwin_ify_result_match(iw, iw->fingnum[match_offset]);
 	else
-		iwin_ify_result_other(result);
+		iwin_ify_result_other(iw, result);
+	scan_trace_mark(iw->trace, SCAN_RESULT);
 
-	fp_img_free(img_normal);
-	img_normal = NULL;
+	fp_img_free(iw->img_normal);
+	iw->img_normal = NULL;
 
 	if (img) {
-		img_normal = img;
-		iwin_img_draw();
+		iw->img_normal = img;
+		iwin_img_draw(iw);
+		scan_trace_mark(iw->trace, SCAN_DRAWN);
 	}
 
-	dialog = run_please_wait_dialog("Ending identification...");
-	r = fp_async_identify_stop(dev, identify_stopped_cb, dialog);
-	if (r < 0)
-		__identify_cleanup(dialog);
+	iwin_identify_stop(iw);
 }
 
 static void scan_finger_response(GtkWidget *dialog, gint arg,
 	gpointer user_data)
 {
-	int r;
+	struct iwin *iw = user_data;
 
 	destroy_scan_finger_dialog(dialog);
-	dialog = run_please_wait_dialog("Ending identification...");
-	r = fp_async_identify_stop(fpdev, identify_stopped_cb, dialog);
-	if (r < 0)
-		__identify_cleanup(dialog);
+	iw->scan_dialog = NULL;
+	iwin_identify_stop(iw);
 }
 
 static void iwin_cb_identify(GtkWidget *widget, gpointer user_data)
 {
-	struct fp_print_data *print;
+	struct iwin *iw = user_data;
+	struct dev_handle *handle = iw->session->handle;
+	struct fp_print_data **prints = iw->gallery;
 	GtkWidget *dialog;
 	int i;
 	int r;
 	size_t offset = 0;
-	int selected_fingers = 0;
 
-	/* count number of selected fingers */
-	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++)
-		if (gtk_toggle_button_get_active(
-				GTK_TOGGLE_BUTTON(iwin_fing_checkbox[i])))
-			selected_fingers++;
-	g_assert(selected_fingers);
-
-	/* allocate list for print gallery */
-	gallery = g_malloc0(sizeof(*gallery) * (selected_fingers + 1));
-	gallery[selected_fingers] = NULL; /* NULL-terminate */
-	fingnum = g_malloc(sizeof(*fingnum) * selected_fingers);
+	iw->identifying_store = handle->store && gtk_toggle_button_get_active(
+		GTK_TOGGLE_BUTTON(iw->gallery_checkbox));
+	if (iw->identifying_store) {
+		prints = gallery_prints(handle->store, 0);
+		goto identify;
+	}
 
 	/* populate print gallery from selected fingers */
 	for (i = LEFT_THUMB; i <= RIGHT_LITTLE; i++) {
-		struct fp_dscv_print *dprint;
-
 		if (!gtk_toggle_button_get_active(
-				GTK_TOGGLE_BUTTON(iwin_fing_checkbox[i])))
+				GTK_TOGGLE_BUTTON(iw->fing_checkbox[i])))
 			continue;
 	
-		dprint = dscv_print_for_finger(i);
-		g_assert(dprint);
-
-		r = fp_print_data_from_dscv_print(dprint, &print);
-		if (r < 0) {
-			dprint = NULL;
+		r = resident_sync(iw, i);
+		if (r < 0)
 			goto err;
-		}
+		g_assert(handle->resident[i]);
 
-		gallery[offset] = print;
-		fingnum[offset] = fp_dscv_print_get_finger(dprint);
+		iw->gallery[offset] = handle->resident[i];
+		iw->fingnum[offset] = i;
 		offset++;
 	}
+	g_assert(offset);
+	iw->gallery[offset] = NULL; /* NULL-terminate */
 
+identify:
 	/* do identification */
 
-	dialog = create_scan_finger_dialog();
-	r = fp_async_identify_start(fpdev, gallery, identify_cb, dialog);
+	dialog = create_scan_finger_dialog(iw->session->window);
+	iw->trace = scan_trace_begin("identify", iw->session->dev);
+	r = io_identify_start(iw->session->dev, prints, identify_cb, iw);
+	scan_trace_mark(iw->trace, SCAN_STARTED);
 	if (r < 0) {
+		scan_trace_release(iw->trace);
+		iw->trace = NULL;
 		destroy_scan_finger_dialog(dialog);
-		dialog = gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
+		dialog = gtk_message_dialog_new_with_markup(
+			GTK_WINDOW(iw->session->window),
 			GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
 			GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
 			"Could not start identification, error %d", r);
@@ -332,14 +435,17 @@ static void iwin_cb_identify(GtkWidget *widget, gpointer user_data)
 		return;
 	}
 
+	session_op_begin(iw->session);
+	iw->identifying = TRUE;
+	iw->scan_dialog = dialog;
 	g_signal_connect(dialog, "response", G_CALLBACK(scan_finger_response),
-		NULL);
+		iw);
 	run_scan_finger_dialog(dialog);
 	return;
 
 err:
-	/* FIXME this leaks the gallery and any already-scanned prints */
-	dialog = gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
+	dialog = gtk_message_dialog_new_with_markup(
+				GTK_WINDOW(iw->session->window),
 				GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
 				GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
 				"Could not load print for %s, error %d",
@@ -348,13 +454,18 @@ err:
 	gtk_widget_destroy(dialog);
 }
 
-static GtkWidget *iwin_create(void)
+static GtkWidget *iwin_create(struct fpd_session *session)
 {
+	struct iwin *iw;
 	GtkWidget *ui_vbox;
 	GtkWidget *label, *vfy_vbox, *ify_frame, *scan_frame, *img_vbox;
 	GtkWidget *iwin_main_hbox;
 	int i;
 
+	iw = g_slice_new0(struct iwin);
+	iw->session = session;
+	session->iwin = iw;
+
 	iwin_main_hbox = gtk_hbox_new(FALSE, 1);
 
 	/* Image frame */
@@ -366,13 +477,13 @@ static GtkWidget *iwin_create(void)
 	gtk_container_add(GTK_CONTAINER(scan_frame), img_vbox);
 
 	/* Image */
-	iwin_verify_img = gtk_image_new();
-	gtk_box_pack_start(GTK_BOX(img_vbox), iwin_verify_img, TRUE, FALSE, 0);
+	iw->verify_img = gtk_image_new();
+	gtk_box_pack_start(GTK_BOX(img_vbox), iw->verify_img, TRUE, FALSE, 0);
 
 	/* Non-imaging device */
-	iwin_non_img_label = gtk_label_new("This device does not have imaging "
+	iw->non_img_label = gtk_label_new("This device does not have imaging "
 		"capabilities, no images will be displayed.");
-	gtk_box_pack_start_defaults(GTK_BOX(img_vbox), iwin_non_img_label);
+	gtk_box_pack_start_defaults(GTK_BOX(img_vbox), iw->non_img_label);
 
 	/* vbox for verification status and image control frames */
 	ui_vbox = gtk_vbox_new(FALSE, 1);
@@ -393,28 +504,45 @@ static GtkWidget *iwin_create(void)
 		GtkWidget *checkbox = gtk_check_button_new_with_label(fingerstr(i));
 		gtk_box_pack_start(GTK_BOX(vfy_vbox), checkbox, FALSE, FALSE, 0);
 		g_signal_connect(GTK_OBJECT(checkbox), "toggled",
-			G_CALLBACK(iwin_cb_fing_checkbox_toggled), NULL);
-		iwin_fing_checkbox[i] = checkbox;
+			G_CALLBACK(iwin_cb_fing_checkbox_toggled), iw);
+		iw->fing_checkbox[i] = checkbox;
 	}
 
+	/* Multi-user gallery, only offered if one was given */
+	iw->gallery_checkbox = gtk_check_button_new_with_label(
+		"All users in gallery");
+	g_signal_connect(GTK_OBJECT(iw->gallery_checkbox), "toggled",
+		G_CALLBACK(iwin_cb_fing_checkbox_toggled), iw);
+	gtk_widget_set_sensitive(iw->gallery_checkbox, FALSE);
+	if (gallery_path)
+		gtk_box_pack_start(GTK_BOX(vfy_vbox), iw->gallery_checkbox, FALSE,
+			FALSE, 0);
+
 	/* Identify button */
-	iwin_ify_button = gtk_button_new_with_label("Identify");
-	g_signal_connect(G_OBJECT(iwin_ify_button), "clicked",
-		G_CALLBACK(iwin_cb_identify), NULL);
-	gtk_box_pack_start(GTK_BOX(vfy_vbox), iwin_ify_button, FALSE, FALSE, 0);
+	iw->ify_button = gtk_button_new_with_label("Identify");
+	g_signal_connect(G_OBJECT(iw->ify_button), "clicked",
+		G_CALLBACK(iwin_cb_identify), iw);
+	gtk_box_pack_start(GTK_BOX(vfy_vbox), iw->ify_button, FALSE, FALSE, 0);
 
 	/* Identify status */
-	iwin_ify_status = gtk_label_new(NULL);
-	gtk_box_pack_start(GTK_BOX(vfy_vbox), iwin_ify_status, FALSE, FALSE, 0);
+	iw->ify_status = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(vfy_vbox), iw->ify_status, FALSE, FALSE, 0);
 
 	return iwin_main_hbox;
 }
 
+static void iwin_destroy(struct fpd_session *session)
+{
+	g_slice_free(struct iwin, session->iwin);
+	session->iwin = NULL;
+}
+
 struct fpd_tab identify_tab = {
 	.name = "Identify",
 	.create = iwin_create,
 	.activate_dev = iwin_activate_dev,
 	.clear = iwin_clear,
 	.refresh = iwin_refresh,
+	.destroy = iwin_destroy,
 };
 
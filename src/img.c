@@ -18,17 +18,399 @@
  */
 
 #include <gtk/gtk.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <libfprint/fprint.h>
 
 #include "fprint_demo.h"
 
-static GtkWidget *iwin_create(void)
+/* number of captured frames buffered between the device and the display */
+#define CWIN_RING_SIZE 16
+
+struct cwin {
+	struct fpd_session *session;
+
+	GtkWidget *capture_img;
+	GtkWidget *non_img_label;
+	GtkWidget *start_button;
+	GtkWidget *stop_button;
+	GtkWidget *status;
+	GtkWidget *captured_lbl;
+	GtkWidget *displayed_lbl;
+	GtkWidget *dropped_lbl;
+
+	struct img_ring *ring;
+
+	/* TRUE while the device should be kept armed for capture */
+	gboolean capturing;
+	/* TRUE while a capture operation is active on the device */
+	gboolean capture_active;
+	/* TRUE between requesting a capture stop and its completion */
+	gboolean stop_pending;
+	/* error which ended capture, shown once the device has stopped */
+	int capture_error;
+
+	guint draw_source;
+	guint stats_source;
+	GTimer *capture_timer;
+	unsigned int nr_captured;
+	unsigned int nr_displayed;
+};
+
+static void cwin_status_update(struct cwin *cw, const char *status)
+{
+	gchar *msg = g_strdup_printf("<b>Status:</b> %s", status);
+	gtk_label_set_markup(GTK_LABEL(cw->status), msg);
+	g_free(msg);
+}
+
+static void cwin_stats_update(struct cwin *cw)
+{
+	double secs = g_timer_elapsed(cw->capture_timer, NULL);
+	gchar *tmp;
+
+	if (secs <= 0.0)
+		secs = 1.0;
+
+	tmp = g_strdup_printf("Captured: %u frames (%.1f fps)", cw->nr_captured,
+		cw->nr_captured / secs);
+	gtk_label_set_text(GTK_LABEL(cw->captured_lbl), tmp);
+	g_free(tmp);
+
+	tmp = g_strdup_printf("Displayed: %u frames (%.1f fps)", cw->nr_displayed,
+		cw->nr_displayed / secs);
+	gtk_label_set_text(GTK_LABEL(cw->displayed_lbl), tmp);
+	g_free(tmp);
+
+	tmp = g_strdup_printf("Dropped: %u frames",
+		cw->ring ? img_ring_dropped(cw->ring) : 0);
+	gtk_label_set_text(GTK_LABEL(cw->dropped_lbl), tmp);
+	g_free(tmp);
+}
+
+static gboolean cwin_stats_timeout(gpointer data)
+{
+	struct cwin *cw = data;
+	cwin_stats_update(cw);
+	return TRUE;
+}
+
+/* idle handler which renders the oldest buffered frame. Runs as often as
+ * the main loop allows, so when the display cannot keep up with the device
+ * the ring fills and starts dropping frames. */
+static gboolean cwin_draw_idle(gpointer data)
+{
+	struct cwin *cw = data;
+	struct fp_img *img = img_ring_pop(cw->ring);
+	GdkPixbuf *pixbuf;
+
+	if (!img) {
+		cw->draw_source = 0;
+		return FALSE;
+	}
+
+	pixbuf = img_to_pixbuf(img);
+	gtk_widget_set_size_request(cw->capture_img, fp_img_get_width(img),
+		fp_img_get_height(img));
+	gtk_image_set_from_pixbuf(GTK_IMAGE(cw->capture_img), pixbuf);
+	g_object_unref(pixbuf);
+	fp_img_free(img);
+	cw->nr_displayed++;
+
+	if (img_ring_count(cw->ring))
+		return TRUE;
+
+	cw->draw_source = 0;
+	return FALSE;
+}
+
+static void cwin_set_idle_state(struct cwin *cw)
+{
+	if (cw->stats_source) {
+		g_source_remove(cw->stats_source);
+		cw->stats_source = 0;
+	}
+	g_timer_stop(cw->capture_timer);
+	cwin_stats_update(cw);
+
+	gtk_widget_set_sensitive(cw->start_button, cw->session->dev != NULL);
+	gtk_widget_set_sensitive(cw->stop_button, FALSE);
+}
+
+static void capture_cb(struct fp_dev *dev, int result, struct fp_img *img,
+	void *user_data);
+
+static void capture_stopped_cb(struct fp_dev *dev, void *user_data)
+{
+	struct cwin *cw = user_data;
+	int r;
+
+	cw->capture_active = FALSE;
+	cw->stop_pending = FALSE;
+	if (!cw->capturing) {
+		if (cw->capture_error < 0) {
+			gchar *msg = g_strdup_printf("Capture failed, error %d",
+				cw->capture_error);
+			cwin_status_update(cw, msg);
+			g_free(msg);
+		} else {
+			cwin_status_update(cw, "Capture stopped.");
+		}
+		cwin_set_idle_state(cw);
+		session_op_end(cw->session);
+		return;
+	}
+
+	/* re-arm immediately for the next frame */
+	r = io_capture_start(dev, 0, capture_cb, cw);
+	if (r < 0) {
+		gchar *msg = g_strdup_printf("Could not restart capture, error %d", r);
+		cw->capturing = FALSE;
+		cwin_status_update(cw, msg);
+		g_free(msg);
+		cwin_set_idle_state(cw);
+		session_op_end(cw->session);
+		return;
+	}
+	cw->capture_active = TRUE;
+}
+
+static void capture_cb(struct fp_dev *dev, int result, struct fp_img *img,
+	void *user_data)
+{
+	struct cwin *cw = user_data;
+	int r;
+
+	if (result < 0) {
+		cw->capturing = FALSE;
+		cw->capture_error = result;
+	}
+
+	if (img) {
+		if (cw->capturing) {
+			cw->nr_captured++;
+			img_ring_push(cw->ring, img);
+			if (!cw->draw_source)
+				cw->draw_source = g_idle_add(cwin_draw_idle, cw);
+		} else {
+			fp_img_free(img);
+		}
+	}
+
+	cw->stop_pending = TRUE;
+	r = io_capture_stop(dev, capture_stopped_cb, cw);
+	if (r < 0)
+		capture_stopped_cb(dev, cw);
+}
+
+static void cwin_cb_start(GtkWidget *widget, gpointer user_data)
+{
+	struct cwin *cw = user_data;
+	GtkWidget *dialog;
+	int r;
+
+	if (cw->capture_active)
+		return;
+
+	img_ring_flush(cw->ring);
+	img_ring_reset_stats(cw->ring);
+	cw->nr_captured = 0;
+	cw->nr_displayed = 0;
+	cw->capture_error = 0;
+	g_timer_start(cw->capture_timer);
+
+	r = io_capture_start(cw->session->dev, 0, capture_cb, cw);
+	if (r < 0) {
+		dialog = gtk_message_dialog_new_with_markup(
+			GTK_WINDOW(cw->session->window),
+			GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+			GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
+			"Could not start capture, error %d", r);
+		gtk_dialog_run(GTK_DIALOG(dialog));
+		gtk_widget_destroy(dialog);
+		return;
+	}
+
+	session_op_begin(cw->session);
+	cw->capturing = TRUE;
+	cw->capture_active = TRUE;
+	cwin_status_update(cw, "Capturing, scan your finger repeatedly.");
+	cw->stats_source = g_timeout_add(1000, cwin_stats_timeout, cw);
+	gtk_widget_set_sensitive(cw->start_button, FALSE);
+	gtk_widget_set_sensitive(cw->stop_button, TRUE);
+}
+
+static void cwin_cb_stop(GtkWidget *widget, gpointer user_data)
+{
+	struct cwin *cw = user_data;
+	int r;
+
+	cw->capturing = FALSE;
+	gtk_widget_set_sensitive(cw->stop_button, FALSE);
+	if (!cw->capture_active)
+		return;
+
+	cwin_status_update(cw, "Stopping capture...");
+	if (cw->stop_pending)
+		return;
+
+	cw->stop_pending = TRUE;
+	r = io_capture_stop(cw->session->dev, capture_stopped_cb, cw);
+	if (r < 0)
+		capture_stopped_cb(cw->session->dev, cw);
+}
+
+static void cwin_stop(struct fpd_session *session)
+{
+	if (session->cwin->capturing)
+		cwin_cb_stop(NULL, session->cwin);
+}
+
+static void cwin_clear(struct fpd_session *session)
 {
-	return gtk_label_new("Not implemented yet.");
+	struct cwin *cw = session->cwin;
+
+	/* the device is about to go away, don't wait for the stop to finish */
+	if (cw->capturing)
+		cwin_cb_stop(NULL, cw);
+	cw->capture_active = FALSE;
+	cw->stop_pending = FALSE;
+
+	if (cw->draw_source) {
+		g_source_remove(cw->draw_source);
+		cw->draw_source = 0;
+	}
+	img_ring_flush(cw->ring);
+
+	gtk_image_clear(GTK_IMAGE(cw->capture_img));
+	gtk_label_set_text(GTK_LABEL(cw->status), NULL);
+	gtk_label_set_text(GTK_LABEL(cw->captured_lbl), NULL);
+	gtk_label_set_text(GTK_LABEL(cw->displayed_lbl), NULL);
+	gtk_label_set_text(GTK_LABEL(cw->dropped_lbl), NULL);
+	gtk_widget_set_sensitive(cw->start_button, FALSE);
+	gtk_widget_set_sensitive(cw->stop_button, FALSE);
+}
+
+static void cwin_activate_dev(struct fpd_session *session)
+{
+	struct cwin *cw = session->cwin;
+	struct fp_dev *dev = session->dev;
+	int width;
+	int height;
+	g_assert(dev);
+
+	if (!fp_dev_supports_imaging(dev)) {
+		gtk_widget_show(cw->non_img_label);
+		gtk_widget_hide(cw->capture_img);
+		cwin_status_update(cw, "Device does not support imaging.");
+		return;
+	}
+
+	width = fp_dev_get_img_width(dev);
+	height = fp_dev_get_img_height(dev);
+	gtk_widget_set_size_request(cw->capture_img,
+		(width == 0) ? 192 : width,
+		(height == 0) ? 192 : height);
+	gtk_widget_hide(cw->non_img_label);
+	gtk_widget_show(cw->capture_img);
+	gtk_widget_set_sensitive(cw->start_button, TRUE);
+	cwin_status_update(cw, "Ready to capture.");
+}
+
+static GtkWidget *cwin_create(struct fpd_session *session)
+{
+	struct cwin *cw;
+	GtkWidget *ui_vbox, *img_vbox, *scan_frame, *ctrl_frame, *ctrl_vbox;
+	GtkWidget *stats_frame, *stats_vbox;
+	GtkWidget *cwin_main_hbox;
+
+	cw = g_slice_new0(struct cwin);
+	cw->session = session;
+	session->cwin = cw;
+
+	cw->ring = img_ring_new(CWIN_RING_SIZE);
+	cw->capture_timer = g_timer_new();
+
+	cwin_main_hbox = gtk_hbox_new(FALSE, 1);
+
+	/* Image frame */
+	scan_frame = gtk_frame_new("Captured Image");
+	gtk_box_pack_start(GTK_BOX(cwin_main_hbox), scan_frame, TRUE, TRUE, 0);
+
+	/* Image vbox */
+	img_vbox = gtk_vbox_new(FALSE, 1);
+	gtk_container_add(GTK_CONTAINER(scan_frame), img_vbox);
+
+	/* Image */
+	cw->capture_img = gtk_image_new();
+	gtk_box_pack_start(GTK_BOX(img_vbox), cw->capture_img, TRUE, FALSE, 0);
+
+	/* Non-imaging device */
+	cw->non_img_label = gtk_label_new("This device does not have imaging "
+		"capabilities, images cannot be captured.");
+	gtk_box_pack_start_defaults(GTK_BOX(img_vbox), cw->non_img_label);
+
+	/* vbox for capture control and statistics frames */
+	ui_vbox = gtk_vbox_new(FALSE, 1);
+	gtk_box_pack_end(GTK_BOX(cwin_main_hbox), ui_vbox, FALSE, FALSE, 0);
+
+	/* Capture control */
+	ctrl_frame = gtk_frame_new("Continuous capture");
+	gtk_box_pack_start_defaults(GTK_BOX(ui_vbox), ctrl_frame);
+
+	ctrl_vbox = gtk_vbox_new(FALSE, 1);
+	gtk_container_add(GTK_CONTAINER(ctrl_frame), ctrl_vbox);
+
+	cw->start_button = gtk_button_new_with_label("Start capture");
+	g_signal_connect(G_OBJECT(cw->start_button), "clicked",
+		G_CALLBACK(cwin_cb_start), cw);
+	gtk_box_pack_start(GTK_BOX(ctrl_vbox), cw->start_button, FALSE, FALSE, 0);
+
+	cw->stop_button = gtk_button_new_with_label("Stop capture");
+	g_signal_connect(G_OBJECT(cw->stop_button), "clicked",
+		G_CALLBACK(cwin_cb_stop), cw);
+	gtk_box_pack_start(GTK_BOX(ctrl_vbox), cw->stop_button, FALSE, FALSE, 0);
+
+	cw->status = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(ctrl_vbox), cw->status, FALSE, FALSE, 0);
+
+	/* Statistics */
+	stats_frame = gtk_frame_new("Statistics");
+	gtk_box_pack_end_defaults(GTK_BOX(ui_vbox), stats_frame);
+
+	stats_vbox = gtk_vbox_new(FALSE, 1);
+	gtk_container_add(GTK_CONTAINER(stats_frame), stats_vbox);
+
+	cw->captured_lbl = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(stats_vbox), cw->captured_lbl, FALSE, FALSE, 0);
+
+	cw->displayed_lbl = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(stats_vbox), cw->displayed_lbl, FALSE, FALSE, 0);
+
+	cw->dropped_lbl = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(stats_vbox), cw->dropped_lbl, FALSE, FALSE, 0);
+
+	return cwin_main_hbox;
+}
+
+static void cwin_destroy(struct fpd_session *session)
+{
+	struct cwin *cw = session->cwin;
+
+	if (cw->stats_source)
+		g_source_remove(cw->stats_source);
+	if (cw->draw_source)
+		g_source_remove(cw->draw_source);
+	img_ring_free(cw->ring);
+	g_timer_destroy(cw->capture_timer);
+	g_slice_free(struct cwin, cw);
+	session->cwin = NULL;
 }
 
 struct fpd_tab img_tab = {
 	.name = "Image capture",
-	.create = iwin_create,
+	.create = cwin_create,
+	.activate_dev = cwin_activate_dev,
+	.clear = cwin_clear,
+	.stop = cwin_stop,
+	.destroy = cwin_destroy,
 };
-
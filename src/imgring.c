@@ -0,0 +1,114 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Bounded FIFO of captured images. The producer never blocks: when the
+ * ring is full the oldest image is freed to make room and counted as
+ * dropped. */
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+struct img_ring {
+	struct fp_img **imgs;
+	unsigned int size;
+	unsigned int head; /* index of oldest image */
+	unsigned int count;
+	unsigned int dropped;
+};
+
+struct img_ring *img_ring_new(unsigned int size)
+{
+	struct img_ring *ring = g_slice_new0(struct img_ring);
+	g_assert(size > 0);
+	ring->imgs = g_malloc0(sizeof(*ring->imgs) * size);
+	ring->size = size;
+	return ring;
+}
+
+/* free all queued images, leaving the drop counter intact */
+void img_ring_flush(struct img_ring *ring)
+{
+	while (ring->count) {
+		fp_img_free(ring->imgs[ring->head]);
+		ring->imgs[ring->head] = NULL;
+		ring->head = (ring->head + 1) % ring->size;
+		ring->count--;
+	}
+	ring->head = 0;
+}
+
+void img_ring_free(struct img_ring *ring)
+{
+	if (!ring)
+		return;
+	img_ring_flush(ring);
+	g_free(ring->imgs);
+	g_slice_free(struct img_ring, ring);
+}
+
+/* takes ownership of img */
+void img_ring_push(struct img_ring *ring, struct fp_img *img)
+{
+	unsigned int tail;
+
+	if (ring->count == ring->size) {
+		/* overwrite the oldest */
+		fp_img_free(ring->imgs[ring->head]);
+		ring->imgs[ring->head] = img;
+		ring->head = (ring->head + 1) % ring->size;
+		ring->dropped++;
+		return;
+	}
+
+	tail = (ring->head + ring->count) % ring->size;
+	ring->imgs[tail] = img;
+	ring->count++;
+}
+
+/* remove and return the oldest image, caller takes ownership */
+struct fp_img *img_ring_pop(struct img_ring *ring)
+{
+	struct fp_img *img;
+
+	if (ring->count == 0)
+		return NULL;
+
+	img = ring->imgs[ring->head];
+	ring->imgs[ring->head] = NULL;
+	ring->head = (ring->head + 1) % ring->size;
+	ring->count--;
+	return img;
+}
+
+unsigned int img_ring_count(struct img_ring *ring)
+{
+	return ring->count;
+}
+
+unsigned int img_ring_dropped(struct img_ring *ring)
+{
+	return ring->dropped;
+}
+
+void img_ring_reset_stats(struct img_ring *ring)
+{
+	ring->dropped = 0;
+}
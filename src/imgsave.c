@@ -0,0 +1,320 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Saving of 8-bit grayscale images as PNG or binary PGM. Saves are queued
+ * to a worker thread and written one at a time, in order, so that the GUI
+ * carries on while images are encoded and flushed. Each file is written
+ * under a temporary name and renamed into place once complete. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include <glib.h>
+
+#include "fpd_core.h"
+
+/* largest payload of a stored deflate block */
+#define STORED_BLOCK_MAX 65535
+
+struct img_save_job {
+	gchar *path;
+	enum img_save_format format;
+	unsigned char *data;
+	int width;
+	int height;
+	int result;
+	img_save_cb callback;
+	void *user_data;
+	volatile gint cancelled;
+};
+
+static GThreadPool *save_pool = NULL;
+static guint32 crc_table[256];
+
+static void crc_table_init(void)
+{
+	guint32 c;
+	int n, k;
+
+	for (n = 0; n < 256; n++) {
+		c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+static guint32 crc_update(guint32 crc, const unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void put_be32(unsigned char *buf, guint32 val)
+{
+	buf[0] = val >> 24;
+	buf[1] = val >> 16;
+	buf[2] = val >> 8;
+	buf[3] = val;
+}
+
+static int write_chunk(FILE *file, const char *type,
+	const unsigned char *data, size_t len)
+{
+	unsigned char buf[4];
+	guint32 crc;
+
+	put_be32(buf, len);
+	if (fwrite(buf, 4, 1, file) != 1 || fwrite(type, 4, 1, file) != 1)
+		return -EIO;
+	if (len && fwrite(data, len, 1, file) != 1)
+		return -EIO;
+
+	crc = crc_update(0xffffffff, (const unsigned char *) type, 4);
+	crc = crc_update(crc, data, len);
+	put_be32(buf, crc ^ 0xffffffff);
+	if (fwrite(buf, 4, 1, file) != 1)
+		return -EIO;
+	return 0;
+}
+
+#ifndef HAVE_ZLIB_H
+static guint32 adler32(const unsigned char *buf, size_t len)
+{
+	guint32 a = 1, b = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		a = (a + buf[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+/* a zlib stream made of stored, uncompressed, deflate blocks */
+static unsigned char *zlib_stored(const unsigned char *src, size_t len,
+	size_t *out_len)
+{
+	size_t nr_blocks = len / STORED_BLOCK_MAX + 1;
+	unsigned char *out = g_malloc(2 + nr_blocks * 5 + len + 4);
+	unsigned char *p = out;
+	size_t done = 0;
+
+	*p++ = 0x78;
+	*p++ = 0x01;
+	do {
+		size_t n = MIN(len - done, STORED_BLOCK_MAX);
+		*p++ = (done + n == len) ? 1 : 0;
+		*p++ = n & 0xff;
+		*p++ = n >> 8;
+		*p++ = ~n & 0xff;
+		*p++ = (~n >> 8) & 0xff;
+		memcpy(p, src + done, n);
+		p += n;
+		done += n;
+	} while (done < len);
+	put_be32(p, adler32(src, len));
+	p += 4;
+
+	*out_len = p - out;
+	return out;
+}
+#endif
+
+static int write_png(FILE *file, const unsigned char *data, int width,
+	int height)
+{
+	static const unsigned char signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+	};
+	unsigned char ihdr[13];
+	size_t raw_len = (size_t) (width + 1) * height;
+	unsigned char *raw = g_malloc(raw_len);
+	unsigned char *idat;
+	size_t idat_len;
+	int r;
+	int y;
+
+	/* every scanline starts with filter type 0, none */
+	for (y = 0; y < height; y++) {
+		raw[y * (width + 1)] = 0;
+		memcpy(raw + y * (width + 1) + 1, data + y * width, width);
+	}
+
+#ifdef HAVE_ZLIB_H
+	{
+		uLongf len = compressBound(raw_len);
+		idat = g_malloc(len);
+		if (compress2(idat, &len, raw, raw_len, Z_DEFAULT_COMPRESSION)
+				!= Z_OK) {
+			g_free(idat);
+			g_free(raw);
+			return -ENOMEM;
+		}
+		idat_len = len;
+	}
+#else
+	idat = zlib_stored(raw, raw_len, &idat_len);
+#endif
+	g_free(raw);
+
+	put_be32(ihdr, width);
+	put_be32(ihdr + 4, height);
+	ihdr[8] = 8;	/* bit depth */
+	ihdr[9] = 0;	/* grayscale */
+	ihdr[10] = 0;	/* deflate */
+	ihdr[11] = 0;	/* adaptive filtering */
+	ihdr[12] = 0;	/* not interlaced */
+
+	if (fwrite(signature, sizeof(signature), 1, file) != 1)
+		r = -EIO;
+	else
+		r = write_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+	if (r == 0)
+		r = write_chunk(file, "IDAT", idat, idat_len);
+	if (r == 0)
+		r = write_chunk(file, "IEND", NULL, 0);
+
+	g_free(idat);
+	return r;
+}
+
+static int write_pgm(FILE *file, const unsigned char *data, int width,
+	int height)
+{
+	if (fprintf(file, "P5\n%d %d\n255\n", width, height) < 0
+			|| fwrite(data, (size_t) width * height, 1, file) != 1)
+		return -EIO;
+	return 0;
+}
+
+static int save_file(struct img_save_job *job)
+{
+	gchar *tmp_path = g_strdup_printf("%s.tmp", job->path);
+	FILE *file;
+	int r;
+
+	file = fopen(tmp_path, "wb");
+	if (!file) {
+		r = -errno;
+		g_free(tmp_path);
+		return r;
+	}
+
+	if (job->format == IMG_SAVE_PGM)
+		r = write_pgm(file, job->data, job->width, job->height);
+	else
+		r = write_png(file, job->data, job->width, job->height);
+
+	if (fclose(file) != 0 && r == 0)
+		r = -EIO;
+	if (r == 0 && rename(tmp_path, job->path) != 0)
+		r = -errno;
+	if (r < 0)
+		remove(tmp_path);
+
+	g_free(tmp_path);
+	return r;
+}
+
+static void save_job_free(struct img_save_job *job)
+{
+	g_free(job->path);
+	g_free(job->data);
+	g_slice_free(struct img_save_job, job);
+}
+
+/* runs in the main loop */
+static gboolean save_complete(gpointer data)
+{
+	struct img_save_job *job = data;
+
+	if (!g_atomic_int_get(&job->cancelled) && job->callback)
+		job->callback(job->path, job->result, job->user_data);
+	save_job_free(job);
+	return FALSE;
+}
+
+/* runs on the worker thread */
+static void save_run(gpointer data, gpointer user_data)
+{
+	struct img_save_job *job = data;
+
+	job->result = save_file(job);
+	g_idle_add(save_complete, job);
+}
+
+/* PGM for names ending in .pgm, PNG otherwise */
+enum img_save_format img_save_format_for(const char *path)
+{
+	if (g_str_has_suffix(path, ".pgm") || g_str_has_suffix(path, ".PGM"))
+		return IMG_SAVE_PGM;
+	return IMG_SAVE_PNG;
+}
+
+/* Queue width x height bytes of 8-bit grayscale data, which are copied, to
+ * be saved to path. callback is run in the main loop with the result, 0 or
+ * a negative errno, once the file has been written. The returned job
+ * remains valid until then. */
+struct img_save_job *img_save_submit(const char *path,
+	enum img_save_format format, const unsigned char *data, int width,
+	int height, img_save_cb callback, void *user_data)
+{
+	struct img_save_job *job = g_slice_new0(struct img_save_job);
+
+	job->path = g_strdup(path);
+	job->format = format;
+	job->data = g_memdup(data, width * height);
+	job->width = width;
+	job->height = height;
+	job->callback = callback;
+	job->user_data = user_data;
+
+	if (!save_pool) {
+		crc_table_init();
+		save_pool = g_thread_pool_new(save_run, NULL, 1, FALSE, NULL);
+	}
+	g_thread_pool_push(save_pool, job, NULL);
+	return job;
+}
+
+/* The file is still written, but callback will not be called. Must be
+ * called from the main loop. */
+void img_save_cancel(struct img_save_job *job)
+{
+	g_atomic_int_set(&job->cancelled, 1);
+}
+
+/* Wait for all queued saves to be written. Their callbacks are not run. */
+void img_save_flush(void)
+{
+	if (!save_pool)
+		return;
+
+	g_thread_pool_free(save_pool, FALSE, TRUE);
+	save_pool = NULL;
+}
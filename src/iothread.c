@@ -0,0 +1,497 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Device I/O thread. libfprint's event handling runs in a main context of
+ * its own, so that USB transfers are serviced on time however long the GUI
+ * spends drawing, saving images or sitting in a modal dialog; swipe
+ * sensors in particular report short swipes when they are left waiting.
+ * 
+ * The io_* functions stand in for the fp_async_* functions of the same
+ * name. They take the libfprint lock around the call, and arrange for the
+ * caller's callback to be run in the default main context. libfprint calls
+ * back in the I/O thread, where the result is packed into an event and
+ * pushed onto a lock-free stack, and an idle in the default context pops
+ * the whole stack and delivers the events in order. The I/O thread only
+ * ever waits for the GUI while it is itself calling into libfprint.
+ * 
+ * Results may be queued before the GUI asks for the operation to stop, or
+ * for the device to be closed. As with libfprint itself, no result is
+ * delivered after either: ops are reference counted by their queued
+ * events, and the events of a stopped op, or of a closed device, are
+ * dropped on delivery. */
+
+#include <errno.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+/* a started operation, owning the caller's callback */
+struct io_op {
+	GCallback callback;
+	void *user_data;
+	/* stop ops: the start op to free once stopped */
+	struct io_op *started;
+	/* held by the owner and by each queued event */
+	volatile gint refcnt;
+	/* no more results are wanted, set under the libfprint lock */
+	gboolean cancelled;
+	/* the device has been closed, nothing at all is delivered */
+	gboolean dead;
+};
+
+struct io_event {
+	struct io_event *next;
+	void (*deliver)(struct io_event *event);
+	struct io_op *op;
+	struct fp_dev *dev;
+	int result;
+	size_t match_offset;
+	struct fp_img *img;
+	struct fp_print_data *print;
+	/* when libfprint made the callback, see loop_stats_now() */
+	gint64 raised_at;
+};
+
+static GMainContext *io_context = NULL;
+static GThread *io_thread = NULL;
+static volatile gint io_running = 0;
+
+/* Treiber stack of undelivered events, newest first */
+static volatile gpointer pending_events = NULL;
+
+/* raised_at of the event being delivered, 0 outside delivery */
+static gint64 delivering_raised_at = 0;
+
+/* the enroll, verify, identify or capture op running on each device, and
+ * the stop op in progress on it, protected by the libfprint lock */
+static GHashTable *running_ops = NULL;
+static GHashTable *stopping_ops = NULL;
+
+static struct io_op *op_new(GCallback callback, void *user_data)
+{
+	struct io_op *op = g_slice_new0(struct io_op);
+	op->callback = callback;
+	op->user_data = user_data;
+	op->refcnt = 1;
+	return op;
+}
+
+/* drop a reference, the owner's or an event's */
+static void op_free(struct io_op *op)
+{
+	if (op && g_atomic_int_dec_and_test(&op->refcnt))
+		g_slice_free(struct io_op, op);
+}
+
+/* stop delivering results for an op which is being replaced or stopped */
+static void op_cancel(struct io_op *op)
+{
+	if (op)
+		op->cancelled = TRUE;
+}
+
+/* take over the running op of dev, if any */
+static struct io_op *op_steal(struct fp_dev *dev)
+{
+	struct io_op *op = g_hash_table_lookup(running_ops, dev);
+	if (op)
+		g_hash_table_remove(running_ops, dev);
+	return op;
+}
+
+static gboolean deliver_events(gpointer data)
+{
+	struct io_event *event;
+	struct io_event *next;
+	struct io_event *events = NULL;
+
+	do
+		event = g_atomic_pointer_get(&pending_events);
+	while (!g_atomic_pointer_compare_and_exchange(&pending_events, event,
+		NULL));
+
+	/* restore the order the events were raised in */
+	for (; event; event = next) {
+		next = event->next;
+		event->next = events;
+		events = event;
+	}
+
+	for (event = events; event; event = next) {
+		next = event->next;
+		delivering_raised_at = event->raised_at;
+		event->deliver(event);
+		delivering_raised_at = 0;
+		op_free(event->op);
+		g_slice_free(struct io_event, event);
+	}
+
+	return FALSE;
+}
+
+/* called from the I/O thread */
+static void event_push(struct io_event *event)
+{
+	gpointer head;
+
+	event->raised_at = loop_stats_now();
+	do {
+		head = g_atomic_pointer_get(&pending_events);
+		event->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(&pending_events, head,
+		event));
+
+	/* the stack was empty, so nobody is going to deliver it yet */
+	if (!head)
+		g_idle_add_full(G_PRIORITY_DEFAULT, deliver_events, NULL, NULL);
+}
+
+static struct io_event *event_new(void (*deliver)(struct io_event *),
+	void *op, struct fp_dev *dev)
+{
+	struct io_event *event = g_slice_new0(struct io_event);
+	event->deliver = deliver;
+	event->op = op;
+	event->dev = dev;
+	g_atomic_int_inc(&event->op->refcnt);
+	return event;
+}
+
+/* a result which is no longer wanted, drop what it carries */
+static gboolean event_unwanted(struct io_event *event)
+{
+	if (!event->op->cancelled)
+		return FALSE;
+
+	fp_img_free(event->img);
+	fp_print_data_free(event->print);
+	return TRUE;
+}
+
+/* delivery, in the default main context */
+
+static void deliver_open(struct io_event *event)
+{
+	struct io_op *op = event->op;
+	((fp_dev_open_cb) op->callback)(event->dev, event->result, op->user_data);
+	op_free(op);
+}
+
+static void deliver_enroll(struct io_event *event)
+{
+	struct io_op *op = event->op;
+
+	if (event_unwanted(event))
+		return;
+	((fp_enroll_stage_cb) op->callback)(event->dev, event->result,
+		event->print, event->img, op->user_data);
+}
+
+/* verify and capture results look the same */
+static void deliver_img(struct io_event *event)
+{
+	struct io_op *op = event->op;
+
+	if (event_unwanted(event))
+		return;
+	((fp_verify_cb) op->callback)(event->dev, event->result, event->img,
+		op->user_data);
+}
+
+static void deliver_identify(struct io_event *event)
+{
+	struct io_op *op = event->op;
+
+	if (event_unwanted(event))
+		return;
+	((fp_identify_cb) op->callback)(event->dev, event->result,
+		event->match_offset, event->img, op->user_data);
+}
+
+/* all stop callbacks look the same */
+static void deliver_stopped(struct io_event *event)
+{
+	struct io_op *op = event->op;
+
+	fdsource_lock();
+	if (g_hash_table_lookup(stopping_ops, event->dev) == op)
+		g_hash_table_remove(stopping_ops, event->dev);
+	fdsource_unlock();
+
+	if (!op->dead)
+		((fp_verify_stop_cb) op->callback)(event->dev, op->user_data);
+	op_free(op->started);
+	op_free(op);
+}
+
+/* libfprint callbacks, in the I/O thread */
+
+static void open_cb(struct fp_dev *dev, int status, void *user_data)
+{
+	struct io_event *event = event_new(deliver_open, user_data, dev);
+	event->result = status;
+	event_push(event);
+}
+
+static void enroll_stage_cb(struct fp_dev *dev, int result,
+	struct fp_print_data *print, struct fp_img *img, void *user_data)
+{
+	struct io_event *event = event_new(deliver_enroll, user_data, dev);
+	event->result = result;
+	event->print = print;
+	event->img = img;
+	event_push(event);
+}
+
+static void img_cb(struct fp_dev *dev, int result, struct fp_img *img,
+	void *user_data)
+{
+	struct io_event *event = event_new(deliver_img, user_data, dev);
+	event->result = result;
+	event->img = img;
+	event_push(event);
+}
+
+static void identify_cb(struct fp_dev *dev, int result, size_t match_offset,
+	struct fp_img *img, void *user_data)
+{
+	struct io_event *event = event_new(deliver_identify, user_data, dev);
+	event->result = result;
+	event->match_offset = match_offset;
+	event->img = img;
+	event_push(event);
+}
+
+static void stopped_cb(struct fp_dev *dev, void *user_data)
+{
+	event_push(event_new(deliver_stopped, user_data, dev));
+}
+
+/* Wrappers for the GUI. Start functions remember the op as the one running
+ * on the device, and the matching stop function frees it once stopped. */
+
+int io_dev_open(struct fp_dscv_dev *ddev, fp_dev_open_cb callback,
+	void *user_data)
+{
+	struct io_op *op = op_new(G_CALLBACK(callback), user_data);
+	int r;
+
+	fdsource_lock();
+	r = fp_async_dev_open(ddev, open_cb, op);
+	fdsource_unlock();
+	if (r < 0)
+		op_free(op);
+	return r;
+}
+
+/* Close the device. Events of its ops may still be queued, so the ops are
+ * only marked dead here, and freed once those events have been dropped. */
+void io_dev_close(struct fp_dev *dev)
+{
+	struct io_op *op;
+
+	fdsource_lock();
+	op = op_steal(dev);
+	if (op) {
+		op->cancelled = TRUE;
+		op->dead = TRUE;
+		op_free(op);
+	}
+	op = g_hash_table_lookup(stopping_ops, dev);
+	if (op) {
+		g_hash_table_remove(stopping_ops, dev);
+		op->dead = TRUE;
+	}
+	fp_dev_close(dev);
+	fdsource_unlock();
+}
+
+static void op_started(struct fp_dev *dev, struct io_op *op, int r)
+{
+	struct io_op *old;
+
+	if (r < 0) {
+		op_free(op);
+		return;
+	}
+	old = op_steal(dev);
+	op_cancel(old);
+	op_free(old);
+	g_hash_table_insert(running_ops, dev, op);
+}
+
+int io_enroll_start(struct fp_dev *dev, fp_enroll_stage_cb callback,
+	void *user_data)
+{
+	struct io_op *op = op_new(G_CALLBACK(callback), user_data);
+	int r;
+
+	fdsource_lock();
+	r = fp_async_enroll_start(dev, enroll_stage_cb, op);
+	op_started(dev, op, r);
+	fdsource_unlock();
+	return r;
+}
+
+int io_verify_start(struct fp_dev *dev, struct fp_print_data *data,
+	fp_verify_cb callback, void *user_data)
+{
+	struct io_op *op = op_new(G_CALLBACK(callback), user_data);
+	int r;
+
+	fdsource_lock();
+	r = fp_async_verify_start(dev, data, img_cb, op);
+	op_started(dev, op, r);
+	fdsource_unlock();
+	return r;
+}
+
+int io_identify_start(struct fp_dev *dev, struct fp_print_data **gallery,
+	fp_identify_cb callback, void *user_data)
+{
+	struct io_op *op = op_new(G_CALLBACK(callback), user_data);
+	int r;
+
+	fdsource_lock();
+	r = fp_async_identify_start(dev, gallery, identify_cb, op);
+	op_started(dev, op, r);
+	fdsource_unlock();
+	return r;
+}
+
+int io_capture_start(struct fp_dev *dev, int unconditional,
+	fp_capture_cb callback, void *user_data)
+{
+	struct io_op *op = op_new(G_CALLBACK(callback), user_data);
+	int r;
+
+	fdsource_lock();
+	r = fp_async_capture_start(dev, unconditional, img_cb, op);
+	op_started(dev, op, r);
+	fdsource_unlock();
+	return r;
+}
+
+/* the stop functions only differ in what they call */
+static int op_stop(struct fp_dev *dev,
+	int (*stop)(struct fp_dev *, fp_verify_stop_cb, void *),
+	GCallback callback, void *user_data)
+{
+	struct io_op *op = op_new(callback, user_data);
+	int r;
+
+	fdsource_lock();
+	/* the caller takes the op as ended even if stopping fails */
+	op_cancel(g_hash_table_lookup(running_ops, dev));
+	r = stop(dev, stopped_cb, op);
+	if (r < 0) {
+		op_free(op);
+	} else {
+		op->started = op_steal(dev);
+		g_hash_table_insert(stopping_ops, dev, op);
+	}
+	fdsource_unlock();
+	return r;
+}
+
+int io_enroll_stop(struct fp_dev *dev, fp_enroll_stop_cb callback,
+	void *user_data)
+{
+	return op_stop(dev, fp_async_enroll_stop, G_CALLBACK(callback),
+		user_data);
+}
+
+int io_verify_stop(struct fp_dev *dev, fp_verify_stop_cb callback,
+	void *user_data)
+{
+	return op_stop(dev, fp_async_verify_stop, G_CALLBACK(callback),
+		user_data);
+}
+
+int io_identify_stop(struct fp_dev *dev, fp_identify_stop_cb callback,
+	void *user_data)
+{
+	return op_stop(dev, fp_async_identify_stop, G_CALLBACK(callback),
+		user_data);
+}
+
+int io_capture_stop(struct fp_dev *dev, fp_capture_stop_cb callback,
+	void *user_data)
+{
+	return op_stop(dev, fp_async_capture_stop, G_CALLBACK(callback),
+		user_data);
+}
+
+/* When libfprint made the callback currently being run, in the clock of
+ * loop_stats_now(). 0 when not called from a callback. */
+gint64 io_event_time(void)
+{
+	return delivering_raised_at;
+}
+
+static gpointer io_thread_run(gpointer data)
+{
+	while (g_atomic_int_get(&io_running))
+		g_main_context_iteration(io_context, TRUE);
+	return NULL;
+}
+
+/* Start handling libfprint events in the I/O thread. Takes the place of
+ * setup_pollfds(), and requires GLib threading to be initialised. */
+int io_thread_start(void)
+{
+	GError *error = NULL;
+	int r;
+
+	if (io_thread)
+		return -EBUSY;
+
+	running_ops = g_hash_table_new(NULL, NULL);
+	stopping_ops = g_hash_table_new(NULL, NULL);
+	io_context = g_main_context_new();
+	r = setup_pollfds_context(io_context);
+	if (r < 0)
+		return r;
+
+	g_atomic_int_set(&io_running, 1);
+	io_thread = g_thread_create(io_thread_run, NULL, TRUE, &error);
+	if (!io_thread) {
+		g_warning("couldn't start I/O thread: %s", error->message);
+		g_error_free(error);
+		g_atomic_int_set(&io_running, 0);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* Stop the I/O thread, at exit. Nothing handles libfprint's events
+ * afterwards, so only synchronous libfprint calls may follow. */
+void io_thread_stop(void)
+{
+	if (!io_thread)
+		return;
+
+	g_atomic_int_set(&io_running, 0);
+	g_main_context_wakeup(io_context);
+	g_thread_join(io_thread);
+	io_thread = NULL;
+}
@@ -0,0 +1,202 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Event loop instrumentation. When FPD_LOOP_STATS is set in the
+ * environment, the libfprint source times each of its prepare, check and
+ * dispatch calls, the delay from its fds or timer being found ready to
+ * libfprint being asked to handle them, and how late the timer fired, and
+ * counts dispatches which found nothing to do. The figures are kept in
+ * log-linear histograms, with eight buckets per power of two so quantiles
+ * are within about 6%, and printed to stderr at exit or on SIGUSR1.
+ * 
+ * Only the thread running the source records, so nothing is locked. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "fpd_core.h"
+
+#define SUB_BITS 3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NR_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+struct lat_hist {
+	guint64 buckets[NR_BUCKETS];
+	guint64 count;
+	gint64 max;
+};
+
+static const char *phase_names[NR_LOOP_PHASES] = {
+	[LOOP_PREPARE] = "prepare",
+	[LOOP_CHECK] = "check",
+	[LOOP_DISPATCH] = "dispatch",
+	[LOOP_READY] = "ready->handle",
+	[LOOP_TIMER_LATE] = "timer late",
+};
+
+gboolean loop_stats_enabled = FALSE;
+
+static struct lat_hist hists[NR_LOOP_PHASES];
+static guint64 nr_dispatches = 0;
+static guint64 nr_empty_dispatches = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+static unsigned int bucket_index(guint64 v)
+{
+	unsigned int msb = SUB_BITS;
+
+	if (v < SUB_BUCKETS)
+		return v;
+
+	while (msb < 63 && v >> (msb + 1))
+		msb++;
+	return (msb - SUB_BITS + 1) * SUB_BUCKETS
+		+ ((v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* midpoint of the values falling in a bucket */
+static double bucket_value(unsigned int i)
+{
+	unsigned int msb;
+	guint64 low;
+	guint64 width;
+
+	if (i < SUB_BUCKETS)
+		return i;
+
+	msb = i / SUB_BUCKETS + SUB_BITS - 1;
+	width = (guint64) 1 << (msb - SUB_BITS);
+	low = (guint64) (SUB_BUCKETS + i % SUB_BUCKETS) << (msb - SUB_BITS);
+	return low + (width - 1) / 2.0;
+}
+
+static double hist_quantile(struct lat_hist *hist, double q)
+{
+	guint64 rank = (guint64) (q * hist->count);
+	guint64 seen = 0;
+	unsigned int i;
+
+	if (rank >= hist->count)
+		rank = hist->count - 1;
+
+	for (i = 0; i < NR_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	/* the midpoint of the top bucket may lie above the real maximum */
+	return MIN(bucket_value(i), (double) hist->max);
+}
+
+static void request_dump(int sig)
+{
+	dump_requested = 1;
+}
+
+static void dump_at_exit(void)
+{
+	loop_stats_dump();
+}
+
+/* Turn instrumentation on if FPD_LOOP_STATS is set. Called when the
+ * source is set up. */
+void loop_stats_init(void)
+{
+	struct sigaction sa;
+
+	if (loop_stats_enabled || !g_getenv("FPD_LOOP_STATS"))
+		return;
+
+	loop_stats_enabled = TRUE;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = request_dump;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	atexit(dump_at_exit);
+}
+
+gint64 loop_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void loop_stats_record(enum loop_phase phase, gint64 ns)
+{
+	struct lat_hist *hist = &hists[phase];
+
+	if (ns < 0)
+		ns = 0;
+	hist->buckets[bucket_index(ns)]++;
+	hist->count++;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+void loop_stats_dispatch(gboolean empty)
+{
+	nr_dispatches++;
+	if (empty)
+		nr_empty_dispatches++;
+}
+
+/* called from the source's thread, to act on SIGUSR1 */
+void loop_stats_poll(void)
+{
+	if (!dump_requested)
+		return;
+
+	dump_requested = 0;
+	loop_stats_dump();
+}
+
+void loop_stats_dump(void)
+{
+	int i;
+
+	if (!loop_stats_enabled)
+		return;
+
+	fprintf(stderr, "event loop latency (us):\n");
+	fprintf(stderr, "%-14s %10s %10s %10s %10s\n", "phase", "count", "p50",
+		"p99", "max");
+	for (i = 0; i < NR_LOOP_PHASES; i++) {
+		struct lat_hist *hist = &hists[i];
+
+		if (!hist->count) {
+			fprintf(stderr, "%-14s %10d %10s %10s %10s\n", phase_names[i],
+				0, "-", "-", "-");
+			continue;
+		}
+		fprintf(stderr, "%-14s %10" G_GUINT64_FORMAT " %10.1f %10.1f %10.1f\n",
+			phase_names[i], hist->count, hist_quantile(hist, 0.5) / 1000,
+			hist_quantile(hist, 0.99) / 1000, hist->max / 1000.0);
+	}
+	fprintf(stderr, "dispatches: %" G_GUINT64_FORMAT ", with nothing to do: %"
+		G_GUINT64_FORMAT "\n", nr_dispatches, nr_empty_dispatches);
+}
@@ -17,43 +17,50 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <poll.h>
-#include <stdlib.h>
-#include <sys/time.h>
-
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <libfprint/fprint.h>
 
 #include "fprint_demo.h"
 
-#define for_each_tab_call_op(op) do { \
-		int __fe_tabno; \
-		for (__fe_tabno = 0; __fe_tabno < G_N_ELEMENTS(tabs); __fe_tabno++) { \
-			const struct fpd_tab *__fe_tab = tabs[__fe_tabno]; \
-			if (__fe_tab->op) \
-				__fe_tab->op(); \
-		} \
-	} while(0);
+enum devmodel_cols {
+	DC_COL_NAME,
+	DC_COL_DSCV_DEV,
+	DC_COL_DRIVER_ID,
+	DC_COL_DEVTYPE,
+	/* the open session, NULL if the device is not open */
+	DC_COL_SESSION,
+	/* the device's handle, kept open for a while after its session */
+	DC_COL_HANDLE,
+};
 
+static GtkWidget *mwin_window;
 static GtkWidget *mwin_devcombo;
 static GtkListStore *mwin_devmodel;
-static GtkWidget *mwin_drvname_label;
-static GtkWidget *mwin_imgcapa_label;
+static GtkWidget *mwin_open_button;
 static GtkWidget *mwin_devstatus_label;
-static GtkWidget *mwin_notebook;
-
-struct fp_dev *fpdev = NULL;
-struct fp_dscv_print **fp_dscv_prints = NULL;
-GtkWidget *mwin_window;
-
-static const struct fpd_tab *tabs[] = {
-	&enroll_tab,
-	&verify_tab,
-	&identify_tab,
-	&img_tab,
+/* asks which windows to close after an identical reader went */
+static GtkWidget *mwin_unplug_dialog = NULL;
+/* the discovery which the device list rows point into */
+static struct fp_dscv_dev **discovered_devs = NULL;
+
+/* multi-user gallery store for identification, from the command line */
+char *gallery_path = NULL;
+
+/* how many devices to keep open after their windows are closed */
+static int keep_open = DEV_POOL_DEFAULT_LIMIT;
+
+static GOptionEntry entries[] = {
+	{ "gallery", 'g', 0, G_OPTION_ARG_FILENAME, &gallery_path,
+		"Offer identification against the multi-user gallery in DIR", "DIR" },
+	{ "keep-open", 'k', 0, G_OPTION_ARG_INT, &keep_open,
+		"Keep up to N closed devices open for reuse (default 2)", "N" },
+	{ NULL }
 };
 
+/* TRUE once the enrolled print store has been indexed */
+static gboolean prints_loaded = FALSE;
+
 static void mwin_devstatus_update(char *status)
 {
 	gchar *msg = g_strdup_printf("<b>Status:</b> %s", status);
@@ -61,61 +68,81 @@ static void mwin_devstatus_update(char *status)
 	g_free(msg);
 }
 
-static void dev_open_cb(struct fp_dev *dev, int status, void *user_data)
+/* forget a session once its window has gone */
+static void mwin_cb_session_destroy(GtkWidget *widget, gpointer user_data)
 {
-	struct fp_driver *drv;
-	gchar *tmp;
-
-	gtk_widget_destroy(GTK_WIDGET(user_data));
-	fpdev = dev;
-
-	fp_dscv_prints = fp_discover_prints();
-	if (!fp_dscv_prints) {
-		mwin_devstatus_update("Error loading enrolled prints.");
-		/* FIXME error handling */
-		return;
-	}
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	GtkTreeIter iter;
+	gboolean valid;
 
-	mwin_devstatus_update("Device ready for use.");
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+			valid = gtk_tree_model_iter_next(model, &iter)) {
+		struct fpd_session *session;
 
-	drv = fp_dev_get_driver(fpdev);
-	tmp = g_strdup_printf("<b>Driver:</b> %s", fp_driver_get_name(drv));
-	gtk_label_set_markup(GTK_LABEL(mwin_drvname_label), tmp);
-	g_free(tmp);
+		struct fp_dscv_dev *ddev;
+		struct dev_handle *handle;
 
-	if (fp_dev_supports_imaging(fpdev))
-		gtk_label_set_markup(GTK_LABEL(mwin_imgcapa_label), "Imaging device");
-	else
-		gtk_label_set_markup(GTK_LABEL(mwin_imgcapa_label),
-			"Non-imaging device");
+		gtk_tree_model_get(model, &iter, DC_COL_SESSION, &session,
+			DC_COL_DSCV_DEV, &ddev, DC_COL_HANDLE, &handle, -1);
+		if (session != user_data)
+			continue;
 
-	for_each_tab_call_op(activate_dev);
+		/* kept open after its kind of reader lost one, and not
+		 * matched to a reader since */
+		if (!ddev) {
+			dev_handle_unref(handle);
+			gtk_list_store_remove(mwin_devmodel, &iter);
+		} else {
+			gtk_list_store_set(mwin_devmodel, &iter, DC_COL_SESSION, NULL, -1);
+		}
+		return;
+	}
 }
 
-static void mwin_cb_dev_changed(GtkWidget *widget, gpointer user_data)
+/* open the selected device in a session of its own, or bring its window
+ * to the front if it is open already */
+static void mwin_open_selected(void)
 {
 	GtkTreeIter iter;
-	GtkWidget *dialog;
 	struct fp_dscv_dev *ddev;
-	int r;
+	struct fpd_session *session;
+	struct dev_handle *handle;
+	gchar *name;
 
-	for_each_tab_call_op(clear);
-
-	if (!gtk_combo_box_get_active_iter(GTK_COMBO_BOX(mwin_devcombo), &iter)) {
-		mwin_devstatus_update("No devices found.");
+	if (!gtk_combo_box_get_active_iter(GTK_COMBO_BOX(mwin_devcombo), &iter))
 		return;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(mwin_devmodel), &iter,
+		DC_COL_NAME, &name, DC_COL_DSCV_DEV, &ddev,
+		DC_COL_SESSION, &session, DC_COL_HANDLE, &handle, -1);
+
+	if (session) {
+		session_present(session);
+	} else if (!prints_loaded) {
+		/* FIXME error handling */
+		mwin_devstatus_update("Error loading enrolled prints.");
+	} else {
+		session = session_open(handle, ddev, name);
+		g_signal_connect(G_OBJECT(session->window), "destroy",
+			G_CALLBACK(mwin_cb_session_destroy), session);
+		gtk_list_store_set(mwin_devmodel, &iter, DC_COL_SESSION, session, -1);
 	}
 
-	gtk_tree_model_get(GTK_TREE_MODEL(mwin_devmodel), &iter, 1, &ddev, -1);
+	g_free(name);
+}
 
-	fp_dscv_prints_free(fp_dscv_prints);
-	fp_dscv_prints = NULL;
-	fp_dev_close(fpdev);
+static void mwin_cb_dev_changed(GtkWidget *widget, gpointer user_data)
+{
+	gboolean selected = gtk_combo_box_get_active(
+		GTK_COMBO_BOX(mwin_devcombo)) >= 0;
 
-	dialog = run_please_wait_dialog("Opening device...");
-	r = fp_async_dev_open(ddev, dev_open_cb, dialog);
-	if (r)
-		mwin_devstatus_update("Could not open device.");
+	gtk_widget_set_sensitive(mwin_open_button, selected);
+	mwin_open_selected();
+}
+
+static void mwin_cb_open(GtkWidget *widget, gpointer user_data)
+{
+	mwin_open_selected();
 }
 
 static void mwin_cb_destroy(GtkWidget *widget, gpointer data)
@@ -136,7 +163,8 @@ static GtkWidget *mwin_create_devbar(void)
 	gtk_box_pack_start_defaults(GTK_BOX(devbar_hbox), dev_vbox);
 
 	/* Device model and combo box */
-	mwin_devmodel = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_POINTER);
+	mwin_devmodel = gtk_list_store_new(6, G_TYPE_STRING, G_TYPE_POINTER,
+		G_TYPE_UINT, G_TYPE_UINT, G_TYPE_POINTER, G_TYPE_POINTER);
 	mwin_devcombo =
 		gtk_combo_box_new_with_model(GTK_TREE_MODEL(mwin_devmodel));
 	g_signal_connect(G_OBJECT(mwin_devcombo), "changed",
@@ -145,7 +173,7 @@ static GtkWidget *mwin_create_devbar(void)
 	renderer = gtk_cell_renderer_text_new();
 	gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(mwin_devcombo), renderer, TRUE);
 	gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(mwin_devcombo), renderer,
-		"text", 0, NULL);
+		"text", DC_COL_NAME, NULL);
 
 	gtk_box_pack_start(GTK_BOX(dev_vbox), mwin_devcombo, FALSE, FALSE, 0);
 
@@ -153,13 +181,14 @@ static GtkWidget *mwin_create_devbar(void)
 	mwin_devstatus_label = gtk_label_new(NULL);
 	gtk_box_pack_start_defaults(GTK_BOX(dev_vbox), mwin_devstatus_label);
 
-	mwin_drvname_label = gtk_label_new(NULL);
-	gtk_box_pack_start_defaults(GTK_BOX(dev_vbox), mwin_drvname_label);
-
-	mwin_imgcapa_label = gtk_label_new(NULL);
-	gtk_box_pack_start_defaults(GTK_BOX(dev_vbox), mwin_imgcapa_label);
-
 	/* Buttons */
+	mwin_open_button = gtk_button_new_from_stock(GTK_STOCK_OPEN);
+	g_signal_connect(G_OBJECT(mwin_open_button), "clicked",
+		G_CALLBACK(mwin_cb_open), NULL);
+	gtk_widget_set_sensitive(mwin_open_button, FALSE);
+	gtk_box_pack_start(GTK_BOX(devbar_hbox), mwin_open_button, FALSE, FALSE,
+		0);
+
 	button = gtk_button_new_from_stock(GTK_STOCK_QUIT);
 	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(mwin_cb_destroy),
 		NULL);
@@ -171,7 +200,6 @@ static GtkWidget *mwin_create_devbar(void)
 static void mwin_create(void)
 {
 	GtkWidget *main_vbox;
-	int i;
 
 	/* Window */
 	mwin_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -184,234 +212,458 @@ static void mwin_create(void)
 	main_vbox = gtk_vbox_new(FALSE, 5);
 	gtk_container_add(GTK_CONTAINER(mwin_window), main_vbox);
 
-	/* Notebook */
-	mwin_notebook = gtk_notebook_new();
-	gtk_box_pack_start_defaults(GTK_BOX(main_vbox), mwin_notebook);
-
-	for (i = 0; i < G_N_ELEMENTS(tabs); i++) {
-		const struct fpd_tab *tab = tabs[i];
-		gtk_notebook_append_page(GTK_NOTEBOOK(mwin_notebook),
-			tab->create(), gtk_label_new(tab->name));
-	}
-	for_each_tab_call_op(clear);
-
-	/* Device bar */
-	gtk_box_pack_end(GTK_BOX(main_vbox), mwin_create_devbar(), FALSE, FALSE, 0);
+	/* Device bar, each device is used in a window of its own */
+	gtk_box_pack_start_defaults(GTK_BOX(main_vbox), mwin_create_devbar());
+	gtk_widget_set_sensitive(mwin_devcombo, FALSE);
+	mwin_devstatus_update("Discovering devices...");
 
 	gtk_widget_show_all(mwin_window);
 }
 
+static void mwin_devstatus_count(void)
+{
+	int nr_devs = gtk_tree_model_iter_n_children(
+		GTK_TREE_MODEL(mwin_devmodel), NULL);
+	gchar *msg;
 
-static gboolean mwin_populate_devs(void)
+	if (nr_devs == 0) {
+		mwin_devstatus_update("No devices found.");
+		return;
+	}
+
+	msg = g_strdup_printf("%d device%s found.", nr_devs,
+		(nr_devs == 1) ? "" : "s");
+	mwin_devstatus_update(msg);
+	g_free(msg);
+}
+
+/* number of discovered devices with the given driver and devtype */
+static int count_devs(struct fp_dscv_dev **devs, guint driver_id,
+	guint devtype)
 {
-	struct fp_dscv_dev **discovered_devs;
-	struct fp_dscv_dev *ddev;
+	int count = 0;
 	int i;
 
-	discovered_devs = fp_discover_devs();
-	if (!discovered_devs)
-		return FALSE;
-
-	for (i = 0; (ddev = discovered_devs[i]); i++) {
-		struct fp_driver *drv = fp_dscv_dev_get_driver(ddev);
-		GtkTreeIter iter;
+	for (i = 0; devs[i]; i++)
+		if (fp_driver_get_driver_id(fp_dscv_dev_get_driver(devs[i]))
+				== driver_id && fp_dscv_dev_get_devtype(devs[i]) == devtype)
+			count++;
+	return count;
+}
 
-		gtk_list_store_append(mwin_devmodel, &iter);
-		gtk_list_store_set(mwin_devmodel, &iter, 0,
-			fp_driver_get_full_name(drv), 1, ddev, -1);
+/* number of device list rows with the given driver and devtype */
+static int count_rows(guint driver_id, guint devtype)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	GtkTreeIter iter;
+	gboolean valid;
+	int count = 0;
+
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+			valid = gtk_tree_model_iter_next(model, &iter)) {
+		guint row_driver_id;
+		guint row_devtype;
+
+		gtk_tree_model_get(model, &iter, DC_COL_DRIVER_ID, &row_driver_id,
+			DC_COL_DEVTYPE, &row_devtype, -1);
+		if (row_driver_id == driver_id && row_devtype == devtype)
+			count++;
 	}
+	return count;
+}
 
-	return TRUE;
+static void mwin_append_dev(struct fp_dscv_dev *ddev)
+{
+	struct fp_driver *drv = fp_dscv_dev_get_driver(ddev);
+	GtkTreeIter iter;
+
+	gtk_list_store_append(mwin_devmodel, &iter);
+	gtk_list_store_set(mwin_devmodel, &iter,
+		DC_COL_NAME, fp_driver_get_full_name(drv),
+		DC_COL_DSCV_DEV, ddev,
+		DC_COL_DRIVER_ID, (guint) fp_driver_get_driver_id(drv),
+		DC_COL_DEVTYPE, (guint) fp_dscv_dev_get_devtype(ddev),
+		DC_COL_SESSION, NULL, DC_COL_HANDLE, dev_handle_new(), -1);
 }
 
-static gboolean mwin_select_first_dev(void)
+/* whether an open row of the kind has been left without a reader */
+static gboolean kind_unplugged(guint driver_id, guint devtype)
 {
-	gtk_combo_box_set_active(GTK_COMBO_BOX(mwin_devcombo), 0);
-	return TRUE;
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	GtkTreeIter iter;
+	gboolean valid;
+
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+			valid = gtk_tree_model_iter_next(model, &iter)) {
+		struct fp_dscv_dev *ddev;
+		guint row_driver_id;
+		guint row_devtype;
+
+		gtk_tree_model_get(model, &iter, DC_COL_DSCV_DEV, &ddev,
+			DC_COL_DRIVER_ID, &row_driver_id, DC_COL_DEVTYPE, &row_devtype,
+			-1);
+		if (!ddev && row_driver_id == driver_id && row_devtype == devtype)
+			return TRUE;
+	}
+	return FALSE;
 }
 
-struct fdsource {
-	GSource source;
-	GSList *pollfds;
-};
+static gboolean mwin_find_session(struct fpd_session *session,
+	GtkTreeIter *iter)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	gboolean valid;
+
+	for (valid = gtk_tree_model_get_iter_first(model, iter); valid;
+			valid = gtk_tree_model_iter_next(model, iter)) {
+		struct fpd_session *row_session;
 
-static gboolean source_prepare(GSource *source, gint *timeout)
+		gtk_tree_model_get(model, iter, DC_COL_SESSION, &row_session, -1);
+		if (row_session == session)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Remove the row of a session closed because its reader was unplugged.
+ * Any reader the row stood for is still there, so it is handed to an open
+ * row of the same kind left without one, or listed afresh. */
+static void mwin_remove_unplugged(GtkTreeIter *iter)
 {
-	int r;
-	struct timeval tv;
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	struct fp_dscv_dev *ddev;
+	struct dev_handle *handle;
+	guint driver_id;
+	guint devtype;
+	GtkTreeIter other;
+	gboolean valid;
+
+	gtk_tree_model_get(model, iter, DC_COL_DSCV_DEV, &ddev,
+		DC_COL_DRIVER_ID, &driver_id, DC_COL_DEVTYPE, &devtype,
+		DC_COL_HANDLE, &handle, -1);
+	dev_handle_unref(handle);
+	gtk_list_store_remove(mwin_devmodel, iter);
+	if (!ddev)
+		return;
 
-	r = fp_get_next_timeout(&tv);
-	if (r == 0) {
-		*timeout = -1;
-		return FALSE;
+	for (valid = gtk_tree_model_get_iter_first(model, &other); valid;
+			valid = gtk_tree_model_iter_next(model, &other)) {
+		struct fp_dscv_dev *other_ddev;
+		guint other_driver_id;
+		guint other_devtype;
+
+		gtk_tree_model_get(model, &other, DC_COL_DSCV_DEV, &other_ddev,
+			DC_COL_DRIVER_ID, &other_driver_id,
+			DC_COL_DEVTYPE, &other_devtype, -1);
+		if (!other_ddev && other_driver_id == driver_id
+				&& other_devtype == devtype) {
+			gtk_list_store_set(mwin_devmodel, &other, DC_COL_DSCV_DEV, ddev,
+				-1);
+			return;
+		}
 	}
+	mwin_append_dev(ddev);
+}
 
-	if (!timerisset(&tv))
-		return TRUE;
+static void mwin_cb_unplugged_response(GtkDialog *dialog, gint response,
+	gpointer user_data)
+{
+	GtkWidget *box = g_object_get_data(G_OBJECT(dialog), "sessions");
+	GList *rows = gtk_container_get_children(GTK_CONTAINER(box));
+	GList *l;
+
+	for (l = rows; response == GTK_RESPONSE_ACCEPT && l; l = l->next) {
+		GtkWidget *check = g_object_get_data(G_OBJECT(l->data), "check");
+		struct fpd_session *session = g_object_get_data(G_OBJECT(l->data),
+			"session");
+		GtkTreeIter iter;
 
-	*timeout = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
-	return FALSE;
+		if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check))
+				|| !mwin_find_session(session, &iter))
+			continue;
+		session_close(session);
+		mwin_remove_unplugged(&iter);
+	}
+
+	g_list_free(rows);
+	gtk_widget_destroy(GTK_WIDGET(dialog));
+	mwin_devstatus_count();
 }
 
-static gboolean source_check(GSource *source)
+/* Readers of a kind with windows open have gone, but libfprint cannot tell
+ * identical readers apart, so the user picks the windows to close. Each
+ * window leaves the list if it is closed later on. */
+static void mwin_ask_unplugged(void)
 {
-	struct fdsource *_fdsource = (struct fdsource *) source;
-	GSList *elem = _fdsource->pollfds;
-	struct timeval tv;
-	int r;
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	GtkWidget *dialog, *vbox, *box, *label;
+	GtkTreeIter iter;
+	gboolean valid;
+	int n = 0;
 
-	if (!elem)
-		return FALSE;
+	if (mwin_unplug_dialog)
+		gtk_widget_destroy(mwin_unplug_dialog);
 
-	do {
-		GPollFD *pollfd = elem->data;
-		if (pollfd->revents)
-			return TRUE;
-	} while ((elem = g_slist_next(elem)));
+	dialog = gtk_dialog_new_with_buttons("Reader unplugged",
+		GTK_WINDOW(mwin_window),
+		GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_NO_SEPARATOR,
+		"Keep all open", GTK_RESPONSE_REJECT,
+		"Close selected", GTK_RESPONSE_ACCEPT, NULL);
+	vbox = GTK_DIALOG(dialog)->vbox;
 
-	r = fp_get_next_timeout(&tv);
-	if (r == 1 && !timerisset(&tv))
-		return TRUE;
+	label = gtk_label_new("A reader was unplugged, but it cannot be told "
+		"apart from others of the same kind. Select the windows of the "
+		"readers which are gone. Operations fail in windows whose reader "
+		"is gone until they are closed.");
+	gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), label);
 
-	return FALSE;
+	box = gtk_vbox_new(FALSE, 2);
+	gtk_box_pack_start_defaults(GTK_BOX(vbox), box);
+	g_object_set_data(G_OBJECT(dialog), "sessions", box);
+
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+			valid = gtk_tree_model_iter_next(model, &iter)) {
+		struct fpd_session *session;
+		GtkWidget *hbox, *check, *button;
+		guint driver_id;
+		guint devtype;
+		gchar *name;
+		gchar *text;
+
+		gtk_tree_model_get(model, &iter, DC_COL_NAME, &name,
+			DC_COL_DRIVER_ID, &driver_id, DC_COL_DEVTYPE, &devtype,
+			DC_COL_SESSION, &session, -1);
+		if (!session || !kind_unplugged(driver_id, devtype)) {
+			g_free(name);
+			continue;
+		}
+
+		hbox = gtk_hbox_new(FALSE, 5);
+		text = g_strdup_printf("%s (window %d)", name, ++n);
+		check = gtk_check_button_new_with_label(text);
+		g_free(text);
+		g_free(name);
+		gtk_box_pack_start_defaults(GTK_BOX(hbox), check);
+
+		button = gtk_button_new_with_label("Show");
+		g_signal_connect_swapped(G_OBJECT(button), "clicked",
+			G_CALLBACK(session_present), session);
+		gtk_box_pack_start(GTK_BOX(hbox), button, FALSE, FALSE, 0);
+
+		g_object_set_data(G_OBJECT(hbox), "check", check);
+		g_object_set_data(G_OBJECT(hbox), "session", session);
+		g_signal_connect_object(G_OBJECT(session->window), "destroy",
+			G_CALLBACK(gtk_widget_destroy), hbox, G_CONNECT_SWAPPED);
+		gtk_box_pack_start_defaults(GTK_BOX(box), hbox);
+	}
+
+	g_signal_connect(G_OBJECT(dialog), "response",
+		G_CALLBACK(mwin_cb_unplugged_response), NULL);
+	g_signal_connect(G_OBJECT(dialog), "destroy",
+		G_CALLBACK(gtk_widget_destroyed), &mwin_unplug_dialog);
+	mwin_unplug_dialog = dialog;
+	gtk_widget_show_all(dialog);
 }
 
-static gboolean source_dispatch(GSource *source, GSourceFunc callback,
-	gpointer data)
+/* Bring the device list up to date with a new discovery, only adding and
+ * removing the rows which changed so that open devices are left alone.
+ * libfprint does not tell where a device is plugged in, so rows are
+ * matched on driver and devtype. When there are fewer readers of a kind
+ * than before, there is no telling which of them went. The closed rows of
+ * that kind are removed and the open ones are matched to the readers still
+ * there; if that leaves open rows without a reader, the user is asked
+ * which windows to close. */
+static gboolean mwin_update_devs(void)
 {
-	struct timeval zerotimeout = {
-		.tv_sec = 0,
-		.tv_usec = 0,
-	};
+	struct fp_dscv_dev **devs;
+	struct fp_dscv_dev *ddev;
+	gboolean *kept;
+	gboolean *lost;
+	gboolean unplugged = FALSE;
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	GtkTreeIter iter;
+	gboolean valid;
+	int nr_devs;
+	int nr_rows;
+	int row;
+	int i;
 
-	/* FIXME error handling */
-	fp_handle_events_timeout(&zerotimeout);
+	fdsource_lock();
+	devs = fp_discover_devs();
+	fdsource_unlock();
+	if (!devs)
+		return FALSE;
 
-	/* FIXME whats the return value used for? */
+	for (nr_devs = 0; devs[nr_devs]; nr_devs++)
+		;
+	kept = g_new0(gboolean, nr_devs);
+
+	/* find the rows whose kind of reader has lost one, before any go */
+	nr_rows = gtk_tree_model_iter_n_children(model, NULL);
+	lost = g_new0(gboolean, nr_rows);
+	for (valid = gtk_tree_model_get_iter_first(model, &iter), row = 0; valid;
+			valid = gtk_tree_model_iter_next(model, &iter), row++) {
+		guint driver_id;
+		guint devtype;
+
+		gtk_tree_model_get(model, &iter, DC_COL_DRIVER_ID, &driver_id,
+			DC_COL_DEVTYPE, &devtype, -1);
+		lost[row] = count_devs(devs, driver_id, devtype)
+			< count_rows(driver_id, devtype);
+	}
+
+	valid = gtk_tree_model_get_iter_first(model, &iter);
+	row = 0;
+	while (valid) {
+		struct fpd_session *session;
+		struct dev_handle *handle;
+		gboolean row_lost = lost[row++];
+		guint driver_id;
+		guint devtype;
+
+		gtk_tree_model_get(model, &iter, DC_COL_DRIVER_ID, &driver_id,
+			DC_COL_DEVTYPE, &devtype, DC_COL_SESSION, &session,
+			DC_COL_HANDLE, &handle, -1);
+		ddev = NULL;
+		if (!row_lost || session)
+			for (i = 0; (ddev = devs[i]); i++)
+				if (!kept[i] && fp_driver_get_driver_id(
+						fp_dscv_dev_get_driver(ddev)) == driver_id
+						&& fp_dscv_dev_get_devtype(ddev) == devtype)
+					break;
+
+		if (ddev)
+			kept[i] = TRUE;
+		if (ddev || session) {
+			/* an open row left without a reader stays until the
+			 * user says whether it is the one which went */
+			gtk_list_store_set(mwin_devmodel, &iter, DC_COL_DSCV_DEV, ddev,
+				-1);
+			if (!ddev)
+				unplugged = TRUE;
+			valid = gtk_tree_model_iter_next(model, &iter);
+		} else {
+			dev_handle_unref(handle);
+			valid = gtk_list_store_remove(mwin_devmodel, &iter);
+		}
+	}
+
+	for (i = 0; (ddev = devs[i]); i++)
+		if (!kept[i])
+			mwin_append_dev(ddev);
+
+	g_free(lost);
+	g_free(kept);
+	if (discovered_devs)
+		fp_dscv_devs_free(discovered_devs);
+	discovered_devs = devs;
+	mwin_devstatus_count();
+	if (unplugged)
+		mwin_ask_unplugged();
 	return TRUE;
 }
 
-static void source_finalize(GSource *source)
+/* drop the handles of the device list on exit */
+static void mwin_forget_devs(void)
 {
-	struct fdsource *_fdsource = (struct fdsource *) source;
-	GSList *elem = _fdsource->pollfds;
-
-	if (elem)
-		do {
-			GPollFD *pollfd = elem->data;
-			g_source_remove_poll((GSource *) _fdsource, pollfd);
-			g_slice_free(GPollFD, pollfd);
-			_fdsource->pollfds = g_slist_delete_link(_fdsource->pollfds, elem);
-		} while ((elem = g_slist_next(elem)));
-
-	g_slist_free(_fdsource->pollfds);
-}
+	GtkTreeModel *model = GTK_TREE_MODEL(mwin_devmodel);
+	GtkTreeIter iter;
+	gboolean valid;
 
-static GSourceFuncs sourcefuncs = {
-	.prepare = source_prepare,
-	.check = source_check,
-	.dispatch = source_dispatch,
-	.finalize = source_finalize,
-};
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+			valid = gtk_tree_model_iter_next(model, &iter)) {
+		struct dev_handle *handle;
 
-struct fdsource *fdsource = NULL;
+		gtk_tree_model_get(model, &iter, DC_COL_HANDLE, &handle, -1);
+		dev_handle_unref(handle);
+		gtk_list_store_set(mwin_devmodel, &iter, DC_COL_HANDLE, NULL, -1);
+	}
+}
 
-static void pollfd_add(int fd, short events)
+static gboolean mwin_select_first_dev(void)
 {
-	GPollFD *pollfd = g_slice_new(GPollFD);
-	pollfd->fd = fd;
-	pollfd->events = 0;
-	pollfd->revents = 0;
-	if (events & POLLIN)
-		pollfd->events |= G_IO_IN;
-	if (events & POLLOUT)
-		pollfd->events |= G_IO_OUT;
-
-	fdsource->pollfds = g_slist_prepend(fdsource->pollfds, pollfd);
-	g_source_add_poll((GSource *) fdsource, pollfd);
+	gtk_combo_box_set_active(GTK_COMBO_BOX(mwin_devcombo), 0);
+	return TRUE;
 }
 
-static void pollfd_added_cb(int fd, short events)
+static void mwin_cb_hotplug(void *user_data)
 {
-	g_message("now monitoring fd %d", fd);
-	pollfd_add(fd, events);
+	if (!mwin_update_devs())
+		return;
+
+	/* pick up a reader plugged in while none was selected */
+	if (gtk_combo_box_get_active(GTK_COMBO_BOX(mwin_devcombo)) < 0)
+		mwin_select_first_dev();
 }
 
-static void pollfd_removed_cb(int fd)
+/* Load the enrolled prints and discover devices. Both can block for a
+ * while, so this only runs once the window has been painted. */
+static gboolean mwin_discover(gpointer data)
 {
-	GSList *elem = fdsource->pollfds;
-	g_message("no longer monitoring fd %d", fd);
-
-	if (!elem) {
-		g_warning("cannot remove from list as list is empty?");
-		return;
-	}
+	prints_loaded = (print_cache_init() == 0);
 
-	do {
-		GPollFD *pollfd = elem->data;
-		if (pollfd->fd != fd)
-			continue;
+	/* started first so that nothing plugged in meanwhile is missed;
+	 * without hotplug support the device list stays as discovered */
+	if (hotplug_monitor_start(mwin_cb_hotplug, NULL) < 0)
+		g_message("USB hotplug monitoring unavailable");
 
-		g_source_remove_poll((GSource *) fdsource, pollfd);
-		g_slice_free(GPollFD, pollfd);
-		fdsource->pollfds = g_slist_delete_link(fdsource->pollfds, elem);
-		return;
-	} while ((elem = g_slist_next(elem)));
-	
-	g_error("couldn't find fd in list\n");
+	if (!mwin_update_devs())
+		mwin_devstatus_update("Device discovery failed.");
+	gtk_widget_set_sensitive(mwin_devcombo, TRUE);
+	mwin_select_first_dev();
+	return FALSE;
 }
 
-static int setup_pollfds(void)
+static gboolean mwin_cb_first_expose(GtkWidget *widget, GdkEventExpose *event,
+	gpointer data)
 {
-	size_t numfds;
-	size_t i;
-	struct fp_pollfd *fpfds;
-	GSource *gsource = g_source_new(&sourcefuncs, sizeof(struct fdsource));
-
-	fdsource = (struct fdsource *) gsource;
-	fdsource->pollfds = NULL;
-
-	numfds = fp_get_pollfds(&fpfds);
-	if (numfds < 0) {
-		if (fpfds)
-			free(fpfds);
-		return (int) numfds;
-	} else if (numfds > 0) {
-		for (i = 0; i < numfds; i++) {
-			struct fp_pollfd *fpfd = &fpfds[i];
-			pollfd_add(fpfd->fd, fpfd->events);
-		}
-	}
-
-	free(fpfds);
-	fp_set_pollfd_notifiers(pollfd_added_cb, pollfd_removed_cb);
-	g_source_attach(gsource, NULL);
-	return 0;
+	g_signal_handlers_disconnect_by_func(widget,
+		G_CALLBACK(mwin_cb_first_expose), data);
+	g_idle_add(mwin_discover, NULL);
+	return FALSE;
 }
 
 int main(int argc, char **argv)
 {
+	GError *error = NULL;
 	int r;
 
 	r = fp_init();
 	if (r < 0)
 		return r;
 
-	gtk_init(&argc, &argv);
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+	if (!gtk_init_with_args(&argc, &argv, NULL, entries, NULL, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
 	gtk_window_set_default_icon_name("fprint_demo");
+	if (keep_open >= 0)
+		dev_pool_set_limit(keep_open);
 
-	r = setup_pollfds();
+	/* USB events are handled in a thread of their own */
+	r = io_thread_start();
 	if (r < 0)
 		return r;
 
 	mwin_create();
-	mwin_populate_devs();
-	mwin_select_first_dev();
+	g_signal_connect_after(G_OBJECT(mwin_window), "expose-event",
+		G_CALLBACK(mwin_cb_first_expose), NULL);
 
 	gtk_main();
 
-	if (fpdev)
-		fp_dev_close(fpdev);
+	hotplug_monitor_stop();
+	sessions_exit();
+	mwin_forget_devs();
+	io_thread_stop();
+	img_save_flush();
+	frame_record_exit();
+	if (discovered_devs)
+		fp_dscv_devs_free(discovered_devs);
+	print_cache_exit();
 	fp_exit();
 	return 0;
 }
@@ -435,66 +687,15 @@ const char *fingerstr(enum fp_finger finger)
 	return names[finger];
 }
 
-void pixbuf_destroy(guchar *pixels, gpointer data)
-{
-	g_free(pixels);
-}
-
-unsigned char *img_to_rgbdata(struct fp_img *img)
-{
-	int size = fp_img_get_width(img) * fp_img_get_height(img);
-	unsigned char *imgdata = fp_img_get_data(img);
-	unsigned char *rgbdata = g_malloc(size * 3);
-	size_t i;
-	size_t rgb_offset = 0;
-
-	for (i = 0; i < size; i++) {
-		unsigned char pixel = imgdata[i];
-		rgbdata[rgb_offset++] = pixel;
-		rgbdata[rgb_offset++] = pixel;
-		rgbdata[rgb_offset++] = pixel;
-	}
-
-	return rgbdata;
-}
-
-GdkPixbuf *img_to_pixbuf(struct fp_img *img)
-{
-	int width = fp_img_get_width(img);
-	int height = fp_img_get_height(img);
-	unsigned char *rgbdata = img_to_rgbdata(img);
-
-	return gdk_pixbuf_new_from_data(rgbdata, GDK_COLORSPACE_RGB,
-			FALSE, 8, width, height, width * 3, pixbuf_destroy, NULL);
-}
-
-void mwin_refresh_prints(void)
-{
-	fp_dscv_prints_free(fp_dscv_prints);
-	fp_dscv_prints = NULL;
-	fp_dscv_prints = fp_discover_prints();
-	if (!fp_dscv_prints) {
-		mwin_devstatus_update("Error loading enrolled prints.");
-		if (fpdev)
-			fp_dev_close(fpdev);
-		fpdev = NULL;
-
-		gtk_label_set_text(GTK_LABEL(mwin_drvname_label), NULL);
-		gtk_label_set_text(GTK_LABEL(mwin_imgcapa_label), NULL);
-		for_each_tab_call_op(clear);
-	} else {
-		for_each_tab_call_op(refresh);
-	}
-}
-
 /* simple dialog to display a "Please wait" message */
-GtkWidget *run_please_wait_dialog(char *msg)
+GtkWidget *run_please_wait_dialog(GtkWidget *parent, char *msg)
 {
 	GtkWidget *dlg = gtk_dialog_new();
 	GtkWidget *label = gtk_label_new(msg);
 
 	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dlg)->vbox), label);
 
+	gtk_window_set_transient_for(GTK_WINDOW(dlg), GTK_WINDOW(parent));
 	gtk_window_set_modal(GTK_WINDOW(dlg), TRUE);
 	gtk_widget_show_all(dlg);
 	gtk_widget_hide(GTK_DIALOG(dlg)->action_area);
@@ -503,12 +704,12 @@ GtkWidget *run_please_wait_dialog(char *msg)
 
 /* create and populate a dialog with a request to scan a finger plus a cancel
  * button. hook onto the response signal in order to listen for cancellation. */
-GtkWidget *create_scan_finger_dialog(void)
+GtkWidget *create_scan_finger_dialog(GtkWidget *parent)
 {
 	GtkWidget *dialog, *label, *progressbar;
 	GtkWidget *vbox;
 
-	dialog = gtk_dialog_new_with_buttons("Scan finger", GTK_WINDOW(mwin_window),
+	dialog = gtk_dialog_new_with_buttons("Scan finger", GTK_WINDOW(parent),
 		GTK_DIALOG_MODAL | GTK_DIALOG_NO_SEPARATOR,
 		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, NULL);
 	gtk_window_set_deletable(GTK_WINDOW(dialog), FALSE);
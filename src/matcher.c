@@ -0,0 +1,277 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Software identification for imaging devices. Rather than letting the
+ * driver capture and compare against the gallery in one operation, the
+ * caller captures an image and hands it over here. The probe template is
+ * extracted and compared against the gallery on a worker thread, and the
+ * result is posted back to the main loop, so the caller is free to start
+ * the next capture while matching runs.
+ * 
+ * The NBIS code behind extraction and the bozorth3 matcher keep their
+ * working state in globals, so within the process they are only called
+ * under nbis_lock(). Large galleries are instead split between forked
+ * worker processes, one per CPU, each with its own copy of that state.
+ * The workers stop as soon as any of them finds a match. */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+#if defined(HAVE_FPI_IMG_TO_PRINT_DATA) && defined(HAVE_FPI_IMG_COMPARE_PRINT_DATA)
+#define SW_MATCH 1
+
+/* libfprint's own image matching entry points. They are not part of the
+ * public API, so configure only enables this code when the installed
+ * library exports them. */
+struct fp_img_dev;
+int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
+	struct fp_print_data **ret);
+int fpi_img_compare_print_data(struct fp_print_data *enrolled_print,
+	struct fp_print_data *new_print);
+
+/* fpi_img_to_print_data() only looks at the fp_dev at the start of the
+ * image device, to stamp the template with the driver and devtype */
+struct img_dev_shim {
+	struct fp_dev *dev;
+};
+
+/* bozorth3 score at which libfprint's image drivers report a match */
+#define MATCH_THRESHOLD 40
+
+/* galleries smaller than this are compared in the worker thread, as
+ * forking would cost more than it saves */
+#define MATCH_FORK_MIN 256
+#define MAX_MATCH_PROCS 64
+
+struct sw_match_job {
+	struct fp_dev *dev;
+	struct fp_img *img;
+	struct fp_print_data **gallery;
+	size_t nr_prints;
+	sw_match_cb callback;
+	void *user_data;
+	int result;
+	size_t match_offset;
+};
+
+static GThreadPool *match_pool = NULL;
+static int nr_match_procs;
+
+/* runs in the main loop */
+static gboolean match_complete(gpointer data)
+{
+	struct sw_match_job *job = data;
+
+	job->callback(job->result, job->match_offset, job->user_data);
+	g_slice_free(struct sw_match_job, job);
+	return FALSE;
+}
+
+/* Compare gallery[start..end) against the probe, giving up once found is
+ * set by another worker. Returns the offset of a match, or -1. */
+static ssize_t compare_range(struct sw_match_job *job,
+	struct fp_print_data *probe, size_t start, size_t end,
+	volatile gint *found)
+{
+	size_t i;
+
+	for (i = start; i < end; i++) {
+		if (found && g_atomic_int_get(found))
+			return -1;
+		if (fpi_img_compare_print_data(job->gallery[i], probe)
+				>= MATCH_THRESHOLD) {
+			if (found)
+				g_atomic_int_set(found, 1);
+			return i;
+		}
+	}
+	return -1;
+}
+
+static ssize_t compare_locked(struct sw_match_job *job,
+	struct fp_print_data *probe, size_t start, size_t end)
+{
+	ssize_t match;
+
+	nbis_lock();
+	match = compare_range(job, probe, start, end, NULL);
+	nbis_unlock();
+	return match;
+}
+
+/* Split the gallery between forked processes. Each reports the offset of
+ * its match, or -1, through a pipe. A shard whose process could not be
+ * started, or did not report, is compared here instead. */
+static ssize_t compare_forked(struct sw_match_job *job,
+	struct fp_print_data *probe)
+{
+	size_t per_proc = (job->nr_prints + nr_match_procs - 1) / nr_match_procs;
+	pid_t pids[MAX_MATCH_PROCS];
+	int fds[MAX_MATCH_PROCS];
+	volatile gint *found;
+	ssize_t match = -1;
+	int i;
+
+	found = mmap(NULL, sizeof(*found), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (found == MAP_FAILED)
+		return compare_locked(job, probe, 0, job->nr_prints);
+	*found = 0;
+
+	/* keep other threads out of NBIS while its state is copied */
+	nbis_lock();
+	for (i = 0; i < nr_match_procs; i++) {
+		size_t start = i * per_proc;
+		size_t end = MIN(start + per_proc, job->nr_prints);
+		int p[2];
+
+		pids[i] = -1;
+		fds[i] = -1;
+		if (start >= end || pipe(p) < 0)
+			continue;
+
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			ssize_t r;
+
+			close(p[0]);
+			r = compare_range(job, probe, start, end, found);
+			if (write(p[1], &r, sizeof(r)) != sizeof(r))
+				_exit(1);
+			_exit(0);
+		}
+
+		close(p[1]);
+		if (pids[i] < 0)
+			close(p[0]);
+		else
+			fds[i] = p[0];
+	}
+	nbis_unlock();
+
+	for (i = 0; i < nr_match_procs; i++) {
+		size_t start = i * per_proc;
+		size_t end = MIN(start + per_proc, job->nr_prints);
+		ssize_t r = -1;
+		gboolean reported = FALSE;
+
+		if (start >= end)
+			break;
+
+		if (fds[i] >= 0) {
+			reported = read(fds[i], &r, sizeof(r)) == sizeof(r);
+			close(fds[i]);
+			waitpid(pids[i], NULL, 0);
+		}
+		if (!reported && !g_atomic_int_get(found))
+			r = compare_locked(job, probe, start, end);
+
+		if (r >= 0 && (match < 0 || r < match))
+			match = r;
+	}
+
+	munmap((void *) found, sizeof(*found));
+	return match;
+}
+
+/* runs on the worker thread */
+static void match_run(gpointer data, gpointer user_data)
+{
+	struct sw_match_job *job = data;
+	struct img_dev_shim shim = { job->dev };
+	struct fp_print_data *probe;
+	ssize_t match;
+	int r;
+
+	nbis_lock();
+	r = fpi_img_to_print_data((struct fp_img_dev *) &shim, job->img, &probe);
+	nbis_unlock();
+	fp_img_free(job->img);
+	job->img = NULL;
+	if (r < 0) {
+		job->result = r;
+		goto out;
+	}
+
+	if (nr_match_procs > 1 && job->nr_prints >= MATCH_FORK_MIN)
+		match = compare_forked(job, probe);
+	else
+		match = compare_locked(job, probe, 0, job->nr_prints);
+	fp_print_data_free(probe);
+
+	if (match >= 0) {
+		job->result = FP_VERIFY_MATCH;
+		job->match_offset = match;
+	} else {
+		job->result = FP_VERIFY_NO_MATCH;
+	}
+
+out:
+	g_idle_add(match_complete, job);
+}
+
+#endif /* SW_MATCH */
+
+gboolean sw_match_available(void)
+{
+#ifdef SW_MATCH
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/* Identify the image against a NULL-terminated gallery. Ownership of img
+ * passes to the matcher, the gallery must remain valid until callback has
+ * been called from the main loop. Returns -ENOTSUP when the installed
+ * libfprint does not provide image matching. */
+int sw_match_submit(struct fp_dev *dev, struct fp_img *img,
+	struct fp_print_data **gallery, sw_match_cb callback, void *user_data)
+{
+#ifdef SW_MATCH
+	struct sw_match_job *job;
+
+	job = g_slice_new0(struct sw_match_job);
+	job->dev = dev;
+	job->img = img;
+	job->gallery = gallery;
+	while (gallery[job->nr_prints])
+		job->nr_prints++;
+	job->callback = callback;
+	job->user_data = user_data;
+
+	if (!match_pool) {
+		long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nr_match_procs = CLAMP(nr_cpus, 1, MAX_MATCH_PROCS);
+		match_pool = g_thread_pool_new(match_run, NULL, 1, FALSE, NULL);
+	}
+	g_thread_pool_push(match_pool, job, NULL);
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
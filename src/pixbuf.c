@@ -0,0 +1,61 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Conversion of libfprint images into GdkPixbufs for display. Kept apart
+ * from the GUI so that fprint_bench can time it. */
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <libfprint/fprint.h>
+
+#include "fprint_demo.h"
+
+void pixbuf_destroy(guchar *pixels, gpointer data)
+{
+	g_free(pixels);
+}
+
+unsigned char *gray_to_rgbdata(const unsigned char *data, int width,
+	int height)
+{
+	int size = width * height;
+	unsigned char *rgbdata = g_malloc(size * 3);
+
+	gray_to_rgb(rgbdata, data, size);
+	return rgbdata;
+}
+
+GdkPixbuf *gray_to_pixbuf(const unsigned char *data, int width, int height)
+{
+	unsigned char *rgbdata = gray_to_rgbdata(data, width, height);
+
+	return gdk_pixbuf_new_from_data(rgbdata, GDK_COLORSPACE_RGB,
+			FALSE, 8, width, height, width * 3, pixbuf_destroy, NULL);
+}
+
+unsigned char *img_to_rgbdata(struct fp_img *img)
+{
+	return gray_to_rgbdata(fp_img_get_data(img), fp_img_get_width(img),
+		fp_img_get_height(img));
+}
+
+GdkPixbuf *img_to_pixbuf(struct fp_img *img)
+{
+	return gray_to_pixbuf(fp_img_get_data(img), fp_img_get_width(img),
+		fp_img_get_height(img));
+}
@@ -0,0 +1,387 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* In-memory index of enrolled prints, keyed on (driver, devtype, finger).
+ * The prints are indexed from the print pack (see printpack.c) kept next
+ * to libfprint's print store, so startup does not open every print file.
+ * The pack is built from the print store on first use and is then kept up
+ * to date by enrollment and deletion, which also update the single index
+ * entry they touch. At startup the pack is checked against the print
+ * store and rebuilt if other programs have enrolled or deleted prints
+ * since it was written. Without a usable pack, the print store is walked
+ * with fp_discover_prints() instead. */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+static GHashTable *print_index = NULL;
+static struct fp_dscv_print **dscv_prints = NULL;
+static struct print_pack *pack = NULL;
+static unsigned int next_serial = 1;
+
+static guint print_hash(gconstpointer key)
+{
+	const struct fpd_print *print = key;
+	return (print->driver_id << 20) ^ print->devtype ^ (print->finger << 16);
+}
+
+static gboolean print_equal(gconstpointer a, gconstpointer b)
+{
+	const struct fpd_print *print1 = a;
+	const struct fpd_print *print2 = b;
+	return print1->driver_id == print2->driver_id
+		&& print1->devtype == print2->devtype
+		&& print1->finger == print2->finger;
+}
+
+static void print_free(gpointer data)
+{
+	g_slice_free(struct fpd_print, data);
+}
+
+static struct fpd_print *print_new(uint16_t driver_id, uint32_t devtype,
+	enum fp_finger finger)
+{
+	struct fpd_print *print = g_slice_new0(struct fpd_print);
+	print->driver_id = driver_id;
+	print->devtype = devtype;
+	print->finger = finger;
+	print->serial = next_serial++;
+	print->pack_index = -1;
+	return print;
+}
+
+static void print_key_for_dev(struct fpd_print *key, struct fp_dev *dev,
+	enum fp_finger finger)
+{
+	key->driver_id = fp_driver_get_driver_id(fp_dev_get_driver(dev));
+	key->devtype = fp_dev_get_devtype(dev);
+	key->finger = finger;
+}
+
+static void print_insert(struct fpd_print *print)
+{
+	/* the entry acts as its own key, so replace rather than insert to
+	 * make the table pick up the new key too */
+	g_hash_table_replace(print_index, print, print);
+}
+
+/* newest modification time of path and everything below it, down to
+ * depth levels */
+static time_t tree_mtime(const char *path, int depth)
+{
+	const char *name;
+	struct stat st;
+	time_t newest;
+	GDir *dir;
+
+	if (stat(path, &st) < 0)
+		return 0;
+	newest = st.st_mtime;
+	if (depth == 0 || !S_ISDIR(st.st_mode))
+		return newest;
+
+	dir = g_dir_open(path, 0, NULL);
+	while (dir && (name = g_dir_read_name(dir))) {
+		gchar *child = g_build_filename(path, name, NULL);
+		newest = MAX(newest, tree_mtime(child, depth - 1));
+		g_free(child);
+	}
+	if (dir)
+		g_dir_close(dir);
+	return newest;
+}
+
+/* Whether the pack still holds what the print store does: no print file
+ * or directory in the store is newer than the pack, and both have prints
+ * for the same fingers. fp_discover_prints() only reads the directories,
+ * not the prints themselves. */
+static gboolean pack_current(struct print_pack *_pack, const char *path,
+	const char *store)
+{
+	const char *user_id = g_get_user_name();
+	unsigned int nr_entries = print_pack_size(_pack);
+	struct fp_dscv_print **dprints;
+	gboolean current = TRUE;
+	GHashTable *keys;
+	struct stat st;
+	unsigned int i;
+
+	/* the store is laid out as <driver id>/<devtype>/<finger> */
+	if (stat(path, &st) < 0 || tree_mtime(store, 3) > st.st_mtime)
+		return FALSE;
+
+	dprints = fp_discover_prints();
+	if (!dprints)
+		return FALSE;
+
+	keys = g_hash_table_new_full(print_hash, print_equal, NULL, print_free);
+	for (i = 0; i < nr_entries; i++) {
+		struct print_pack_info info;
+		struct fpd_print *key;
+
+		if (print_pack_get(_pack, i, &info) < 0
+				|| strcmp(info.user_id, user_id) != 0)
+			continue;
+
+		key = g_slice_new0(struct fpd_print);
+		key->driver_id = info.driver_id;
+		key->devtype = info.devtype;
+		key->finger = info.finger;
+		g_hash_table_replace(keys, key, key);
+	}
+
+	for (i = 0; current && dprints[i]; i++) {
+		struct fpd_print key;
+
+		key.driver_id = fp_dscv_print_get_driver_id(dprints[i]);
+		key.devtype = fp_dscv_print_get_devtype(dprints[i]);
+		key.finger = fp_dscv_print_get_finger(dprints[i]);
+		current = g_hash_table_lookup(keys, &key) != NULL;
+	}
+	if (current && i != g_hash_table_size(keys))
+		current = FALSE;
+
+	g_hash_table_destroy(keys);
+	fp_dscv_prints_free(dprints);
+	return current;
+}
+
+/* build a new pack from the print store and put it in place of any old
+ * one, which other processes may still have open */
+static struct print_pack *pack_build(const char *path, const char *store)
+{
+	gchar *tmp_path = g_strdup_printf("%s.new", path);
+	struct print_pack *_pack;
+	int r = -1;
+
+	unlink(tmp_path);
+	_pack = print_pack_open(tmp_path, TRUE);
+	if (_pack) {
+		g_message("building print pack %s", path);
+		r = print_pack_import_dir(_pack, store, g_get_user_name());
+		print_pack_close(_pack);
+	}
+
+	_pack = NULL;
+	if (r >= 0 && rename(tmp_path, path) == 0)
+		_pack = print_pack_open(path, FALSE);
+	else
+		unlink(tmp_path);
+	g_free(tmp_path);
+	return _pack;
+}
+
+/* open the pack, building it from the print store if there is none yet or
+ * it is out of date */
+static struct print_pack *pack_open(void)
+{
+	gchar *path = g_build_filename(g_get_home_dir(), ".fprint",
+		"prints.pack", NULL);
+	gchar *store = g_build_filename(g_get_home_dir(), ".fprint", "prints",
+		NULL);
+	struct print_pack *_pack = print_pack_open(path, FALSE);
+
+	if (_pack && !pack_current(_pack, path, store)) {
+		g_message("print pack %s is out of date", path);
+		print_pack_close(_pack);
+		_pack = NULL;
+	}
+	if (!_pack)
+		_pack = pack_build(path, store);
+
+	g_free(store);
+	g_free(path);
+	return _pack;
+}
+
+static int index_pack(void)
+{
+	const char *user_id = g_get_user_name();
+	unsigned int nr_entries = print_pack_size(pack);
+	unsigned int i;
+
+	/* later entries supersede earlier ones for the same finger */
+	for (i = 0; i < nr_entries; i++) {
+		struct print_pack_info info;
+		struct fpd_print *print;
+
+		if (print_pack_get(pack, i, &info) < 0
+				|| strcmp(info.user_id, user_id) != 0)
+			continue;
+
+		print = print_new(info.driver_id, info.devtype, info.finger);
+		print->pack_index = i;
+		print_insert(print);
+	}
+
+	return 0;
+}
+
+/* index the enrolled prints */
+int print_cache_init(void)
+{
+	struct fp_dscv_print *dprint;
+	int i;
+
+	print_index = g_hash_table_new_full(print_hash, print_equal, NULL,
+		print_free);
+
+	pack = pack_open();
+	if (pack)
+		return index_pack();
+
+	dscv_prints = fp_discover_prints();
+	if (!dscv_prints)
+		return -1;
+
+	for (i = 0; (dprint = dscv_prints[i]); i++) {
+		struct fpd_print *print = print_new(
+			fp_dscv_print_get_driver_id(dprint),
+			fp_dscv_print_get_devtype(dprint),
+			fp_dscv_print_get_finger(dprint));
+		print->dscv = dprint;
+		print_insert(print);
+	}
+
+	return 0;
+}
+
+void print_cache_exit(void)
+{
+	if (print_index)
+		g_hash_table_destroy(print_index);
+	print_index = NULL;
+	fp_dscv_prints_free(dscv_prints);
+	dscv_prints = NULL;
+	print_pack_close(pack);
+	pack = NULL;
+}
+
+/* look up the print enrolled for finger which is compatible with dev */
+struct fpd_print *print_cache_lookup(struct fp_dev *dev, enum fp_finger finger)
+{
+	struct fpd_print key;
+
+	if (!print_index)
+		return NULL;
+
+	print_key_for_dev(&key, dev, finger);
+	return g_hash_table_lookup(print_index, &key);
+}
+
+/* mark the pack entry of a print being replaced or deleted as deleted */
+static void pack_drop(struct fpd_print *key)
+{
+	struct fpd_print *old = g_hash_table_lookup(print_index, key);
+	if (pack && old && old->pack_index >= 0)
+		print_pack_remove(pack, old->pack_index);
+}
+
+/* record that data has just been saved as the print for finger on dev. Any
+ * existing entry is replaced, so pointers to it become invalid. */
+void print_cache_add(struct fp_dev *dev, enum fp_finger finger,
+	struct fp_print_data *data)
+{
+	struct fpd_print key;
+	struct fpd_print *print;
+
+	if (!print_index)
+		return;
+
+	print_key_for_dev(&key, dev, finger);
+	pack_drop(&key);
+
+	print = print_new(key.driver_id, key.devtype, finger);
+	if (pack) {
+		int r = print_pack_append(pack, g_get_user_name(), finger, data);
+		if (r >= 0)
+			print->pack_index = r;
+		else
+			g_message("could not add print to pack, error %d", r);
+	}
+	print_insert(print);
+}
+
+/* print_cache_add() for the prints of several fingers saved together,
+ * which are added to the pack in one go */
+void print_cache_add_many(struct fp_dev *dev, const enum fp_finger *fingers,
+	struct fp_print_data **data, unsigned int nr_prints)
+{
+	struct fpd_print key;
+	unsigned int i;
+	int first = -1;
+
+	if (!print_index || nr_prints == 0)
+		return;
+
+	for (i = 0; i < nr_prints; i++) {
+		print_key_for_dev(&key, dev, fingers[i]);
+		pack_drop(&key);
+	}
+
+	if (pack) {
+		first = print_pack_append_many(pack, g_get_user_name(), fingers,
+			data, nr_prints);
+		if (first < 0)
+			g_message("could not add prints to pack, error %d", first);
+	}
+
+	for (i = 0; i < nr_prints; i++) {
+		struct fpd_print *print;
+
+		print_key_for_dev(&key, dev, fingers[i]);
+		print = print_new(key.driver_id, key.devtype, fingers[i]);
+		if (first >= 0)
+			print->pack_index = first + i;
+		print_insert(print);
+	}
+}
+
+/* record that the print for finger has been deleted for dev */
+void print_cache_remove(struct fp_dev *dev, enum fp_finger finger)
+{
+	struct fpd_print key;
+
+	if (!print_index)
+		return;
+
+	print_key_for_dev(&key, dev, finger);
+	pack_drop(&key);
+	g_hash_table_remove(print_index, &key);
+}
+
+/* load the print data of a cached entry. The caller owns the result. */
+int print_cache_load(struct fp_dev *dev, struct fpd_print *print,
+	struct fp_print_data **data)
+{
+	/* prints which could not be added to the pack and prints enrolled
+	 * since startup without a pack are loaded through the device */
+	if (print->pack_index >= 0)
+		return print_pack_load(pack, print->pack_index, data);
+	if (print->dscv)
+		return fp_print_data_from_dscv_print(print->dscv, data);
+	return fp_print_data_load(dev, print->finger, data);
+}
@@ -0,0 +1,648 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Print pack: all enrolled prints of any number of users in one file.
+ * 
+ * The file starts with a header, followed by a fixed capacity index of
+ * 64-byte entries, followed by the serialized fp_print_data blobs. The
+ * file is mapped read-only, so opening it costs one open and one mmap no
+ * matter how many prints it holds. Scanning the index only touches the
+ * index pages, and a blob is only paged in when that print is loaded.
+ * 
+ * New prints are appended: the blob is written at the end of the file,
+ * then its index entry, and the entry count in the header is updated
+ * last. An interrupted append therefore leaves only an unreferenced blob
+ * behind. When the index is full, the file is rewritten with twice the
+ * capacity and renamed over the original. Deleted prints are marked in
+ * their index entry. All fields are little endian.
+ * 
+ * Several processes may write to the same pack. Each append, removal or
+ * grow is done under an exclusive flock() of the file, and a writer whose
+ * file has been renamed over by another process growing it reopens the
+ * path first. A pack rebuilt from scratch numbers its entries differently
+ * and carries a different id, so a process holding the old one stops
+ * writing rather than marking the wrong entries. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+#define PACK_MAGIC "FPDPACK"
+#define PACK_VERSION 1
+#define PACK_INITIAL_CAPACITY 64
+
+struct pack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nr_entries;
+	uint32_t capacity;
+	/* random, and kept when the pack grows */
+	uint32_t id;
+	uint32_t reserved[2];
+};
+
+struct pack_entry {
+	uint64_t offset;
+	uint32_t length;
+	uint16_t driver_id;
+	uint8_t finger; /* 0 once deleted */
+	uint8_t reserved;
+	uint32_t devtype;
+	char user_id[PRINT_PACK_USER_ID_MAX + 1];
+};
+
+struct print_pack {
+	gchar *path;
+	int fd;
+	const unsigned char *map;
+	size_t map_size;
+	uint32_t id;
+	/* the file has been written to since it was mapped */
+	gboolean stale;
+};
+
+#define pack_header(pack) ((const struct pack_header *) (pack)->map)
+#define pack_entries(pack) \
+	((const struct pack_entry *) ((pack)->map + sizeof(struct pack_header)))
+#define index_end(capacity) \
+	(sizeof(struct pack_header) + (capacity) * sizeof(struct pack_entry))
+
+static int pack_map(struct print_pack *pack)
+{
+	const struct pack_header *hdr;
+	struct stat st;
+	void *map;
+
+	if (pack->map)
+		munmap((void *) pack->map, pack->map_size);
+	pack->map = NULL;
+	pack->stale = FALSE;
+
+	if (fstat(pack->fd, &st) < 0)
+		return -errno;
+	if (st.st_size < sizeof(struct pack_header))
+		return -EINVAL;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, pack->fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+	pack->map = map;
+	pack->map_size = st.st_size;
+
+	hdr = pack_header(pack);
+	if (memcmp(hdr->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0
+			|| GUINT32_FROM_LE(hdr->version) != PACK_VERSION
+			|| index_end(GUINT32_FROM_LE(hdr->capacity)) > pack->map_size
+			|| GUINT32_FROM_LE(hdr->nr_entries)
+				> GUINT32_FROM_LE(hdr->capacity))
+		return -EINVAL;
+	return 0;
+}
+
+static int pack_sync(struct print_pack *pack)
+{
+	if (pack->stale)
+		return pack_map(pack);
+	return 0;
+}
+
+static int lock_fd(int fd, int operation)
+{
+	while (flock(fd, operation) < 0)
+		if (errno != EINTR)
+			return -errno;
+	return 0;
+}
+
+/* Take the write lock and map the file as it now is. If another process
+ * has grown the pack since it was opened, the file at the path is opened
+ * and locked in its place. If it has been rebuilt instead, the entry
+ * numbers known to the caller no longer apply and -ESTALE is returned. */
+static int pack_lock(struct print_pack *pack)
+{
+	struct pack_header hdr;
+	struct stat st;
+	struct stat path_st;
+	int fd;
+	int r;
+
+	for (;;) {
+		r = lock_fd(pack->fd, LOCK_EX);
+		if (r < 0)
+			return r;
+
+		if (fstat(pack->fd, &st) < 0 || stat(pack->path, &path_st) < 0) {
+			r = -errno;
+			goto err;
+		}
+		if (st.st_dev == path_st.st_dev && st.st_ino == path_st.st_ino)
+			break;
+
+		fd = open(pack->path, O_RDWR);
+		if (fd < 0) {
+			r = -errno;
+			goto err;
+		}
+		if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+				|| GUINT32_FROM_LE(hdr.id) != pack->id) {
+			close(fd);
+			r = -ESTALE;
+			goto err;
+		}
+		lock_fd(pack->fd, LOCK_UN);
+		close(pack->fd);
+		pack->fd = fd;
+	}
+
+	r = pack_map(pack);
+	if (r == 0)
+		return 0;
+
+err:
+	lock_fd(pack->fd, LOCK_UN);
+	return r;
+}
+
+static void pack_unlock(struct print_pack *pack)
+{
+	lock_fd(pack->fd, LOCK_UN);
+}
+
+static int write_at(int fd, const void *buf, size_t length, off_t offset)
+{
+	const char *p = buf;
+
+	while (length) {
+		ssize_t r = pwrite(fd, p, length, offset);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += r;
+		offset += r;
+		length -= r;
+	}
+	return 0;
+}
+
+static int write_empty(int fd, uint32_t capacity, uint32_t id)
+{
+	struct pack_header hdr;
+	int r;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+	hdr.version = GUINT32_TO_LE(PACK_VERSION);
+	hdr.capacity = GUINT32_TO_LE(capacity);
+	hdr.id = GUINT32_TO_LE(id);
+
+	if (ftruncate(fd, index_end(capacity)) < 0)
+		return -errno;
+	r = write_at(fd, &hdr, sizeof(hdr), 0);
+	if (r < 0)
+		return r;
+	return 0;
+}
+
+/* Open the pack at path, creating an empty one if requested and it does
+ * not exist. Returns NULL if the file is missing or not a valid pack. */
+struct print_pack *print_pack_open(const char *path, gboolean create)
+{
+	struct print_pack *pack;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0 && errno == EACCES)
+		fd = open(path, O_RDONLY);
+	if (fd < 0 && errno == ENOENT && create) {
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0 && write_empty(fd, PACK_INITIAL_CAPACITY,
+				g_random_int()) < 0) {
+			close(fd);
+			unlink(path);
+			fd = -1;
+		}
+	}
+	if (fd < 0)
+		return NULL;
+
+	pack = g_slice_new0(struct print_pack);
+	pack->path = g_strdup(path);
+	pack->fd = fd;
+	if (pack_map(pack) < 0) {
+		g_message("ignoring invalid print pack %s", path);
+		print_pack_close(pack);
+		return NULL;
+	}
+	pack->id = GUINT32_FROM_LE(pack_header(pack)->id);
+	return pack;
+}
+
+void print_pack_close(struct print_pack *pack)
+{
+	if (!pack)
+		return;
+	if (pack->map)
+		munmap((void *) pack->map, pack->map_size);
+	close(pack->fd);
+	g_free(pack->path);
+	g_slice_free(struct print_pack, pack);
+}
+
+/* number of index entries, including deleted ones */
+unsigned int print_pack_size(struct print_pack *pack)
+{
+	if (pack_sync(pack) < 0)
+		return 0;
+	return GUINT32_FROM_LE(pack_header(pack)->nr_entries);
+}
+
+/* Describe entry i. Returns -ENOENT for deleted entries. The user ID
+ * points into the mapping and is only valid until the pack is next
+ * written to. */
+int print_pack_get(struct print_pack *pack, unsigned int i,
+	struct print_pack_info *info)
+{
+	const struct pack_entry *entry;
+	int r;
+
+	r = pack_sync(pack);
+	if (r < 0)
+		return r;
+	if (i >= GUINT32_FROM_LE(pack_header(pack)->nr_entries))
+		return -EINVAL;
+
+	entry = &pack_entries(pack)[i];
+	if (entry->finger == 0)
+		return -ENOENT;
+
+	info->driver_id = GUINT16_FROM_LE(entry->driver_id);
+	info->devtype = GUINT32_FROM_LE(entry->devtype);
+	info->finger = entry->finger;
+	info->user_id = entry->user_id;
+	return 0;
+}
+
+/* deserialize the print data of entry i, caller owns the result */
+int print_pack_load(struct print_pack *pack, unsigned int i,
+	struct fp_print_data **data)
+{
+	const struct pack_entry *entry;
+	uint64_t offset;
+	uint32_t length;
+	int r;
+
+	r = pack_sync(pack);
+	if (r < 0)
+		return r;
+	if (i >= GUINT32_FROM_LE(pack_header(pack)->nr_entries))
+		return -EINVAL;
+
+	entry = &pack_entries(pack)[i];
+	offset = GUINT64_FROM_LE(entry->offset);
+	length = GUINT32_FROM_LE(entry->length);
+	if (entry->finger == 0)
+		return -ENOENT;
+	if (offset > pack->map_size || length > pack->map_size - offset)
+		return -EINVAL;
+
+	/* fp_print_data_from_data() copies the buffer, the mapping is never
+	 * written through */
+	*data = fp_print_data_from_data((unsigned char *) pack->map + offset,
+		length);
+	if (!*data)
+		return -EINVAL;
+	return 0;
+}
+
+/* Rewrite the pack with room for more index entries. Called with the lock
+ * held, which moves over to the new file. */
+static int pack_grow(struct print_pack *pack)
+{
+	const struct pack_header *hdr = pack_header(pack);
+	uint32_t nr_entries = GUINT32_FROM_LE(hdr->nr_entries);
+	uint32_t capacity = GUINT32_FROM_LE(hdr->capacity) * 2;
+	size_t old_end = index_end(GUINT32_FROM_LE(hdr->capacity));
+	size_t shift = index_end(capacity) - old_end;
+	struct pack_entry *entries;
+	gchar *tmp_path;
+	uint32_t i;
+	int fd;
+	int r;
+
+	tmp_path = g_strdup_printf("%s.tmp", pack->path);
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		r = -errno;
+		goto out;
+	}
+
+	/* locked before it appears at the path, so that other writers wait
+	 * on it once they have reopened */
+	r = lock_fd(fd, LOCK_EX);
+	if (r < 0)
+		goto err;
+	r = write_empty(fd, capacity, pack->id);
+	if (r < 0)
+		goto err;
+
+	/* blobs move up by the size of the added index entries */
+	entries = g_memdup(pack_entries(pack),
+		nr_entries * sizeof(struct pack_entry));
+	for (i = 0; i < nr_entries; i++)
+		entries[i].offset = GUINT64_TO_LE(
+			GUINT64_FROM_LE(entries[i].offset) + shift);
+	r = write_at(fd, entries, nr_entries * sizeof(struct pack_entry),
+		sizeof(struct pack_header));
+	g_free(entries);
+	if (r < 0)
+		goto err;
+
+	r = write_at(fd, pack->map + old_end, pack->map_size - old_end,
+		index_end(capacity));
+	if (r < 0)
+		goto err;
+
+	r = write_at(fd, &hdr->nr_entries, sizeof(hdr->nr_entries),
+		G_STRUCT_OFFSET(struct pack_header, nr_entries));
+	if (r < 0 || fsync(fd) < 0 || rename(tmp_path, pack->path) < 0) {
+		r = (r < 0) ? r : -errno;
+		goto err;
+	}
+
+	close(pack->fd);
+	pack->fd = fd;
+	r = pack_map(pack);
+	goto out;
+
+err:
+	close(fd);
+	unlink(tmp_path);
+out:
+	g_free(tmp_path);
+	return r;
+}
+
+/* Append a serialized print. Returns the index of the new entry. */
+int print_pack_append_raw(struct print_pack *pack, const char *user_id,
+	uint16_t driver_id, uint32_t devtype, enum fp_finger finger,
+	const unsigned char *buf, size_t length)
+{
+	const struct pack_header *hdr;
+	struct pack_entry entry;
+	uint32_t nr_entries;
+	struct stat st;
+	int r;
+
+	if (strlen(user_id) > PRINT_PACK_USER_ID_MAX)
+		return -ENAMETOOLONG;
+
+	r = pack_lock(pack);
+	if (r < 0)
+		return r;
+
+	hdr = pack_header(pack);
+	nr_entries = GUINT32_FROM_LE(hdr->nr_entries);
+	if (nr_entries == GUINT32_FROM_LE(hdr->capacity)) {
+		r = pack_grow(pack);
+		if (r < 0)
+			goto out;
+	}
+
+	if (fstat(pack->fd, &st) < 0) {
+		r = -errno;
+		goto out;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = GUINT64_TO_LE(st.st_size);
+	entry.length = GUINT32_TO_LE(length);
+	entry.driver_id = GUINT16_TO_LE(driver_id);
+	entry.devtype = GUINT32_TO_LE(devtype);
+	entry.finger = finger;
+	strcpy(entry.user_id, user_id);
+
+	r = write_at(pack->fd, buf, length, st.st_size);
+	if (r == 0)
+		r = write_at(pack->fd, &entry, sizeof(entry),
+			index_end(nr_entries));
+	if (r == 0) {
+		uint32_t count = GUINT32_TO_LE(nr_entries + 1);
+		r = write_at(pack->fd, &count, sizeof(count),
+			G_STRUCT_OFFSET(struct pack_header, nr_entries));
+	}
+	pack->stale = TRUE;
+
+out:
+	pack_unlock(pack);
+	return (r < 0) ? r : (int) nr_entries;
+}
+
+int print_pack_append(struct print_pack *pack, const char *user_id,
+	enum fp_finger finger, struct fp_print_data *data)
+{
+	unsigned char *buf;
+	size_t length;
+	int r;
+
+	length = fp_print_data_get_data(data, &buf);
+	if (length == 0)
+		return -ENOMEM;
+
+	r = print_pack_append_raw(pack, user_id,
+		fp_print_data_get_driver_id(data), fp_print_data_get_devtype(data),
+		finger, buf, length);
+	free(buf);
+	return r;
+}
+
+/* Append the prints of several fingers of one user at once: the blobs are
+ * written with one write and the index entries with another, and the entry
+ * count is updated once. Returns the index of the first new entry, the
+ * others following in order. */
+int print_pack_append_many(struct print_pack *pack, const char *user_id,
+	const enum fp_finger *fingers, struct fp_print_data **data,
+	unsigned int nr_prints)
+{
+	const struct pack_header *hdr;
+	struct pack_entry *entries;
+	GByteArray *blobs;
+	uint32_t nr_entries;
+	uint32_t count;
+	struct stat st;
+	unsigned int i;
+	int r;
+
+	if (strlen(user_id) > PRINT_PACK_USER_ID_MAX)
+		return -ENAMETOOLONG;
+	if (nr_prints == 0)
+		return -EINVAL;
+
+	r = pack_lock(pack);
+	if (r < 0)
+		return r;
+
+	hdr = pack_header(pack);
+	nr_entries = GUINT32_FROM_LE(hdr->nr_entries);
+	while (nr_entries + nr_prints > GUINT32_FROM_LE(hdr->capacity)) {
+		r = pack_grow(pack);
+		if (r < 0)
+			goto unlock;
+		hdr = pack_header(pack);
+	}
+
+	if (fstat(pack->fd, &st) < 0) {
+		r = -errno;
+		goto unlock;
+	}
+
+	blobs = g_byte_array_new();
+	entries = g_new0(struct pack_entry, nr_prints);
+	for (i = 0; i < nr_prints; i++) {
+		unsigned char *buf;
+		size_t length = fp_print_data_get_data(data[i], &buf);
+
+		if (length == 0) {
+			r = -ENOMEM;
+			goto out;
+		}
+		entries[i].offset = GUINT64_TO_LE(st.st_size + blobs->len);
+		entries[i].length = GUINT32_TO_LE(length);
+		entries[i].driver_id = GUINT16_TO_LE(
+			fp_print_data_get_driver_id(data[i]));
+		entries[i].devtype = GUINT32_TO_LE(
+			fp_print_data_get_devtype(data[i]));
+		entries[i].finger = fingers[i];
+		strcpy(entries[i].user_id, user_id);
+		g_byte_array_append(blobs, buf, length);
+		free(buf);
+	}
+
+	r = write_at(pack->fd, blobs->data, blobs->len, st.st_size);
+	if (r == 0)
+		r = write_at(pack->fd, entries,
+			nr_prints * sizeof(struct pack_entry), index_end(nr_entries));
+	if (r == 0) {
+		count = GUINT32_TO_LE(nr_entries + nr_prints);
+		r = write_at(pack->fd, &count, sizeof(count),
+			G_STRUCT_OFFSET(struct pack_header, nr_entries));
+	}
+	pack->stale = TRUE;
+
+out:
+	g_free(entries);
+	g_byte_array_free(blobs, TRUE);
+unlock:
+	pack_unlock(pack);
+	return (r < 0) ? r : (int) nr_entries;
+}
+
+/* mark entry i as deleted */
+int print_pack_remove(struct print_pack *pack, unsigned int i)
+{
+	uint8_t deleted = 0;
+	int r;
+
+	r = pack_lock(pack);
+	if (r < 0)
+		return r;
+
+	if (i >= GUINT32_FROM_LE(pack_header(pack)->nr_entries))
+		r = -EINVAL;
+	else
+		r = write_at(pack->fd, &deleted, sizeof(deleted),
+			index_end(i) + G_STRUCT_OFFSET(struct pack_entry, finger));
+	pack->stale = TRUE;
+
+	pack_unlock(pack);
+	return r;
+}
+
+/* Append every print stored below path in libfprint's layout
+ * (<driver id>/<devtype>/<finger>) under the given user ID. The files are
+ * copied as they are, without being parsed. Returns the number added. */
+int print_pack_import_dir(struct print_pack *pack, const char *path,
+	const char *user_id)
+{
+	const char *driver_name;
+	GDir *driver_dir;
+	int nr_prints = 0;
+
+	driver_dir = g_dir_open(path, 0, NULL);
+	if (!driver_dir)
+		return 0;
+
+	while ((driver_name = g_dir_read_name(driver_dir))) {
+		gchar *driver_path = g_build_filename(path, driver_name, NULL);
+		unsigned long driver_id = strtoul(driver_name, NULL, 16);
+		const char *devtype_name;
+		GDir *devtype_dir = g_dir_open(driver_path, 0, NULL);
+
+		while (devtype_dir
+				&& (devtype_name = g_dir_read_name(devtype_dir))) {
+			gchar *devtype_path = g_build_filename(driver_path,
+				devtype_name, NULL);
+			unsigned long devtype = strtoul(devtype_name, NULL, 16);
+			const char *name;
+			GDir *dir = g_dir_open(devtype_path, 0, NULL);
+
+			while (dir && (name = g_dir_read_name(dir))) {
+				gchar *file = g_build_filename(devtype_path, name, NULL);
+				gchar *contents;
+				gsize length;
+				char *end;
+				long finger = strtol(name, &end, 16);
+
+				if (!*end && finger >= LEFT_THUMB && finger <= RIGHT_LITTLE
+						&& g_file_get_contents(file, &contents, &length,
+							NULL)) {
+					if (print_pack_append_raw(pack, user_id, driver_id,
+							devtype, finger, (unsigned char *) contents,
+							length) >= 0)
+						nr_prints++;
+					g_free(contents);
+				}
+				g_free(file);
+			}
+
+			if (dir)
+				g_dir_close(dir);
+			g_free(devtype_path);
+		}
+
+		if (devtype_dir)
+			g_dir_close(devtype_dir);
+		g_free(driver_path);
+	}
+
+	g_dir_close(driver_dir);
+	return nr_prints;
+}
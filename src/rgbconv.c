@@ -0,0 +1,198 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Expansion of 8-bit grayscale image data into packed 24-bit RGB. On x86
+ * the fastest kernel supported by the running CPU is picked on first use;
+ * everything else uses the plain C loop. Minutiae are also drawn here, so
+ * that the headless tools render images the same way as the GUI. */
+
+#include <stddef.h>
+
+#ifdef HAVE_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+#include "fpd_core.h"
+
+static void gray_to_rgb_c(unsigned char *dst, const unsigned char *src,
+	size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		unsigned char pixel = src[i];
+		*dst++ = pixel;
+		*dst++ = pixel;
+		*dst++ = pixel;
+	}
+}
+
+#ifdef HAVE_SIMD_DISPATCH
+
+/* 16 pixels in, 48 bytes out: each output vector is one pshufb of the same
+ * input vector */
+__attribute__((target("ssse3")))
+static void gray_to_rgb_ssse3(unsigned char *dst, const unsigned char *src,
+	size_t n)
+{
+	const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2,
+		2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7,
+		8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13,
+		13, 13, 14, 14, 14, 15, 15, 15);
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+		_mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(v, m0));
+		_mm_storeu_si128((__m128i *) (dst + 16), _mm_shuffle_epi8(v, m1));
+		_mm_storeu_si128((__m128i *) (dst + 32), _mm_shuffle_epi8(v, m2));
+		dst += 48;
+	}
+
+	gray_to_rgb_c(dst, src + i, n - i);
+}
+
+/* vpshufb only shuffles within 128-bit lanes, so each 32-byte output vector
+ * is produced from a 16-byte window of the input (at offsets 0, 10 and 16)
+ * duplicated into both lanes */
+__attribute__((target("avx2")))
+static inline __m256i dup_window(const unsigned char *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(v), v, 1);
+}
+
+__attribute__((target("avx2")))
+static void gray_to_rgb_avx2(unsigned char *dst, const unsigned char *src,
+	size_t n)
+{
+	const __m256i m0 = _mm256_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2,
+		2, 3, 3, 3, 4, 4, 4, 5, 5, 5, 6, 6, 6, 7, 7, 7,
+		8, 8, 8, 9, 9, 9, 10, 10);
+	const __m256i m1 = _mm256_setr_epi8(0, 1, 1, 1, 2, 2, 2, 3,
+		3, 3, 4, 4, 4, 5, 5, 5, 6, 6, 6, 7, 7, 7, 8, 8,
+		8, 9, 9, 9, 10, 10, 10, 11);
+	const __m256i m2 = _mm256_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7,
+		8, 8, 8, 9, 9, 9, 10, 10, 10, 11, 11, 11, 12, 12, 12, 13,
+		13, 13, 14, 14, 14, 15, 15, 15);
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		const unsigned char *p = src + i;
+		_mm256_storeu_si256((__m256i *) dst,
+			_mm256_shuffle_epi8(dup_window(p), m0));
+		_mm256_storeu_si256((__m256i *) (dst + 32),
+			_mm256_shuffle_epi8(dup_window(p + 10), m1));
+		_mm256_storeu_si256((__m256i *) (dst + 64),
+			_mm256_shuffle_epi8(dup_window(p + 16), m2));
+		dst += 96;
+	}
+
+	gray_to_rgb_ssse3(dst, src + i, n - i);
+}
+
+#endif
+
+static gray_to_rgb_fn gray_to_rgb_impl = NULL;
+
+static gray_to_rgb_fn gray_to_rgb_select(void)
+{
+#ifdef HAVE_SIMD_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return gray_to_rgb_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return gray_to_rgb_ssse3;
+#endif
+	return gray_to_rgb_c;
+}
+
+/* expand n grayscale pixels at src into 3*n bytes at dst */
+void gray_to_rgb(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	if (!gray_to_rgb_impl)
+		gray_to_rgb_impl = gray_to_rgb_select();
+	gray_to_rgb_impl(dst, src, n);
+}
+
+/* List every kernel the running CPU supports, the plain C loop first, so
+ * that they can be checked against each other. kernels must have room for
+ * GRAY_TO_RGB_MAX_KERNELS entries. */
+int gray_to_rgb_kernels(struct gray_to_rgb_kernel *kernels)
+{
+	int n = 0;
+
+	kernels[n].name = "c";
+	kernels[n++].fn = gray_to_rgb_c;
+#ifdef HAVE_SIMD_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		kernels[n].name = "ssse3";
+		kernels[n++].fn = gray_to_rgb_ssse3;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		kernels[n].name = "avx2";
+		kernels[n++].fn = gray_to_rgb_avx2;
+	}
+#endif
+	return n;
+}
+
+/* draw a red cross centred on (x, y) of an RGB image */
+void plot_cross(unsigned char *rgbdata, int width, int x, int y)
+{
+	size_t pixel_offset = (y * width) + x;
+#define write_pixel(num) do { \
+		rgbdata[((num) * 3)] = 0xff; \
+		rgbdata[((num) * 3) + 1] = 0; \
+		rgbdata[((num) * 3) + 2] = 0; \
+	} while(0)
+
+	write_pixel(pixel_offset - 2);
+	write_pixel(pixel_offset - 1);
+	write_pixel(pixel_offset);
+	write_pixel(pixel_offset + 1);
+	write_pixel(pixel_offset + 2);
+
+	write_pixel(pixel_offset - (width * 2));
+	write_pixel(pixel_offset - (width * 1) - 1);
+	write_pixel(pixel_offset - (width * 1));
+	write_pixel(pixel_offset - (width * 1) + 1);
+	write_pixel(pixel_offset + (width * 1) - 1);
+	write_pixel(pixel_offset + (width * 1));
+	write_pixel(pixel_offset + (width * 1) + 1);
+	write_pixel(pixel_offset + (width * 2));
+#undef write_pixel
+}
+
+/* mark each minutia on an RGB image with a red cross */
+void plot_minutiae(unsigned char *rgbdata, int width, int height,
+	struct fp_minutia **minlist, int nr_minutiae)
+{
+	int i;
+
+	for (i = 0; i < nr_minutiae; i++) {
+		int x, y;
+
+		fp_minutia_get_coords(minlist[i], &x, &y);
+		plot_cross(rgbdata, width, x, y);
+	}
+}
@@ -0,0 +1,162 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* rgbconv_check: checks every grayscale to RGB kernel which the running
+ * CPU supports against a plain loop, byte for byte. Each kernel converts
+ * every length from 0 up to --max-len, at each combination of source and
+ * destination misalignment, and the bytes around the output are checked
+ * for having been left alone. Built and run by "make check". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+/* misalignments tried for each of source and destination */
+#define MAX_MISALIGN 16
+/* untouched bytes expected on either side of the output */
+#define GUARD 64
+#define GUARD_BYTE 0xa5
+
+static int max_len = 1024;
+static int seed = 1;
+
+static GOptionEntry entries[] = {
+	{ "max-len", 'n', 0, G_OPTION_ARG_INT, &max_len,
+		"Check every length up to N pixels (default 1024)", "N" },
+	{ "seed", 's', 0, G_OPTION_ARG_INT, &seed,
+		"Seed for the source pixels (default 1)", "SEED" },
+	{ NULL }
+};
+
+/* the loop the kernels replaced */
+static void reference(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		dst[i * 3] = src[i];
+		dst[i * 3 + 1] = src[i];
+		dst[i * 3 + 2] = src[i];
+	}
+}
+
+/* returns the number of mismatching runs, reporting the first few */
+static int check_kernel(const struct gray_to_rgb_kernel *kernel,
+	const unsigned char *pixels, unsigned char *expected, unsigned char *out)
+{
+	int failures = 0;
+	int len;
+	int sa;
+	int da;
+	int i;
+
+	for (len = 0; len <= max_len; len++) {
+		size_t out_len = (size_t) len * 3;
+
+		for (sa = 0; sa < MAX_MISALIGN; sa++) {
+			const unsigned char *src = pixels + sa;
+
+			reference(expected, src, len);
+			for (da = 0; da < MAX_MISALIGN; da++) {
+				unsigned char *dst = out + GUARD + da;
+
+				memset(out, GUARD_BYTE,
+					GUARD + MAX_MISALIGN + out_len + GUARD);
+				kernel->fn(dst, src, len);
+
+				for (i = 0; i < GUARD + da; i++)
+					if (out[i] != GUARD_BYTE)
+						break;
+				if (i == GUARD + da && !memcmp(dst, expected, out_len)) {
+					for (i = 0; i < GUARD; i++)
+						if (dst[out_len + i] != GUARD_BYTE)
+							break;
+					if (i == GUARD)
+						continue;
+				}
+
+				if (failures++ < 10)
+					printf("%s: mismatch at length %d, source offset %d, "
+						"destination offset %d\n", kernel->name, len, sa, da);
+			}
+		}
+	}
+
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	struct gray_to_rgb_kernel kernels[GRAY_TO_RGB_MAX_KERNELS];
+	GOptionContext *context;
+	GError *error = NULL;
+	unsigned char *pixels;
+	unsigned char *expected;
+	unsigned char *out;
+	GRand *rng;
+	int nr_kernels;
+	int failed = 0;
+	int i;
+
+	context = g_option_context_new("- check the grayscale to RGB kernels");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (max_len < 0) {
+		fprintf(stderr, "invalid length\n");
+		return 1;
+	}
+
+	rng = g_rand_new_with_seed(seed);
+	pixels = g_malloc(max_len + MAX_MISALIGN);
+	for (i = 0; i < max_len + MAX_MISALIGN; i++)
+		pixels[i] = g_rand_int_range(rng, 0, 256);
+	g_rand_free(rng);
+
+	expected = g_malloc((size_t) max_len * 3 + 1);
+	out = g_malloc(GUARD + MAX_MISALIGN + (size_t) max_len * 3 + GUARD);
+
+	nr_kernels = gray_to_rgb_kernels(kernels);
+	for (i = 0; i < nr_kernels; i++) {
+		int failures = check_kernel(&kernels[i], pixels, expected, out);
+
+		printf("%-6s %s", kernels[i].name, failures ? "FAILED" : "ok");
+		if (failures)
+			printf(" (%d of %d runs)", failures,
+				(max_len + 1) * MAX_MISALIGN * MAX_MISALIGN);
+		printf("\n");
+		if (failures)
+			failed = 1;
+	}
+
+	g_free(out);
+	g_free(expected);
+	g_free(pixels);
+	return failed;
+}
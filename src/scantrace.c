@@ -0,0 +1,224 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* End-to-end scan tracing. When FPD_SCAN_TRACE names a file, each verify,
+ * identify and enroll operation started from the GUI is timed from the
+ * start call to the stop completing and the scan being drawn, and one
+ * record per operation is appended to the file. The file is written as CSV
+ * if its name ends in ".csv" and as JSON lines otherwise.
+ * 
+ * Stages are recorded in microseconds since the start call, the first time
+ * they happen; for enrollment that is the first of its scans:
+ * 
+ *   started     the start call returned
+ *   callback    libfprint called back, in the device I/O thread
+ *   delivered   the callback reached the GUI
+ *   image       the callback came with an image
+ *   result      the result was shown
+ *   drawn       the scan image was shown
+ *   stopped     the stop completed
+ * 
+ * so callback is the time spent in the device, delivered - callback the
+ * hand-off to the GUI and drawn - delivered the rendering. A trace is
+ * written once everybody holding it has released it, as drawing may
+ * finish after the operation has stopped. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libfprint/fprint.h>
+
+#include "fpd_core.h"
+
+struct scan_trace {
+	const char *op;
+	const char *driver;
+	unsigned int seq;
+	GTimeVal wall_start;
+	gint64 start;
+	/* ns since start, -1 for stages which have not happened */
+	gint64 stages[NR_SCAN_STAGES];
+	int result;
+	gboolean have_result;
+	unsigned int nr_callbacks;
+	int holds;
+};
+
+static const char *stage_names[NR_SCAN_STAGES] = {
+	[SCAN_STARTED] = "started",
+	[SCAN_CALLBACK] = "callback",
+	[SCAN_DELIVERED] = "delivered",
+	[SCAN_IMAGE] = "image",
+	[SCAN_RESULT] = "result",
+	[SCAN_DRAWN] = "drawn",
+	[SCAN_STOPPED] = "stopped",
+};
+
+/* -1 until the environment has been looked at, then 0 or 1 */
+static int trace_enabled = -1;
+static gboolean trace_csv = FALSE;
+static FILE *trace_file = NULL;
+static unsigned int trace_seq = 0;
+
+static gboolean trace_open(void)
+{
+	const char *path;
+
+	if (trace_enabled >= 0)
+		return trace_enabled;
+
+	trace_enabled = 0;
+	path = g_getenv("FPD_SCAN_TRACE");
+	if (!path || !*path)
+		return FALSE;
+
+	trace_file = fopen(path, "a");
+	if (!trace_file) {
+		g_warning("couldn't open scan trace %s", path);
+		return FALSE;
+	}
+
+	trace_csv = g_str_has_suffix(path, ".csv");
+	if (trace_csv && ftell(trace_file) == 0) {
+		int i;
+
+		fprintf(trace_file, "op,seq,driver,start,result,callbacks");
+		for (i = 0; i < NR_SCAN_STAGES; i++)
+			fprintf(trace_file, ",%s_us", stage_names[i]);
+		fprintf(trace_file, "\n");
+	}
+
+	trace_enabled = 1;
+	return TRUE;
+}
+
+static void trace_write(struct scan_trace *trace)
+{
+	int i;
+
+	if (trace_csv) {
+		fprintf(trace_file, "%s,%u,%s,%ld.%06ld,", trace->op, trace->seq,
+			trace->driver, (long) trace->wall_start.tv_sec,
+			(long) trace->wall_start.tv_usec);
+		if (trace->have_result)
+			fprintf(trace_file, "%d", trace->result);
+		fprintf(trace_file, ",%u", trace->nr_callbacks);
+		for (i = 0; i < NR_SCAN_STAGES; i++) {
+			if (trace->stages[i] < 0)
+				fprintf(trace_file, ",");
+			else
+				fprintf(trace_file, ",%" G_GINT64_FORMAT,
+					trace->stages[i] / 1000);
+		}
+	} else {
+		fprintf(trace_file, "{\"op\":\"%s\",\"seq\":%u,\"driver\":\"%s\","
+			"\"start\":%ld.%06ld,", trace->op, trace->seq, trace->driver,
+			(long) trace->wall_start.tv_sec,
+			(long) trace->wall_start.tv_usec);
+		if (trace->have_result)
+			fprintf(trace_file, "\"result\":%d,", trace->result);
+		else
+			fprintf(trace_file, "\"result\":null,");
+		fprintf(trace_file, "\"callbacks\":%u", trace->nr_callbacks);
+		for (i = 0; i < NR_SCAN_STAGES; i++) {
+			if (trace->stages[i] < 0)
+				fprintf(trace_file, ",\"%s_us\":null", stage_names[i]);
+			else
+				fprintf(trace_file, ",\"%s_us\":%" G_GINT64_FORMAT,
+					stage_names[i], trace->stages[i] / 1000);
+		}
+		fprintf(trace_file, "}");
+	}
+
+	fprintf(trace_file, "\n");
+	fflush(trace_file);
+}
+
+/* Start tracing an operation on dev, just before its start call. Returns
+ * NULL when tracing is off; all the other functions accept NULL. The
+ * caller holds the trace until it releases it. */
+struct scan_trace *scan_trace_begin(const char *op, struct fp_dev *dev)
+{
+	struct scan_trace *trace;
+	int i;
+
+	if (!trace_open())
+		return NULL;
+
+	trace = g_slice_new0(struct scan_trace);
+	trace->op = op;
+	trace->driver = fp_driver_get_name(fp_dev_get_driver(dev));
+	trace->seq = ++trace_seq;
+	g_get_current_time(&trace->wall_start);
+	trace->start = loop_stats_now();
+	for (i = 0; i < NR_SCAN_STAGES; i++)
+		trace->stages[i] = -1;
+	trace->holds = 1;
+	return trace;
+}
+
+static void mark_at(struct scan_trace *trace, enum scan_stage stage,
+	gint64 when)
+{
+	if (trace->stages[stage] < 0)
+		trace->stages[stage] = MAX(when - trace->start, 0);
+}
+
+void scan_trace_mark(struct scan_trace *trace, enum scan_stage stage)
+{
+	if (trace)
+		mark_at(trace, stage, loop_stats_now());
+}
+
+/* Record a libfprint callback reaching the GUI. raised_at is when libfprint
+ * made it, from io_event_time(). */
+void scan_trace_callback(struct scan_trace *trace, gint64 raised_at,
+	int result, gboolean have_img)
+{
+	gint64 now;
+
+	if (!trace)
+		return;
+
+	now = loop_stats_now();
+	mark_at(trace, SCAN_CALLBACK, raised_at ? raised_at : now);
+	mark_at(trace, SCAN_DELIVERED, now);
+	if (have_img)
+		mark_at(trace, SCAN_IMAGE, now);
+	trace->result = result;
+	trace->have_result = TRUE;
+	trace->nr_callbacks++;
+}
+
+void scan_trace_hold(struct scan_trace *trace)
+{
+	if (trace)
+		trace->holds++;
+}
+
+/* drop a hold, writing the trace out once nobody holds it */
+void scan_trace_release(struct scan_trace *trace)
+{
+	if (!trace || --trace->holds > 0)
+		return;
+
+	trace_write(trace);
+	g_slice_free(struct scan_trace, trace);
+}
@@ -0,0 +1,337 @@
+/*
+ * fprint_demo: Demonstration of libfprint's capabilities
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Device sessions. Every open device gets its own window with a full set
+ * of tabs, so that several readers can be used at the same time. Each
+ * window is in a window group of its own, which keeps the modal dialogs of
+ * one session from blocking the others. */
+
+#include <gtk/gtk.h>
+#include <libfprint/fprint.h>
+
+#include "fprint_demo.h"
+
+#define for_each_tab_call_op(session, op) do { \
+		int __fe_tabno; \
+		for (__fe_tabno = 0; __fe_tabno < NR_TABS; __fe_tabno++) { \
+			const struct fpd_tab *__fe_tab = tabs[__fe_tabno]; \
+			if ((session)->tab_built[__fe_tabno] && __fe_tab->op) \
+				__fe_tab->op(session); \
+		} \
+	} while(0);
+
+static const struct fpd_tab *tabs[NR_TABS] = {
+	&enroll_tab,
+	&verify_tab,
+	&identify_tab,
+	&img_tab,
+};
+
+static GSList *sessions = NULL;
+
+static void session_status_update(struct fpd_session *session,
+	const char *status)
+{
+	gchar *msg = g_strdup_printf("<b>Status:</b> %s", status);
+	gtk_label_set_markup(GTK_LABEL(session->status_label), msg);
+	g_free(msg);
+}
+
+/* build a tab and bring it up to date with the session's device */
+static void session_build_tab(struct fpd_session *session, int tabno)
+{
+	const struct fpd_tab *tab = tabs[tabno];
+	GtkWidget *widget;
+
+	if (session->tab_built[tabno])
+		return;
+
+	widget = tab->create(session);
+	gtk_container_add(GTK_CONTAINER(session->tab_pages[tabno]), widget);
+	gtk_widget_show_all(widget);
+	session->tab_built[tabno] = TRUE;
+
+	tab->clear(session);
+	if (session->active && tab->activate_dev)
+		tab->activate_dev(session);
+}
+
+/* bring the window up to date with the newly opened device */
+static void session_dev_ready(struct fpd_session *session)
+{
+	struct fp_dev *dev = session->dev;
+	struct fp_driver *drv;
+	gchar *tmp;
+
+	session_status_update(session, "Device ready for use.");
+
+	drv = fp_dev_get_driver(dev);
+	tmp = g_strdup_printf("<b>Driver:</b> %s", fp_driver_get_name(drv));
+	gtk_label_set_markup(GTK_LABEL(session->drvname_label), tmp);
+	g_free(tmp);
+
+	if (fp_dev_supports_imaging(dev))
+		gtk_label_set_markup(GTK_LABEL(session->imgcapa_label),
+			"Imaging device");
+	else
+		gtk_label_set_markup(GTK_LABEL(session->imgcapa_label),
+			"Non-imaging device");
+
+	for_each_tab_call_op(session, activate_dev);
+	session->active = TRUE;
+}
+
+static void dev_open_cb(struct fp_dev *dev, int status, void *user_data)
+{
+	struct fpd_session *session = user_data;
+
+	gtk_widget_destroy(session->please_wait);
+	session->please_wait = NULL;
+	session->dev = dev;
+
+	/* only a device which opened properly is kept for reuse */
+	if (status == 0)
+		session->handle->dev = dev;
+
+	if (session->closing)
+		goto out;
+
+	if (status < 0)
+		session_status_update(session, "Could not open device.");
+	else
+		session_dev_ready(session);
+
+out:
+	session_op_end(session);
+}
+
+static void session_cb_switch_page(GtkNotebook *notebook,
+	GtkNotebookPage *page, guint page_num, gpointer user_data)
+{
+	session_build_tab(user_data, page_num);
+}
+
+static gboolean session_cb_delete(GtkWidget *widget, GdkEvent *event,
+	gpointer user_data)
+{
+	session_close(user_data);
+	return TRUE;
+}
+
+static void session_cb_close(GtkWidget *widget, gpointer user_data)
+{
+	session_close(user_data);
+}
+
+static void session_create_window(struct fpd_session *session,
+	const char *name)
+{
+	GtkWidget *main_vbox, *devbar_hbox, *dev_vbox, *button;
+	gchar *title;
+	int i;
+
+	session->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	title = g_strdup_printf("%s - fprint project demo v" VERSION, name);
+	gtk_window_set_title(GTK_WINDOW(session->window), title);
+	g_free(title);
+	g_signal_connect(G_OBJECT(session->window), "delete-event",
+		G_CALLBACK(session_cb_delete), session);
+
+	session->group = gtk_window_group_new();
+	gtk_window_group_add_window(session->group, GTK_WINDOW(session->window));
+
+	main_vbox = gtk_vbox_new(FALSE, 5);
+	gtk_container_add(GTK_CONTAINER(session->window), main_vbox);
+
+	/* Notebook, with a page for each tab to be built into when shown */
+	session->notebook = gtk_notebook_new();
+	gtk_box_pack_start_defaults(GTK_BOX(main_vbox), session->notebook);
+
+	for (i = 0; i < NR_TABS; i++) {
+		session->tab_pages[i] = gtk_vbox_new(FALSE, 0);
+		gtk_notebook_append_page(GTK_NOTEBOOK(session->notebook),
+			session->tab_pages[i], gtk_label_new(tabs[i]->name));
+	}
+	g_signal_connect(G_OBJECT(session->notebook), "switch-page",
+		G_CALLBACK(session_cb_switch_page), session);
+	session_build_tab(session,
+		gtk_notebook_get_current_page(GTK_NOTEBOOK(session->notebook)));
+
+	/* Device status */
+	devbar_hbox = gtk_hbox_new(FALSE, 3);
+	gtk_box_pack_end(GTK_BOX(main_vbox), devbar_hbox, FALSE, FALSE, 0);
+
+	dev_vbox = gtk_vbox_new(FALSE, 1);
+	gtk_box_pack_start_defaults(GTK_BOX(devbar_hbox), dev_vbox);
+
+	session->status_label = gtk_label_new(NULL);
+	gtk_box_pack_start_defaults(GTK_BOX(dev_vbox), session->status_label);
+
+	session->drvname_label = gtk_label_new(NULL);
+	gtk_box_pack_start_defaults(GTK_BOX(dev_vbox), session->drvname_label);
+
+	session->imgcapa_label = gtk_label_new(NULL);
+	gtk_box_pack_start_defaults(GTK_BOX(dev_vbox), session->imgcapa_label);
+
+	button = gtk_button_new_from_stock(GTK_STOCK_CLOSE);
+	g_signal_connect(G_OBJECT(button), "clicked",
+		G_CALLBACK(session_cb_close), session);
+	gtk_box_pack_start(GTK_BOX(devbar_hbox), button, FALSE, FALSE, 0);
+
+	gtk_widget_show_all(session->window);
+}
+
+/* Open a discovered device in a new session window, reusing the device
+ * of handle if it is still open from earlier. The device list must keep
+ * ddev alive until the open has completed. */
+struct fpd_session *session_open(struct dev_handle *handle,
+	struct fp_dscv_dev *ddev, const char *name)
+{
+	struct fpd_session *session;
+	int r;
+
+	session = g_slice_new0(struct fpd_session);
+	session->handle = dev_handle_ref(handle);
+	session_create_window(session, name);
+	sessions = g_slist_prepend(sessions, session);
+
+	if (dev_handle_acquire(handle)) {
+		session->dev = handle->dev;
+		session_dev_ready(session);
+		return session;
+	}
+
+	session->please_wait = run_please_wait_dialog(session->window,
+		"Opening device...");
+	r = io_dev_open(ddev, dev_open_cb, session);
+	if (r) {
+		gtk_widget_destroy(session->please_wait);
+		session->please_wait = NULL;
+		session_status_update(session, "Could not open device.");
+		return session;
+	}
+
+	session_op_begin(session);
+	return session;
+}
+
+void session_present(struct fpd_session *session)
+{
+	gtk_window_present(GTK_WINDOW(session->window));
+}
+
+static gboolean session_destroy(gpointer data)
+{
+	struct fpd_session *session = data;
+
+	for_each_tab_call_op(session, clear);
+	if (session->dev && session->dev != session->handle->dev)
+		io_dev_close(session->dev);
+	dev_handle_release(session->handle);
+	dev_handle_unref(session->handle);
+
+	sessions = g_slist_remove(sessions, session);
+	gtk_widget_destroy(session->window);
+	g_object_unref(session->group);
+	for_each_tab_call_op(session, destroy);
+	g_slice_free(struct fpd_session, session);
+	return FALSE;
+}
+
+/* Close the session's device and window. Operations which run until the
+ * user stops them are ended, anything else in progress is left to finish
+ * first, so that no callback arrives for a session which has gone. */
+void session_close(struct fpd_session *session)
+{
+	if (session->closing)
+		return;
+
+	session->closing = TRUE;
+	session->active = FALSE;
+	gtk_widget_set_sensitive(session->notebook, FALSE);
+	session_status_update(session, "Closing device...");
+
+	for_each_tab_call_op(session, stop);
+	if (session->busy == 0)
+		g_idle_add(session_destroy, session);
+}
+
+/* Tabs bracket every asynchronous operation on the device with these, so
+ * that the session is not closed underneath it. */
+void session_op_begin(struct fpd_session *session)
+{
+	session->busy++;
+}
+
+void session_op_end(struct fpd_session *session)
+{
+	g_assert(session->busy > 0);
+	if (--session->busy > 0)
+		return;
+
+	if (session->closing) {
+		g_idle_add(session_destroy, session);
+	} else if (session->refresh_pending) {
+		session->refresh_pending = FALSE;
+		if (session->active)
+			for_each_tab_call_op(session, refresh);
+	}
+}
+
+/* Called after the enrolled print cache has been updated for a device.
+ * Only sessions on the same kind of device share its prints. A session
+ * with an operation in progress may have handed prints to libfprint, so
+ * it is refreshed once the operation has ended. */
+void session_refresh_prints(struct fp_dev *dev)
+{
+	uint16_t driver_id = fp_driver_get_driver_id(fp_dev_get_driver(dev));
+	uint32_t devtype = fp_dev_get_devtype(dev);
+	GSList *elem;
+
+	for (elem = sessions; elem; elem = g_slist_next(elem)) {
+		struct fpd_session *session = elem->data;
+
+		if (!session->active || fp_driver_get_driver_id(
+				fp_dev_get_driver(session->dev)) != driver_id
+				|| fp_dev_get_devtype(session->dev) != devtype)
+			continue;
+
+		if (session->busy)
+			session->refresh_pending = TRUE;
+		else
+			for_each_tab_call_op(session, refresh);
+	}
+}
+
+/* close every device on exit, without waiting for operations to end */
+void sessions_exit(void)
+{
+	GSList *elem;
+
+	for (elem = sessions; elem; elem = g_slist_next(elem)) {
+		struct fpd_session *session = elem->data;
+
+		for_each_tab_call_op(session, clear);
+		if (session->dev && session->dev != session->handle->dev)
+			io_dev_close(session->dev);
+		session->dev = NULL;
+		dev_handle_release(session->handle);
+	}
+	dev_pool_exit();
+}
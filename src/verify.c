@@ -23,57 +23,94 @@
 
 #include "fprint_demo.h"
 
-static GtkWidget *vwin_verify_img;
-static GtkWidget *vwin_fingcombo;
-static GtkListStore *vwin_fingmodel;
-static GtkWidget *vwin_vfy_status;
-static GtkWidget *vwin_vfy_button;
-static GtkWidget *vwin_non_img_label;
-static GtkWidget *vwin_radio_normal;
-static GtkWidget *vwin_radio_bin;
-static GtkWidget *vwin_img_save_btn;
-static GtkWidget *vwin_ctrl_frame;
-static GtkWidget *vwin_show_minutiae;
-static GtkWidget *vwin_minutiae_cnt;
-
-static struct fp_img *img_normal = NULL;
-static struct fp_img *img_bin = NULL;
-static struct fp_print_data *enroll_data = NULL;
-
-static void vwin_vfy_status_no_print(void)
+struct vwin {
+	struct fpd_session *session;
+
+	GtkWidget *verify_img;
+	GtkWidget *fingcombo;
+	GtkListStore *fingmodel;
+	GtkWidget *vfy_status;
+	GtkWidget *vfy_button;
+	GtkWidget *non_img_label;
+	GtkWidget *radio_normal;
+	GtkWidget *radio_bin;
+	GtkWidget *img_save_btn;
+	GtkWidget *save_status;
+	GtkWidget *ctrl_frame;
+	GtkWidget *show_minutiae;
+	GtkWidget *minutiae_cnt;
+	GtkWidget *scan_dialog;
+	GtkWidget *please_wait;
+
+	/* template of the selected finger, in use by libfprint while
+	 * verifying, so only replaced once verification has stopped */
+	struct fp_print_data *enroll_data;
+	int enroll_finger;
+	gboolean verifying;
+	gboolean fing_change_pending;
+
+	/* analysis of the last scanned image, and the job producing the
+	 * analysis of a newer one */
+	struct img_analysis *analysis;
+	struct img_analysis_job *analysis_job;
+
+	/* trace of the running verification, and of the one whose image is
+	 * being analysed */
+	struct scan_trace *trace;
+	struct scan_trace *draw_trace;
+
+	/* image saves not yet completed, oldest first */
+	GSList *saves;
+};
+
+static void vwin_analysis_clear(struct vwin *vw)
+{
+	if (vw->analysis_job) {
+		img_analysis_cancel(vw->analysis_job);
+		vw->analysis_job = NULL;
+	}
+	scan_trace_release(vw->draw_trace);
+	vw->draw_trace = NULL;
+	img_analysis_free(vw->analysis);
+	vw->analysis = NULL;
+}
+
+static void vwin_vfy_status_no_print(struct vwin *vw)
 {
-	gtk_label_set_markup(GTK_LABEL(vwin_vfy_status),
+	gtk_label_set_markup(GTK_LABEL(vw->vfy_status),
 		"<b>Status:</b> No prints detected for this device.");
-	gtk_widget_set_sensitive(vwin_vfy_button, FALSE);
+	gtk_widget_set_sensitive(vw->vfy_button, FALSE);
 }
 
-static void vwin_fingcombo_select_first(void)
+static void vwin_fingcombo_select_first(struct vwin *vw)
 {
 	GtkTreeIter iter;
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(vwin_fingmodel), &iter))
-		gtk_combo_box_set_active_iter(GTK_COMBO_BOX(vwin_fingcombo), &iter);
+	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(vw->fingmodel), &iter))
+		gtk_combo_box_set_active_iter(GTK_COMBO_BOX(vw->fingcombo), &iter);
 	else
-		vwin_vfy_status_no_print();
+		vwin_vfy_status_no_print(vw);
 }
 
-static void vwin_clear(void)
+static void vwin_clear(struct fpd_session *session)
 {
-	fp_img_free(img_normal);
-	img_normal = NULL;
-	fp_img_free(img_bin);
-	img_bin = NULL;
-
-	fp_print_data_free(enroll_data);
-	enroll_data = NULL;
-
-	gtk_image_clear(GTK_IMAGE(vwin_verify_img));
-	gtk_widget_set_sensitive(vwin_img_save_btn, FALSE);
-	gtk_list_store_clear(GTK_LIST_STORE(vwin_fingmodel));
-
-	gtk_label_set_text(GTK_LABEL(vwin_vfy_status), NULL);
-	gtk_label_set_text(GTK_LABEL(vwin_minutiae_cnt), NULL);
-	gtk_widget_set_sensitive(vwin_fingcombo, FALSE);
-	gtk_widget_set_sensitive(vwin_vfy_button, FALSE);
+	struct vwin *vw = session->vwin;
+	vwin_analysis_clear(vw);
+
+	if (vw->verifying) {
+		vw->fing_change_pending = TRUE;
+	} else {
+		fp_print_data_free(vw->enroll_data);
+		vw->enroll_data = NULL;
+	}
+
+	gtk_image_clear(GTK_IMAGE(vw->verify_img));
+	gtk_widget_set_sensitive(vw->img_save_btn, FALSE);
+	gtk_list_store_clear(GTK_LIST_STORE(vw->fingmodel));
+
+	gtk_label_set_text(GTK_LABEL(vw->vfy_status), NULL);
+	gtk_label_set_text(GTK_LABEL(vw->minutiae_cnt), NULL);
+	gtk_widget_set_sensitive(vw->fingcombo, FALSE);
+	gtk_widget_set_sensitive(vw->vfy_button, FALSE);
 }
 
 enum fingcombo_cols {
@@ -82,126 +119,128 @@ enum fingcombo_cols {
 	FC_COL_FINGSTR,
 };
 
-static void vwin_refresh(void)
+/* add the enrolled fingers of the current device to the finger list */
+static void vwin_populate_fingers(struct vwin *vw)
+{
+	GtkTreeIter iter;
+	int fnum;
+
+	for (fnum = LEFT_THUMB; fnum <= RIGHT_LITTLE; fnum++) {
+		struct fpd_print *print = print_cache_lookup(vw->session->dev, fnum);
+		if (!print)
+			continue;
+
+		gtk_list_store_append(vw->fingmodel, &iter);
+		gtk_list_store_set(vw->fingmodel, &iter, FC_COL_PRINT, print,
+			FC_COL_FINGSTR, fingerstr(fnum), FC_COL_FINGNUM, fnum, -1);
+	}
+}
+
+static void vwin_refresh(struct fpd_session *session)
 {
-	struct fp_dscv_print *print;
+	struct vwin *vw = session->vwin;
 	GtkTreeIter iter;
 	int orig_fnum = -1;
-	int i = 0;
 	int fnum;
 
 	/* find and remember currently selected finger */
-	if (gtk_combo_box_get_active_iter(GTK_COMBO_BOX(vwin_fingcombo), &iter)) {
-		gtk_tree_model_get(GTK_TREE_MODEL(vwin_fingmodel), &iter,
+	if (gtk_combo_box_get_active_iter(GTK_COMBO_BOX(vw->fingcombo), &iter)) {
+		gtk_tree_model_get(GTK_TREE_MODEL(vw->fingmodel), &iter,
 			FC_COL_FINGNUM, &orig_fnum, -1);
 	}
 
 	/* re-populate list */
-	gtk_list_store_clear(GTK_LIST_STORE(vwin_fingmodel));
-	while ((print = fp_dscv_prints[i++])) {
-		if (!fp_dev_supports_dscv_print(fpdev, print))
-			continue;
-
-		fnum = fp_dscv_print_get_finger(print);
-		gtk_list_store_append(vwin_fingmodel, &iter);
-		gtk_list_store_set(vwin_fingmodel, &iter, FC_COL_PRINT, print,
-			FC_COL_FINGSTR, fingerstr(fnum), FC_COL_FINGNUM, fnum, -1);
-	}
+	gtk_list_store_clear(GTK_LIST_STORE(vw->fingmodel));
+	vwin_populate_fingers(vw);
 
 	/* try and select original again */
-	if (!gtk_tree_model_get_iter_first(GTK_TREE_MODEL(vwin_fingmodel), &iter)
+	if (!gtk_tree_model_get_iter_first(GTK_TREE_MODEL(vw->fingmodel), &iter)
 			|| orig_fnum == -1) {
-		vwin_fingcombo_select_first();
+		vwin_fingcombo_select_first(vw);
 		return;
 	}
 
 	do {
-		gtk_tree_model_get(GTK_TREE_MODEL(vwin_fingmodel), &iter,
+		gtk_tree_model_get(GTK_TREE_MODEL(vw->fingmodel), &iter,
 			FC_COL_FINGNUM, &fnum, -1);
 		if (fnum == orig_fnum) {
-			gtk_combo_box_set_active_iter(GTK_COMBO_BOX(vwin_fingcombo),
+			gtk_combo_box_set_active_iter(GTK_COMBO_BOX(vw->fingcombo),
 				&iter);
 			return;
 		}
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(vwin_fingmodel), &iter));
+	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(vw->fingmodel), &iter));
 
 	/* could not find original -- it may have been deleted */
-	vwin_fingcombo_select_first();
+	vwin_fingcombo_select_first(vw);
 }
 
-static void vwin_activate_dev(void)
+static void vwin_activate_dev(struct fpd_session *session)
 {
-	struct fp_dscv_print *print;
-	int i = 0;
-	g_assert(fpdev);
-	g_assert(fp_dscv_prints);
+	struct vwin *vw = session->vwin;
+	struct fp_dev *dev = session->dev;
 
-	while ((print = fp_dscv_prints[i++])) {
-		GtkTreeIter iter;
-		int fnum;
+	g_assert(dev);
 
-		if (!fp_dev_supports_dscv_print(fpdev, print))
-			continue;
+	vwin_populate_fingers(vw);
+	gtk_widget_set_sensitive(vw->fingcombo, TRUE);
+	vwin_fingcombo_select_first(vw);
 
-		fnum = fp_dscv_print_get_finger(print);
-		gtk_list_store_append(vwin_fingmodel, &iter);
-		gtk_list_store_set(vwin_fingmodel, &iter, FC_COL_PRINT, print,
-			FC_COL_FINGSTR, fingerstr(fnum), FC_COL_FINGNUM, fnum, -1);
-	}
-
-	gtk_widget_set_sensitive(vwin_fingcombo, TRUE);
-	vwin_fingcombo_select_first();
-
-	if (fp_dev_supports_imaging(fpdev)) {
-		int width = fp_dev_get_img_width(fpdev);
-		int height = fp_dev_get_img_height(fpdev);
-		gtk_widget_set_size_request(vwin_verify_img,
+	if (fp_dev_supports_imaging(dev)) {
+		int width = fp_dev_get_img_width(dev);
+		int height = fp_dev_get_img_height(dev);
+		gtk_widget_set_size_request(vw->verify_img,
 			(width == 0) ? 192 : width,
 			(height == 0) ? 192 : height);
-		gtk_widget_hide(vwin_non_img_label);
-		gtk_widget_show(vwin_verify_img);
-		gtk_widget_set_sensitive(vwin_ctrl_frame, TRUE);
+		gtk_widget_hide(vw->non_img_label);
+		gtk_widget_show(vw->verify_img);
+		gtk_widget_set_sensitive(vw->ctrl_frame, TRUE);
 	} else {
-		gtk_widget_show(vwin_non_img_label);
-		gtk_widget_hide(vwin_verify_img);
-		gtk_widget_set_sensitive(vwin_ctrl_frame, FALSE);
+		gtk_widget_show(vw->non_img_label);
+		gtk_widget_hide(vw->verify_img);
+		gtk_widget_set_sensitive(vw->ctrl_frame, FALSE);
 	}
 }
 
-static void vwin_vfy_status_print_loaded(int status)
+static void vwin_vfy_status_print_loaded(struct vwin *vw, int status)
 {
 	if (status == 0) {
-		gtk_label_set_markup(GTK_LABEL(vwin_vfy_status),
+		gtk_label_set_markup(GTK_LABEL(vw->vfy_status),
 			"<b>Status:</b> Ready for verify scan.");
-		gtk_widget_set_sensitive(vwin_vfy_button, TRUE);
+		gtk_widget_set_sensitive(vw->vfy_button, TRUE);
 	} else {
 		gchar *msg = g_strdup_printf("<b>Status:</b> Error %d, print corrupt?",
 			status);
-		gtk_label_set_markup(GTK_LABEL(vwin_vfy_status), msg);
-		gtk_widget_set_sensitive(vwin_vfy_button, FALSE);
+		gtk_label_set_markup(GTK_LABEL(vw->vfy_status), msg);
+		gtk_widget_set_sensitive(vw->vfy_button, FALSE);
 		g_free(msg);
 	}
 }
 
 static void vwin_cb_fing_changed(GtkWidget *widget, gpointer user_data)
 {
-	struct fp_dscv_print *dprint;
+	struct vwin *vw = user_data;
+	struct fpd_print *print;
 	GtkTreeIter iter;
 	int r;
 
-	fp_print_data_free(enroll_data);
-	enroll_data = NULL;
+	if (vw->verifying) {
+		vw->fing_change_pending = TRUE;
+		return;
+	}
 
-	if (!gtk_combo_box_get_active_iter(GTK_COMBO_BOX(vwin_fingcombo), &iter))
+	fp_print_data_free(vw->enroll_data);
+	vw->enroll_data = NULL;
+
+	if (!gtk_combo_box_get_active_iter(GTK_COMBO_BOX(vw->fingcombo), &iter))
 		return;
 
-	gtk_tree_model_get(GTK_TREE_MODEL(vwin_fingmodel), &iter,
-		FC_COL_PRINT, &dprint, -1);
-	r = fp_print_data_from_dscv_print(dprint, &enroll_data);
-	vwin_vfy_status_print_loaded(r);
+	gtk_tree_model_get(GTK_TREE_MODEL(vw->fingmodel), &iter,
+		FC_COL_PRINT, &print, FC_COL_FINGNUM, &vw->enroll_finger, -1);
+	r = print_cache_load(vw->session->dev, print, &vw->enroll_data);
+	vwin_vfy_status_print_loaded(vw, r);
 }
 
-static void vwin_vfy_status_verify_result(int code)
+static void vwin_vfy_status_verify_result(struct vwin *vw, int code)
 {
 	const char *msgs[] = {
 		[FP_VERIFY_NO_MATCH] = "Finger does not match.",
@@ -215,148 +254,148 @@ static void vwin_vfy_status_verify_result(int code)
 
 	if (code < 0) {
 		msg = g_strdup_printf("<b>Status:</b> Scan failed, error %d", code);
-		gtk_label_set_text(GTK_LABEL(vwin_minutiae_cnt), NULL);
+		gtk_label_set_text(GTK_LABEL(vw->minutiae_cnt), NULL);
 	} else {
 		msg = g_strdup_printf("<b>Status:</b> %s", msgs[code]);
 	}
 
-	gtk_label_set_markup(GTK_LABEL(vwin_vfy_status), msg);
+	gtk_label_set_markup(GTK_LABEL(vw->vfy_status), msg);
 	g_free(msg);
 }
 
-static void plot_minutiae(unsigned char *rgbdata, int width, int height,
-	struct fp_minutia **minlist, int nr_minutiae)
-{
-	int i;
-#define write_pixel(num) do { \
-		rgbdata[((num) * 3)] = 0xff; \
-		rgbdata[((num) * 3) + 1] = 0; \
-		rgbdata[((num) * 3) + 2] = 0; \
-	} while(0)
-
-	for (i = 0; i < nr_minutiae; i++) {
-		struct fp_minutia *min = minlist[i];
-		int x, y;
-		size_t pixel_offset;
-
-		fp_minutia_get_coords(min, &x, &y);
-		pixel_offset = (y * width) + x;
-		write_pixel(pixel_offset - 2);
-		write_pixel(pixel_offset - 1);
-		write_pixel(pixel_offset);
-		write_pixel(pixel_offset + 1);
-		write_pixel(pixel_offset + 2);
-
-		write_pixel(pixel_offset - (width * 2));
-		write_pixel(pixel_offset - (width * 1) - 1);
-		write_pixel(pixel_offset - (width * 1));
-		write_pixel(pixel_offset - (width * 1) + 1);
-		write_pixel(pixel_offset + (width * 1) - 1);
-		write_pixel(pixel_offset + (width * 1));
-		write_pixel(pixel_offset + (width * 1) + 1);
-		write_pixel(pixel_offset + (width * 2));
-	}
-}
-
-static void vwin_img_draw(void)
+static void vwin_img_draw(struct vwin *vw)
 {
-	struct fp_minutia **minlist;
-	unsigned char *rgbdata;
-	GdkPixbuf *pixbuf;
 	gchar *tmp;
-	int nr_minutiae;
-	int width;
-	int height;
+	int binarized;
+	int minutiae;
 
-	if (!img_normal || !img_bin)
+	if (!vw->analysis)
 		return;
 
-	minlist = fp_img_get_minutiae(img_normal, &nr_minutiae);
-
-	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(vwin_radio_normal)))
-		rgbdata = img_to_rgbdata(img_normal);
-	else
-		rgbdata = img_to_rgbdata(img_bin);
+	binarized = !gtk_toggle_button_get_active(
+		GTK_TOGGLE_BUTTON(vw->radio_normal));
+	minutiae = gtk_toggle_button_get_active(
+		GTK_TOGGLE_BUTTON(vw->show_minutiae));
+	if (!vw->analysis->pixbufs[binarized][minutiae])
+		return;
 
-	width = fp_img_get_width(img_normal);
-	height = fp_img_get_height(img_normal);
-	gtk_widget_set_size_request(vwin_verify_img, width, height);
+	gtk_widget_set_size_request(vw->verify_img, vw->analysis->width,
+		vw->analysis->height);
 
-	tmp = g_strdup_printf("Detected %d minutiae.", nr_minutiae);
-	gtk_label_set_text(GTK_LABEL(vwin_minutiae_cnt), tmp);
+	tmp = g_strdup_printf("Detected %d minutiae.", vw->analysis->nr_minutiae);
+	gtk_label_set_text(GTK_LABEL(vw->minutiae_cnt), tmp);
 	g_free(tmp);
 
-	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(vwin_show_minutiae)))
-		plot_minutiae(rgbdata, width, height, minlist, nr_minutiae);
+	gtk_image_set_from_pixbuf(GTK_IMAGE(vw->verify_img),
+		vw->analysis->pixbufs[binarized][minutiae]);
+	gtk_widget_set_sensitive(vw->img_save_btn, TRUE);
+}
 
-	pixbuf = gdk_pixbuf_new_from_data(rgbdata, GDK_COLORSPACE_RGB,
-			FALSE, 8, width, height, width * 3, pixbuf_destroy, NULL);
-	gtk_image_set_from_pixbuf(GTK_IMAGE(vwin_verify_img), pixbuf);
-	g_object_unref(pixbuf);
+static void vwin_analysis_done(struct img_analysis *_analysis,
+	void *user_data)
+{
+	struct vwin *vw = user_data;
+
+	vw->analysis_job = NULL;
+	img_analysis_free(vw->analysis);
+	vw->analysis = _analysis;
+	vwin_img_draw(vw);
 
-	gtk_widget_set_sensitive(vwin_img_save_btn, TRUE);
+	scan_trace_mark(vw->draw_trace, SCAN_DRAWN);
+	scan_trace_release(vw->draw_trace);
+	vw->draw_trace = NULL;
 }
 
 static void vwin_cb_imgfmt_toggled(GtkWidget *widget, gpointer data)
 {
-	vwin_img_draw();
+	struct vwin *vw = data;
+	vwin_img_draw(vw);
 }
 
 static void verify_stopped_cb(struct fp_dev *dev, void *user_data)
 {
-	gtk_widget_destroy(GTK_WIDGET(user_data));
+	struct vwin *vw = user_data;
+
+	gtk_widget_destroy(vw->please_wait);
+	vw->please_wait = NULL;
+	scan_trace_mark(vw->trace, SCAN_STOPPED);
+	scan_trace_release(vw->trace);
+	vw->trace = NULL;
+
+	/* pick up a finger selected or changed while verifying */
+	vw->verifying = FALSE;
+	if (vw->fing_change_pending) {
+		vw->fing_change_pending = FALSE;
+		vwin_cb_fing_changed(vw->fingcombo, vw);
+	}
+	session_op_end(vw->session);
 }
 
-static void verify_cb(struct fp_dev *dev, int result, struct fp_img *img,
-	void *user_data)
+static void vwin_verify_stop(struct vwin *vw)
 {
-	GtkWidget *dialog;
 	int r;
 
-	destroy_scan_finger_dialog(GTK_WIDGET(user_data));
-	vwin_vfy_status_verify_result(result);
+	vw->please_wait = run_please_wait_dialog(vw->session->window,
+		"Ending verification...");
+	r = io_verify_stop(vw->session->dev, verify_stopped_cb, vw);
+	if (r < 0)
+		verify_stopped_cb(vw->session->dev, vw);
+}
 
-	fp_img_free(img_normal);
-	img_normal = NULL;
-	fp_img_free(img_bin);
-	img_bin = NULL;
+static void verify_cb(struct fp_dev *dev, int result, struct fp_img *img,
+	void *user_data)
+{
+	struct vwin *vw = user_data;
 
+	scan_trace_callback(vw->trace, io_event_time(), result, img != NULL);
+	frame_record(dev, FRAME_VERIFY, vw->enroll_finger, result, img);
+	destroy_scan_finger_dialog(vw->scan_dialog);
+	vw->scan_dialog = NULL;
+	vwin_vfy_status_verify_result(vw, result);
+	scan_trace_mark(vw->trace, SCAN_RESULT);
+
+	/* a new scan supersedes any analysis still in progress */
+	vwin_analysis_clear(vw);
 	if (img) {
-		img_normal = img;
-		img_bin = fp_img_binarize(img);
-		vwin_img_draw();
+		gtk_label_set_text(GTK_LABEL(vw->minutiae_cnt),
+			"Analysing image...");
+		vw->analysis_job = img_analysis_submit(img, vwin_analysis_done, vw);
+		vw->draw_trace = vw->trace;
+		scan_trace_hold(vw->draw_trace);
 	}
 
-	dialog = run_please_wait_dialog("Ending verification...");
-	r = fp_async_verify_stop(dev, verify_stopped_cb, dialog);
-	if (r < 0)
-		gtk_widget_destroy(dialog);
+	vwin_verify_stop(vw);
 }
 
 static void scan_finger_response(GtkWidget *dialog, gint arg,
 	gpointer user_data)
 {
-	int r;
+	struct vwin *vw = user_data;
 
 	destroy_scan_finger_dialog(dialog);
-	dialog = run_please_wait_dialog("Ending verification...");
-	r = fp_async_verify_stop(fpdev, verify_stopped_cb, dialog);
-	if (r < 0)
-		gtk_widget_destroy(dialog);
+	vw->scan_dialog = NULL;
+	vwin_verify_stop(vw);
 }
 
 static void vwin_cb_verify(GtkWidget *widget, gpointer user_data)
 {
+	struct vwin *vw = user_data;
 	GtkWidget *dialog;
 	int r;
 
-	gtk_widget_set_sensitive(vwin_img_save_btn, FALSE);
+	gtk_widget_set_sensitive(vw->img_save_btn, FALSE);
 
-	dialog = create_scan_finger_dialog();
-	r = fp_async_verify_start(fpdev, enroll_data, verify_cb, dialog);
+	dialog = create_scan_finger_dialog(vw->session->window);
+	vw->trace = scan_trace_begin("verify", vw->session->dev);
+	r = io_verify_start(vw->session->dev, vw->enroll_data, verify_cb,
+		vw);
+	scan_trace_mark(vw->trace, SCAN_STARTED);
 	if (r < 0) {
+		scan_trace_release(vw->trace);
+		vw->trace = NULL;
 		destroy_scan_finger_dialog(dialog);
-		dialog = gtk_message_dialog_new_with_markup(GTK_WINDOW(mwin_window),
+		dialog = gtk_message_dialog_new_with_markup(
+			GTK_WINDOW(vw->session->window),
 			GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
 			GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
 			"Could not start verification, error %d", r, NULL);
@@ -365,21 +404,50 @@ static void vwin_cb_verify(GtkWidget *widget, gpointer user_data)
 		return;
 	}
 
+	session_op_begin(vw->session);
+	vw->verifying = TRUE;
+	vw->scan_dialog = dialog;
 	g_signal_connect(dialog, "response", G_CALLBACK(scan_finger_response),
-		NULL);
+		vw);
 	run_scan_finger_dialog(dialog);
 }
 
+static void vwin_save_status(struct vwin *vw, const char *fmt,
+	const char *path, const char *detail)
+{
+	gchar *name = g_filename_display_basename(path);
+	gchar *msg = g_strdup_printf(fmt, name, detail);
+
+	gtk_label_set_text(GTK_LABEL(vw->save_status), msg);
+	g_free(msg);
+	g_free(name);
+}
+
+static void vwin_save_done(const char *path, int result, void *user_data)
+{
+	struct vwin *vw = user_data;
+
+	/* saves are written one at a time, in order */
+	vw->saves = g_slist_delete_link(vw->saves, vw->saves);
+	if (result < 0)
+		vwin_save_status(vw, "Could not save %s: %s", path,
+			g_strerror(-result));
+	else
+		vwin_save_status(vw, "Saved %s.", path, NULL);
+}
+
+/* Saves the 8-bit image behind the current view, as PGM if the name ends
+ * in .pgm and PNG otherwise. Minutiae are not drawn in. */
 static void vwin_cb_img_save(GtkWidget *widget, gpointer user_data)
 {
-	GdkPixbuf *pixbuf = gtk_image_get_pixbuf(GTK_IMAGE(vwin_verify_img));
+	struct vwin *vw = user_data;
+	struct img_save_job *job;
+	struct fp_img *img;
 	GtkWidget *dialog;
 	gchar *filename;
-	GError *error = NULL;
-
-	g_assert(pixbuf);
 
-	dialog = gtk_file_chooser_dialog_new("Save Image", GTK_WINDOW(mwin_window),
+	dialog = gtk_file_chooser_dialog_new("Save Image",
+		GTK_WINDOW(vw->session->window),
 		GTK_FILE_CHOOSER_ACTION_SAVE,
 		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
 		GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
@@ -396,14 +464,23 @@ static void vwin_cb_img_save(GtkWidget *widget, gpointer user_data)
 
 	filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 	gtk_widget_destroy(dialog);
-	if (!gdk_pixbuf_save(pixbuf, filename, "png", &error, NULL)) {
-		dialog = gtk_message_dialog_new(GTK_WINDOW(mwin_window),
-			GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
-			GTK_BUTTONS_CLOSE, error->message);
-		gtk_dialog_run(GTK_DIALOG(dialog));
-		gtk_widget_destroy(dialog);
-		g_error_free(error);
+
+	/* the image may have been replaced while the dialog was up */
+	if (!vw->analysis) {
+		g_free(filename);
+		return;
 	}
+
+	img = vw->analysis->img;
+	if (vw->analysis->img_bin && !gtk_toggle_button_get_active(
+			GTK_TOGGLE_BUTTON(vw->radio_normal)))
+		img = vw->analysis->img_bin;
+
+	job = img_save_submit(filename, img_save_format_for(filename),
+		fp_img_get_data(img), fp_img_get_width(img),
+		fp_img_get_height(img), vwin_save_done, vw);
+	vw->saves = g_slist_append(vw->saves, job);
+	vwin_save_status(vw, "Saving %s...", filename, NULL);
 	g_free(filename);
 }
 
@@ -416,14 +493,19 @@ static gint fing_sort(GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b,
 	return num1 - num2;
 }
 
-static GtkWidget *vwin_create(void)
+static GtkWidget *vwin_create(struct fpd_session *session)
 {
+	struct vwin *vw;
 	GtkCellRenderer *renderer;
 	GtkWidget *ui_vbox;
 	GtkWidget *label, *vfy_vbox, *vfy_frame, *scan_frame, *img_vbox;
 	GtkWidget *vwin_ctrl_vbox;
 	GtkWidget *vwin_main_hbox;
 
+	vw = g_slice_new0(struct vwin);
+	vw->session = session;
+	session->vwin = vw;
+
 	vwin_main_hbox = gtk_hbox_new(FALSE, 1);
 
 	/* Image frame */
@@ -435,13 +517,13 @@ static GtkWidget *vwin_create(void)
 	gtk_container_add(GTK_CONTAINER(scan_frame), img_vbox);
 
 	/* Image */
-	vwin_verify_img = gtk_image_new();
-	gtk_box_pack_start(GTK_BOX(img_vbox), vwin_verify_img, TRUE, FALSE, 0);
+	vw->verify_img = gtk_image_new();
+	gtk_box_pack_start(GTK_BOX(img_vbox), vw->verify_img, TRUE, FALSE, 0);
 
 	/* Non-imaging device */
-	vwin_non_img_label = gtk_label_new("This device does not have imaging "
+	vw->non_img_label = gtk_label_new("This device does not have imaging "
 		"capabilities, no images will be displayed.");
-	gtk_box_pack_start_defaults(GTK_BOX(img_vbox), vwin_non_img_label);
+	gtk_box_pack_start_defaults(GTK_BOX(img_vbox), vw->non_img_label);
 
 	/* vbox for verification status and image control frames */
 	ui_vbox = gtk_vbox_new(FALSE, 1);
@@ -457,78 +539,97 @@ static GtkWidget *vwin_create(void)
 	/* Discovered prints list */
 	label = gtk_label_new("Select a finger to verify:");
 	gtk_box_pack_start(GTK_BOX(vfy_vbox), label, FALSE, FALSE, 0);
-	vwin_fingmodel = gtk_list_store_new(3, G_TYPE_POINTER, G_TYPE_INT,
+	vw->fingmodel = gtk_list_store_new(3, G_TYPE_POINTER, G_TYPE_INT,
 		G_TYPE_STRING);
-	vwin_fingcombo =
-		gtk_combo_box_new_with_model(GTK_TREE_MODEL(vwin_fingmodel));
-	g_signal_connect(G_OBJECT(vwin_fingcombo), "changed",
-		G_CALLBACK(vwin_cb_fing_changed), NULL);
-	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(vwin_fingmodel), 0,
+	vw->fingcombo =
+		gtk_combo_box_new_with_model(GTK_TREE_MODEL(vw->fingmodel));
+	g_signal_connect(G_OBJECT(vw->fingcombo), "changed",
+		G_CALLBACK(vwin_cb_fing_changed), vw);
+	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(vw->fingmodel), 0,
 		fing_sort, NULL, NULL);
-	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(vwin_fingmodel),
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(vw->fingmodel),
 		0, GTK_SORT_ASCENDING);
 
 	renderer = gtk_cell_renderer_text_new();
-	gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(vwin_fingcombo), renderer, TRUE);
-	gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(vwin_fingcombo), renderer,
+	gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(vw->fingcombo), renderer, TRUE);
+	gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(vw->fingcombo), renderer,
 		"text", FC_COL_FINGSTR, NULL);
-	gtk_box_pack_start(GTK_BOX(vfy_vbox), vwin_fingcombo, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vfy_vbox), vw->fingcombo, FALSE, FALSE, 0);
 
 	/* Verify button */
-	vwin_vfy_button = gtk_button_new_with_label("Verify");
-	g_signal_connect(G_OBJECT(vwin_vfy_button), "clicked",
-		G_CALLBACK(vwin_cb_verify), NULL);
-	gtk_box_pack_start(GTK_BOX(vfy_vbox), vwin_vfy_button, FALSE, FALSE, 0);
+	vw->vfy_button = gtk_button_new_with_label("Verify");
+	g_signal_connect(G_OBJECT(vw->vfy_button), "clicked",
+		G_CALLBACK(vwin_cb_verify), vw);
+	gtk_box_pack_start(GTK_BOX(vfy_vbox), vw->vfy_button, FALSE, FALSE, 0);
 
 	/* Verify status */
-	vwin_vfy_status = gtk_label_new(NULL);
-	gtk_box_pack_start(GTK_BOX(vfy_vbox), vwin_vfy_status, FALSE, FALSE, 0);
+	vw->vfy_status = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(vfy_vbox), vw->vfy_status, FALSE, FALSE, 0);
 
 	/* Minutiae count */
-	vwin_minutiae_cnt = gtk_label_new(NULL);
-	gtk_box_pack_start(GTK_BOX(vfy_vbox), vwin_minutiae_cnt, FALSE, FALSE, 0);
+	vw->minutiae_cnt = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(vfy_vbox), vw->minutiae_cnt, FALSE, FALSE, 0);
 
 	/* Image controls frame */
-	vwin_ctrl_frame = gtk_frame_new("Image control");
-	gtk_box_pack_end_defaults(GTK_BOX(ui_vbox), vwin_ctrl_frame);
+	vw->ctrl_frame = gtk_frame_new("Image control");
+	gtk_box_pack_end_defaults(GTK_BOX(ui_vbox), vw->ctrl_frame);
 
 	vwin_ctrl_vbox = gtk_vbox_new(FALSE, 1);
-	gtk_container_add(GTK_CONTAINER(vwin_ctrl_frame), vwin_ctrl_vbox);
+	gtk_container_add(GTK_CONTAINER(vw->ctrl_frame), vwin_ctrl_vbox);
 
 	/* Image format radio buttons */
-	vwin_radio_normal = gtk_radio_button_new_with_label(NULL, "Normal");
-	g_signal_connect(G_OBJECT(vwin_radio_normal), "toggled",
-		G_CALLBACK(vwin_cb_imgfmt_toggled), NULL);
-	gtk_box_pack_start(GTK_BOX(vwin_ctrl_vbox), vwin_radio_normal, FALSE,
+	vw->radio_normal = gtk_radio_button_new_with_label(NULL, "Normal");
+	g_signal_connect(G_OBJECT(vw->radio_normal), "toggled",
+		G_CALLBACK(vwin_cb_imgfmt_toggled), vw);
+	gtk_box_pack_start(GTK_BOX(vwin_ctrl_vbox), vw->radio_normal, FALSE,
 		FALSE, 0);
 
-	vwin_radio_bin = gtk_radio_button_new_with_label_from_widget(
-		GTK_RADIO_BUTTON(vwin_radio_normal), "Binarized");
-	gtk_box_pack_start(GTK_BOX(vwin_ctrl_vbox), vwin_radio_bin, FALSE,
+	vw->radio_bin = gtk_radio_button_new_with_label_from_widget(
+		GTK_RADIO_BUTTON(vw->radio_normal), "Binarized");
+	gtk_box_pack_start(GTK_BOX(vwin_ctrl_vbox), vw->radio_bin, FALSE,
 		FALSE, 0);
 
 	/* Minutiae plotting */
-	vwin_show_minutiae = gtk_check_button_new_with_label("Show minutiae");
-	g_signal_connect(GTK_OBJECT(vwin_show_minutiae), "toggled",
-		G_CALLBACK(vwin_cb_imgfmt_toggled), NULL);
-	gtk_box_pack_start(GTK_BOX(vwin_ctrl_vbox), vwin_show_minutiae, FALSE,
+	vw->show_minutiae = gtk_check_button_new_with_label("Show minutiae");
+	g_signal_connect(GTK_OBJECT(vw->show_minutiae), "toggled",
+		G_CALLBACK(vwin_cb_imgfmt_toggled), vw);
+	gtk_box_pack_start(GTK_BOX(vwin_ctrl_vbox), vw->show_minutiae, FALSE,
 		FALSE, 0);
 
 	/* Save image */
-	vwin_img_save_btn = gtk_button_new_from_stock(GTK_STOCK_SAVE);
-	g_signal_connect(G_OBJECT(vwin_img_save_btn), "clicked",
-		G_CALLBACK(vwin_cb_img_save), NULL);
-	gtk_box_pack_end(GTK_BOX(vwin_ctrl_vbox), vwin_img_save_btn, FALSE,
+	vw->img_save_btn = gtk_button_new_from_stock(GTK_STOCK_SAVE);
+	g_signal_connect(G_OBJECT(vw->img_save_btn), "clicked",
+		G_CALLBACK(vwin_cb_img_save), vw);
+	gtk_box_pack_end(GTK_BOX(vwin_ctrl_vbox), vw->img_save_btn, FALSE,
+		FALSE, 0);
+
+	/* Save progress */
+	vw->save_status = gtk_label_new(NULL);
+	gtk_label_set_ellipsize(GTK_LABEL(vw->save_status),
+		PANGO_ELLIPSIZE_START);
+	gtk_box_pack_end(GTK_BOX(vwin_ctrl_vbox), vw->save_status, FALSE,
 		FALSE, 0);
 
 	return vwin_main_hbox;
 }
 
+static void vwin_destroy(struct fpd_session *session)
+{
+	struct vwin *vw = session->vwin;
+
+	/* pending saves are still written, but not reported */
+	g_slist_foreach(vw->saves, (GFunc) img_save_cancel, NULL);
+	g_slist_free(vw->saves);
+	g_slice_free(struct vwin, session->vwin);
+	session->vwin = NULL;
+}
+
 struct fpd_tab verify_tab = {
 	.name = "Verify",
 	.create = vwin_create,
 	.activate_dev = vwin_activate_dev,
 	.clear = vwin_clear,
 	.refresh = vwin_refresh,
+	.destroy = vwin_destroy,
 };
 